@@ -0,0 +1,78 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>
+#include <vector>
+
+
+
+//==============================================================================
+//
+// Arena of the scratch memory of a run: the moments and the results of the
+// traces, the buffers of the lags, the partial sums of the threads. The memory
+// is taken from large blocks by moving a pointer, and it's given back all at
+// once by returning to a mark, so the blocks are reused by the following
+// requests, and the loops which take and give back the same amounts don't
+// touch the heap after their first iteration. The arrays are aligned to the
+// cache lines, and they aren't initialized.
+//
+//==============================================================================
+class Arena
+{
+public:
+
+  /// Position in the arena
+  struct Mark
+  {
+    size_t block, used, before;
+  };
+
+  explicit Arena(size_t block_bytes = 1 << 20);
+
+  ~Arena();
+
+  /// Array of n values of type T
+  template <typename T>
+  T* allocate(size_t n)
+  {
+    return static_cast<T*>(allocate_bytes(n * sizeof(T)));
+  }
+
+  Mark mark() const;
+
+  /// Give back everything which was allocated after the mark
+  void release(const Mark &m);
+
+  /// Number of the blocks taken from the heap (for the profile)
+  size_t n_blocks() const { return _blocks.size(); }
+
+  /// The largest amount of memory which was in use at once
+  size_t peak_bytes() const { return _peak; }
+
+protected:
+
+  struct Block
+  {
+    char *data;
+    size_t size;
+  };
+
+  std::vector<Block> _blocks;
+
+  /// The current block and the number of its bytes in use
+  size_t _current, _used;
+
+  /// Bytes in use in the blocks before the current one
+  size_t _before;
+
+  size_t _block_bytes, _peak;
+
+  void* allocate_bytes(size_t bytes);
+
+  Arena(const Arena&);
+  Arena& operator =(const Arena&);
+};
+
+
+
+#endif // ARENA_HPP
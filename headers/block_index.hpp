@@ -0,0 +1,119 @@
+#ifndef BLOCK_INDEX_HPP
+#define BLOCK_INDEX_HPP
+
+#include "conversion.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class BlockReader;
+
+
+
+/// Hash and sums of the values of a block of rows
+struct BlockStats
+{
+  uint64_t hash; ///< hash of the bytes of the values (in the native order)
+  double   sum2; ///< sum of the squares of the values
+  double   sum1; ///< sum of the absolute values
+  uint64_t known; ///< 1 if the block was hashed, 0 otherwise
+};
+
+/// Version of the format of the index files
+const uint32_t INDEX_VERSION = 3;
+
+/// Tag of the order of bytes of the index files (it reads differently, if the
+/// index was written on a machine of another order)
+const uint32_t INDEX_BYTE_ORDER = 0x01020304;
+
+/// Header of an index file
+struct IndexHeader
+{
+  char     magic[4];   ///< "L2I1"
+  uint32_t version;    ///< INDEX_VERSION
+  uint32_t byte_order; ///< INDEX_BYTE_ORDER in the order of the machine
+  uint32_t type;       ///< ElementType of the values
+  uint32_t format;     ///< FileFormat of the indexed file
+  uint32_t swapped;    ///< 1 if the values were byte-swapped when read
+  uint64_t n_rows;     ///< number of rows in the table
+  uint64_t n_cols;     ///< number of columns in the table
+  uint64_t block_rows; ///< number of rows in every block but the last one
+  uint64_t file_size;  ///< size of the indexed file
+  int64_t  file_time;  ///< time of the last modification of the indexed file
+                       ///< (in nanoseconds)
+};
+
+/**
+ * Fast non-cryptographic 64-bit hash of the bytes (in the manner of xxHash64:
+ * four independent lanes of multiply-rotate rounds over 8-byte words).
+ */
+uint64_t hash_bytes(const char *bytes, size_t n_bytes);
+
+/**
+ * Compute the hash and the sums of the n_values values of the given type.
+ */
+BlockStats block_stats(const char *values, long long n_values,
+                       ElementType type);
+
+
+
+//==============================================================================
+//
+// Index of the blocks of rows of a file. The blocks begin at the multiples of
+// BlockReader::rows_per_block(n_cols) rows, so the blocks of files with the
+// same number of columns correspond to each other, and if their hashes (of the
+// values of the same type) are equal, the blocks are equal, and there is no
+// need to read them for comparison.
+//
+// The index is stored next to the file (<file>.l2i), and it's built lazily:
+// the blocks which are read completely are hashed on the fly, and the index
+// is saved when the computations are done. The index is ignored if the file
+// was changed after that (by its size and the time of its modification in
+// nanoseconds), or if the index was written by another version, or on a
+// machine of another order of bytes (the hashes and sums are in the order of
+// the machine), or if the file was read in another way (the hashes and sums
+// are of the values as they're converted by the reader).
+//
+//==============================================================================
+class BlockIndex
+{
+public:
+
+  /// Load the index of the file opened by the reader, or start an empty one
+  BlockIndex(const BlockReader &in);
+
+  /// Name of the index file of the given file
+  static std::string index_name(const std::string &filename);
+
+  int block_rows() const { return _header.block_rows; }
+  ElementType type() const { return (ElementType)_header.type; }
+
+  /// Stats of the block, or nullptr if the block hasn't been hashed yet
+  const BlockStats* stats(int block) const
+  { return _blocks[block].known ? &_blocks[block] : nullptr; }
+
+  /// Set the stats of the block
+  void set_stats(int block, const BlockStats &stats);
+
+  /// Number of the hashed blocks and of all the blocks
+  int n_known() const;
+  int n_blocks() const { return _blocks.size(); }
+
+  /// Write the index, if there are new blocks in it
+  void save();
+
+protected:
+
+  std::string _filename;
+
+  IndexHeader _header;
+
+  std::vector<BlockStats> _blocks;
+
+  bool _modified;
+};
+
+
+
+#endif // BLOCK_INDEX_HPP
@@ -0,0 +1,204 @@
+#ifndef BLOCK_READER_HPP
+#define BLOCK_READER_HPP
+
+#include "conversion.hpp"
+#include "direct_reader.hpp"
+#include "frames.hpp"
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+
+/// Default size (in bytes) of a block of rows which is read from a file at
+/// once by the streaming computations. It's big enough to amortize the cost of
+/// a read call, and small enough to keep several blocks in the cache.
+const int DEFAULT_BLOCK_BYTES = 1 << 22;
+
+/// Formats of the files with the data
+enum FileFormat
+{
+  FORMAT_RAW,  ///< headerless table of floats, a row is a time step
+  FORMAT_SU,   ///< Seismic Unix: traces with 240-byte headers, native floats
+  FORMAT_SEGY, ///< SEG-Y: 3600-byte file header, traces with 240-byte headers,
+               ///< big-endian IBM or IEEE floats
+  FORMAT_L2Z,  ///< framed compressed table (see frames.hpp)
+  FORMAT_GZIP  ///< gzip-compressed raw table (can be read sequentially only)
+};
+
+/**
+ * Get the format of the file by the name of the format ("raw", "su", "segy",
+ * "l2z", "gz") or, if the name is "auto", by the signature of the compressed
+ * files, or by the extension of the file (.su, .sgy, .segy; everything else is
+ * raw).
+ */
+FileFormat file_format(const std::string &filename, const std::string &format);
+
+
+
+//==============================================================================
+//
+// Reader of a file with a table of floating point numbers by blocks of rows.
+// The rows are time steps, the columns are traces. In the raw format the file
+// contains exactly this table, and the numbers may be of any ElementType. The
+// SU and SEG-Y files contain the traces one after another with their headers,
+// so they are mapped in memory, and the samples of the requested rows are
+// picked from every trace (skipping the headers), converted to native floats
+// and transposed into the table on the fly. The frames of the framed
+// compressed files which contain the requested rows are decompressed in
+// parallel.
+//
+//==============================================================================
+class BlockReader
+{
+public:
+
+  /// Constructor opens the file and finds the number of rows in it. For the SU
+  /// and SEG-Y formats the number of columns (traces) is taken from the file,
+  /// so n_cols may be 0 (if it's not, it must coincide with the file). The
+  /// type of the elements matters for the raw format only, the SU and SEG-Y
+  /// files are always read as single precision. The order of bytes is
+  /// detected automatically by the headers of SEG-Y, SU and framed files, the
+  /// raw and gzip files are native, unless the order is given explicitly (or
+  /// it's ORDER_GUESS, then it's guessed by the values of the file). The
+  /// raw files may be read directly, bypassing the page cache (see
+  /// direct_reader.hpp), with up to queue_depth reads in flight.
+  BlockReader(const std::string &filename,
+              int n_cols,
+              const std::string &format = "auto",
+              ElementType type = FLOAT32,
+              ByteOrder order = ORDER_AUTO,
+              IoBackend io = IO_STREAM,
+              int queue_depth = 8);
+
+  ~BlockReader();
+
+  const std::string& name() const { return _filename; }
+
+  FileFormat format() const { return _format; }
+
+  int n_rows() const { return _n_rows; }
+
+  int n_cols() const { return _n_cols; }
+
+  /// Type of the elements which are given by read_block()
+  ElementType type() const { return _type; }
+
+  /// Whether the bytes of the values in the file are swapped when they're read
+  bool swapped() const { return _swap; }
+
+  /// Whether the reader uses several threads itself, so the readers shouldn't
+  /// be called from parallel regions
+  bool is_parallel() const { return _format == FORMAT_L2Z; }
+
+  /// Whether the reads are asynchronous, so the reads of several readers
+  /// overlap if they are started before any of them is finished
+  bool is_asynchronous() const
+  { return _direct && _direct->backend() == IO_URING; }
+
+  /// Read the rows [row_beg, row_end) of the table (all columns) into the
+  /// buffer, which must have the room for (row_end-row_beg)*n_cols() values
+  /// of type(). The values are not converted into another type, so the
+  /// kernels can use them as they are.
+  void read_block(int row_beg, int row_end, char *buffer);
+
+  /// Read the rows [row_beg, row_end) of the table (all columns) into the
+  /// buffer, which must have the room for (row_end-row_beg)*n_cols() values,
+  /// converting them from type() if needed
+  void read_rows(int row_beg, int row_end, float *buffer);
+  void read_rows(int row_beg, int row_end, double *buffer);
+
+  /// Start reading the rows like read_block(), and finish it: the buffer is
+  /// filled when finish_block() returns. For the synchronous readers the rows
+  /// are read by start_block().
+  void start_block(int row_beg, int row_end, char *buffer);
+  void finish_block();
+
+  /// The number of rows in a block of the default size for the given number of
+  /// columns
+  static int rows_per_block(int n_cols);
+
+protected:
+
+  std::string _filename;
+
+  FileFormat _format;
+
+  ElementType _type;
+
+  ByteOrder _order;
+
+  std::ifstream _in;
+
+  /// Direct reader of the raw file (if it's requested and possible), and the
+  /// block which is being read by it
+  IoBackend _io;
+  int _queue_depth;
+  std::shared_ptr<DirectReader> _direct;
+  char *_pending;
+  long long _pending_values;
+
+  int _n_cols;
+
+  int _n_rows;
+
+  /// File mapped in memory (for the formats with trace headers)
+  const char *_map;
+
+  /// Size of the mapped file in bytes
+  long long _map_size;
+
+  /// Offset of the first trace from the beginning of the file
+  long long _first_trace;
+
+  /// Size of a trace with its header in bytes
+  long long _trace_bytes;
+
+  /// Whether the samples are IBM floats (otherwise they're IEEE)
+  bool _ibm;
+
+  /// Whether the bytes of the samples need to be swapped
+  bool _swap;
+
+  /// Buffer for the samples of a trace as they are in the file
+  std::vector<uint32_t> _samples;
+
+  /// Buffer for the converted samples of a group of traces
+  std::vector<float> _traces;
+
+  /// Buffer for the values which need to be converted into another type
+  std::vector<char> _raw;
+
+  /// File descriptor of the framed compressed file
+  int _fd;
+
+  /// Header and the offsets of the frames of the framed compressed file
+  FramedHeader _header;
+  std::vector<uint64_t> _frame_offsets;
+
+  /// gzip stream (gzFile) and the current position in it (in bytes of
+  /// uncompressed data)
+  void *_gz;
+  long long _gz_position;
+
+  void open_raw();
+  void open_traces();
+  void open_framed();
+  void open_gzip();
+  void read_traces(int row_beg, int row_end, float *buffer);
+  void read_frames(int row_beg, int row_end, char *buffer);
+  void read_gzip(int row_beg, int row_end, char *buffer);
+
+  template <typename T>
+  void read_converted(int row_beg, int row_end, T *buffer);
+
+  BlockReader(const BlockReader&);
+  BlockReader& operator =(const BlockReader&);
+};
+
+
+
+#endif // BLOCK_READER_HPP
@@ -0,0 +1,79 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+
+
+/// Header of a checkpoint file
+struct CheckpointHeader
+{
+  char magic[4];    ///< "L2C1"
+  uint32_t n_items; ///< number of the named arrays after the header
+  uint64_t run;     ///< hash of the description of the run
+};
+
+
+
+//==============================================================================
+//
+// Checkpoint of a long run: named arrays of numbers which describe how far
+// every stage has got and what it has accumulated, so a run which was
+// interrupted can be resumed from there. The stages put their state here as
+// they go, and it's written in a compact binary file, when at least the
+// interval has passed since the previous write (so the cost of the
+// checkpoints doesn't depend on the size of the data). The file is replaced
+// atomically, so an interrupted write leaves the previous checkpoint. The
+// checkpoint of another run (with other files or parameters, see the
+// description of the run) is ignored.
+//
+//==============================================================================
+class Checkpoint
+{
+public:
+
+  Checkpoint(const std::string &filename, const std::string &run,
+             double interval);
+
+  /// Load the saved state of the same run. Return false if there is none.
+  bool load();
+
+  bool has(const std::string &name) const;
+
+  const std::vector<double>& values(const std::string &name) const;
+  double value(const std::string &name) const { return values(name)[0]; }
+
+  void set(const std::string &name, const std::vector<double> &values);
+  void set(const std::string &name, const double *values, size_t n);
+  void set(const std::string &name, double value) { set(name, &value, 1); }
+
+  /// Forget the state of the names which begin with the prefix
+  void erase(const std::string &prefix);
+
+  /// Whether the interval has passed since the previous write
+  bool due() const;
+
+  void save();
+
+  /// Remove the file, when the run is complete
+  void remove();
+
+protected:
+
+  std::string _filename;
+
+  uint64_t _run;
+
+  double _interval;
+
+  double _last_save; ///< wall time of the previous write
+
+  std::map<std::string, std::vector<double> > _items;
+};
+
+
+
+#endif // CHECKPOINT_HPP
@@ -1,9 +1,29 @@
 #ifndef COMPUTE_HPP
 #define COMPUTE_HPP
 
+#include "arena.hpp"
+#include "profile.hpp"
+#include "progress.hpp"
+
+#include <memory>
 #include <string>
 
+class BlockIndex;
+class BlockReader;
+class Checkpoint;
+class DiffMetric;
+class LargeBuffer;
+class Mask;
+class NoMetric;
+class NormsMetric;
 class Parameters;
+class RmsDiffMetric;
+class RowWriter;
+class StatsKernel;
+
+/// Exit code of the program, if the files differ more than the tolerances
+/// allow (see Parameters::_tol_l2)
+const int EXIT_TOLERANCE_FAILED = 3;
 
 
 
@@ -16,27 +36,95 @@ public:
   ~Compute();
 
 
-  void run();
+  /// Run the requested computations and return the exit code of the program
+  int run();
 
 
 protected:
 
   Parameters &_param;
 
+  /// Readers of the input files
+  std::shared_ptr<BlockReader> _in0;
+  std::shared_ptr<BlockReader> _in1;
+
+  /// Indexes of the blocks of the input files (if they are requested)
+  std::shared_ptr<BlockIndex> _index0;
+  std::shared_ptr<BlockIndex> _index1;
+
+  /// The whole data from the input files (only for the computations which
+  /// can't be done by streaming the files)
   float **_data0;
   float **_data1;
 
-  int _n_rows; ///< number of rows in the input files = number of samples
+  /// The data 1 as they are in the file, for the files made of them (scaled,
+  /// shifted, aligned). They are _data1, unless the data are masked.
+  float **_input1;
+
+  /// Mask and weights of the compared samples (if they are given)
+  std::shared_ptr<Mask> _mask;
 
+  /// Checkpoints of the run (if they are requested)
+  std::shared_ptr<Checkpoint> _checkpoint;
+
+  /// Partial results of the shard (in the sharded mode)
+  std::shared_ptr<Checkpoint> _partial;
+
+  /// The RMS of the difference of the streamed pass (if it's requested),
+  /// which is reported after the cross correlation
+  std::shared_ptr<RmsDiffMetric> _rms_diff;
+
+  /// The memory of the whole data
+  std::shared_ptr<LargeBuffer> _buffer0;
+  std::shared_ptr<LargeBuffer> _buffer1;
+  std::shared_ptr<LargeBuffer> _buffer_input1;
+
+  int _n_rows; ///< number of rows in the input files = number of samples
 
+  /// Scratch memory of the computations, the profile and the progress of the
+  /// run. They aren't the results, so they are changed by the const methods
+  /// too.
+  mutable Arena _arena;
+  mutable Profile _profile;
+  mutable Progress _progress;
+
+
+  void stage(const char *name) const;
+  void open();
+  void make_mask();
+  std::string run_description() const;
+  void take_shard();
+  void merge_partials() const;
+  bool need_data() const;
   void read();
-  void l2l1() const;
-  void diff_file() const;
+  void preview() const;
+  void sample() const;
+  bool check_tolerance() const;
+  double energy(BlockReader &in, BlockIndex *index) const;
+  void stream_metrics();
+  template <class Norms, class Rms, class Diff>
+  void stream_metrics(RowWriter *out);
+  void keep(const NoMetric &metric);
+  void keep(const RmsDiffMetric &metric);
+  void report(const NoMetric &metric, int n_equal_rows) const;
+  void report(const NormsMetric &metric, int n_equal_rows) const;
+  void report(const RmsDiffMetric &metric, int n_equal_rows) const;
+  void report(const DiffMetric &metric, int n_equal_rows) const;
+  void print_l2l1(const NormsMetric &norms, int n_equal_rows) const;
+  void statistics() const;
+  void report(const StatsKernel &kernel, int n_equal_rows) const;
+  void pack() const;
   void scale() const;
   void shift() const;
+  void dtw_align() const;
   void compute_xcorrelation() const;
   void compute_rms() const;
+  void save_indexes() const;
+  void compute_rms_windows() const;
+  void compute_hilbert_misfits() const;
+  void compute_spectral_misfits() const;
   void check_symmetry(float **data, const std::string &name) const;
+  void vector_norms() const;
 
 
   Compute(const Compute&);
@@ -0,0 +1,209 @@
+#ifndef CONVERSION_HPP
+#define CONVERSION_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+
+
+//==============================================================================
+//
+// Conversions of the binary representations of the numbers. The functions
+// work on arrays and have no branches in the loops, so the compiler can
+// vectorize them.
+//
+//==============================================================================
+
+/// Types of the elements of the data in the files
+enum ElementType
+{
+  FLOAT32,  ///< IEEE single precision
+  FLOAT64,  ///< IEEE double precision
+  FLOAT16,  ///< IEEE half precision
+  BFLOAT16  ///< brain floating point: upper half of IEEE single precision
+};
+
+/// Half precision number (its bits)
+struct float16
+{
+  uint16_t bits;
+};
+
+/// Brain floating point number (its bits)
+struct bfloat16
+{
+  uint16_t bits;
+};
+
+/**
+ * Get the type of the elements by its name: f32, f64, f16 or bf16.
+ */
+ElementType element_type(const std::string &name);
+
+/**
+ * Get the name of the type of the elements.
+ */
+std::string element_type_name(ElementType type);
+
+/**
+ * Size of an element of the given type in bytes.
+ */
+inline int element_size(ElementType type)
+{
+  return (type == FLOAT64 ? 8 : (type == FLOAT32 ? 4 : 2));
+}
+
+inline float bits_to_float(uint32_t bits)
+{
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+inline uint32_t float_to_bits(float value)
+{
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+/**
+ * Conversion of the elements of any type to double. These are the functions
+ * which the kernels use when they read the data, so the conversion happens in
+ * registers, and the data of different types are never converted as a whole.
+ */
+inline double to_double(float value)  { return value; }
+inline double to_double(double value) { return value; }
+
+inline double to_double(bfloat16 value)
+{
+  return bits_to_float((uint32_t)value.bits << 16);
+}
+
+/**
+ * The exponent and the mantissa of a half precision number are shifted into
+ * their places in single precision, so the value is off by the factor
+ * 2^(127-15) = 2^112 (which holds for the subnormal numbers too). Infinity and
+ * NaN get the maximal exponent.
+ */
+inline double to_double(float16 value)
+{
+  const float two_112 = 5.192296858534828e+33f;
+  const uint32_t magnitude = value.bits & 0x7fffu;
+  uint32_t bits = float_to_bits(bits_to_float(magnitude << 13) * two_112);
+  bits |= (magnitude >= 0x7c00u ? 0x7f800000u : 0u);
+  bits |= (uint32_t)(value.bits & 0x8000u) << 16;
+  return bits_to_float(bits);
+}
+
+/**
+ * Convert an array of elements of one type into another one.
+ */
+template <typename From, typename To>
+inline void convert(const From *from, To *to, long long n_values)
+{
+  for (long long i = 0; i < n_values; ++i)
+    to[i] = to_double(from[i]);
+}
+
+/// Order of bytes in the numbers of a file
+enum ByteOrder
+{
+  ORDER_AUTO,   ///< detect by the headers, native for the raw files
+  ORDER_GUESS,  ///< detect by the headers, or guess by the values
+  ORDER_NATIVE, ///< the same as the order of this machine
+  ORDER_LITTLE, ///< little-endian
+  ORDER_BIG     ///< big-endian
+};
+
+/**
+ * Get the order of bytes by its name: auto, guess, native, little or big.
+ */
+ByteOrder byte_order(const std::string &name);
+
+/**
+ * Whether the bytes of the numbers in the given (not automatic) order need to
+ * be swapped to be used on this machine.
+ */
+bool need_swap(ByteOrder order);
+
+/**
+ * Guess if the values of the given type are stored in the foreign order of
+ * bytes. The values are interpreted in both orders, and the one which gives
+ * more numbers with reasonable exponents (or zeros) wins. The native order
+ * wins unless the other one is much more plausible.
+ */
+bool looks_swapped(const char *values, long long n_values, ElementType type);
+
+/**
+ * Reverse the order of bytes of every 2-, 4- or 8-byte value in the array.
+ */
+inline void byte_swap_16(uint16_t *values, long long n_values)
+{
+  for (long long i = 0; i < n_values; ++i)
+    values[i] = __builtin_bswap16(values[i]);
+}
+
+inline void byte_swap_32(uint32_t *values, long long n_values)
+{
+  for (long long i = 0; i < n_values; ++i)
+    values[i] = __builtin_bswap32(values[i]);
+}
+
+inline void byte_swap_64(uint64_t *values, long long n_values)
+{
+  for (long long i = 0; i < n_values; ++i)
+    values[i] = __builtin_bswap64(values[i]);
+}
+
+/**
+ * Reverse the order of bytes of every value (of the given size in bytes) in
+ * the array.
+ */
+inline void byte_swap(char *values, long long n_values, int value_size)
+{
+  if (value_size == 2)
+    byte_swap_16((uint16_t*)values, n_values);
+  else if (value_size == 4)
+    byte_swap_32((uint32_t*)values, n_values);
+  else if (value_size == 8)
+    byte_swap_64((uint64_t*)values, n_values);
+}
+
+/**
+ * Convert a number in IBM single precision floating point format (sign bit, 7
+ * bits of base-16 exponent biased by 64, 24 bits of fraction) into IEEE one.
+ * The value is fraction * 16^(exponent-64) * 2^(-24), which is computed in
+ * double precision (to cover the range of IBM exponents) by constructing the
+ * power of two directly from the bits, and then rounded to single precision.
+ */
+inline float ibm_to_ieee(uint32_t ibm)
+{
+  const uint32_t fraction = ibm & 0x00ffffffu;
+  const int64_t exponent = (int64_t)((ibm >> 24) & 0x7fu) * 4 - 280;
+  const uint64_t scale_bits = (uint64_t)(exponent + 1023) << 52;
+  double scale;
+  memcpy(&scale, &scale_bits, sizeof(scale));
+
+  const float magnitude = (float)(fraction * scale);
+  uint32_t bits;
+  memcpy(&bits, &magnitude, sizeof(bits));
+  bits |= ibm & 0x80000000u; // sign
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+/**
+ * Convert an array of numbers in IBM floating point format into IEEE ones.
+ */
+inline void ibm_to_ieee(const uint32_t *ibm, float *values, long long n_values)
+{
+  for (long long i = 0; i < n_values; ++i)
+    values[i] = ibm_to_ieee(ibm[i]);
+}
+
+
+
+#endif // CONVERSION_HPP
@@ -1,10 +1,176 @@
 #ifndef CORRELATION_HPP
 #define CORRELATION_HPP
 
+#include "arena.hpp"
+#include "tiles.hpp"
+
 #include <cmath>
 #include <vector>
 
 
+
+/// Kernel of the tiled traversal for the averages and the standard deviations
+/// of the traces of two datasets
+class TraceMomentsTiles
+{
+public:
+
+  static const int N_SUMS = 4;
+
+  TraceMomentsTiles(float **data0, float **data1, int row_beg, int row_end,
+                    int col_beg, double *mu[2], double *sigma[2])
+    : _data0(data0), _data1(data1), _n_rows(row_end - row_beg),
+      _col_beg(col_beg), _mu(mu), _sigma(sigma)
+  { }
+
+  void tile(int i_beg, int i_end, int j_beg, int j_end, double *sums,
+            int stride)
+  {
+    double *mu0 = sums - j_beg;
+    double *mu1 = mu0 + stride;
+    double *part0 = mu1 + stride;
+    double *part1 = part0 + stride;
+    for (int i = i_beg; i < i_end; ++i)
+    {
+      const float *row0 = _data0[i];
+      const float *row1 = _data1[i];
+      for (int j = j_beg; j < j_end; ++j)
+      {
+        const double d0 = row0[j];
+        const double d1 = row1[j];
+        mu0[j] += d0;
+        mu1[j] += d1;
+        part0[j] += d0 * d0;
+        part1[j] += d1 * d1;
+      }
+    }
+  }
+
+  void stripe(int j_beg, int j_end, const double *sums, int stride)
+  {
+    for (int j = j_beg; j < j_end; ++j)
+    {
+      const int k = j - j_beg;
+      const double mu0 = sums[k] / _n_rows;
+      const double mu1 = sums[stride + k] / _n_rows;
+      const double part0 = sums[2 * stride + k] / _n_rows;
+      const double part1 = sums[3 * stride + k] / _n_rows;
+      _mu[0][j - _col_beg] = mu0;
+      _mu[1][j - _col_beg] = mu1;
+      _sigma[0][j - _col_beg] = sqrt(part0 - pow(mu0, 2));
+      _sigma[1][j - _col_beg] = sqrt(part1 - pow(mu1, 2));
+    }
+  }
+
+protected:
+
+  float **_data0, **_data1;
+  int _n_rows, _col_beg;
+  double **_mu, **_sigma;
+
+  TraceMomentsTiles(const TraceMomentsTiles&);
+  TraceMomentsTiles& operator =(const TraceMomentsTiles&);
+};
+
+
+
+/// Kernel of the tiled traversal for the normalized cross correlation of the
+/// traces of two datasets with a lag
+class XCorrelationTiles
+{
+public:
+
+  static const int N_SUMS = 1;
+
+  XCorrelationTiles(float **data0, float **data1, int row_beg, int row_end,
+                    int col_beg, int lag, const double *const mu[2],
+                    const double *const sigma[2], double *xcorrelation)
+    : _data0(data0), _data1(data1), _row_beg(row_beg), _row_end(row_end),
+      _col_beg(col_beg), _lag(lag), _mu(mu), _sigma(sigma),
+      _xcorrelation(xcorrelation)
+  { }
+
+  void tile(int i_beg, int i_end, int j_beg, int j_end, double *sums, int)
+  {
+    double *sum = sums - j_beg;
+    const double *mu0 = _mu[0] - _col_beg;
+    const double *mu1 = _mu[1] - _col_beg;
+    for (int i = i_beg; i < i_end; ++i)
+    {
+      const float *row0 = _data0[i];
+      // the second dataset is shifted according to the lag value, and the
+      // other values are padded with the zero
+      if (i + _lag < _row_end && i + _lag >= _row_beg)
+      {
+        const float *row1 = _data1[i + _lag];
+        for (int j = j_beg; j < j_end; ++j)
+          sum[j] += (row0[j] - mu0[j]) * (row1[j] - mu1[j]);
+      }
+      else
+      {
+        for (int j = j_beg; j < j_end; ++j)
+          sum[j] += (row0[j] - mu0[j]) * (0. - mu1[j]);
+      }
+    }
+  }
+
+  void stripe(int j_beg, int j_end, const double *sums, int)
+  {
+    for (int j = j_beg; j < j_end; ++j)
+    {
+      const int k = j - _col_beg;
+      const double sum = sums[j - j_beg] / (_row_end - _row_beg);
+      _xcorrelation[k] = sum / (_sigma[0][k] * _sigma[1][k]);
+    }
+  }
+
+protected:
+
+  float **_data0, **_data1;
+  int _row_beg, _row_end, _col_beg, _lag;
+  const double *const *_mu, *const *_sigma;
+  double *_xcorrelation;
+
+  XCorrelationTiles(const XCorrelationTiles&);
+  XCorrelationTiles& operator =(const XCorrelationTiles&);
+};
+
+
+
+/**
+ *
+ * Average and standard deviation of each trace of the two datasets. They
+ * don't depend on the lag, so they are computed once for all the lags of the
+ * cross correlation.
+ *
+ * @param data0[in] First dataset
+ * @param data1[in] Second dataset
+ * @param row_beg[in] Starting row in the datasets
+ * @param row_end[in] Ending row (not including) in the datasets
+ * @param col_beg[in] Starting trace in the datasets
+ * @param col_end[in] Ending trace (not including) in the datasets
+ * @param mu[out] Averages of the traces of each dataset (col_end - col_beg)
+ * @param sigma[out] Standard deviations of the traces of each dataset
+ * @param scratch[in] Arena for the partial sums of the threads (optional)
+ */
+void trace_moments(float **data0,
+                   float **data1,
+                   int row_beg,
+                   int row_end,
+                   int col_beg,
+                   int col_end,
+                   double *mu[2],
+                   double *sigma[2],
+                   Arena *scratch = nullptr)
+{
+  // the traces are traversed by tiles rather than down the columns
+  TraceMomentsTiles moments(data0, data1, row_beg, row_end, col_beg, mu,
+                            sigma);
+  traverse_tiles(row_beg, row_end, col_beg, col_end, moments, scratch);
+}
+
+
+
 /**
  *
  * Cross correlation between each trace of the two datasets.
@@ -16,7 +182,10 @@
  * @param col_beg[in] Starting trace in the datasets
  * @param col_end[in] Ending trace (not including) in the datasets
  * @param lag[in] Lag for the second dataset
- * @param xcorrelation[out] Vector of cross correlation values for each trace
+ * @param mu[in] Averages of the traces (see trace_moments)
+ * @param sigma[in] Standard deviations of the traces
+ * @param xcorrelation[out] Cross correlation values for each trace
+ * @param scratch[in] Arena for the partial sums of the threads (optional)
  */
 void x_correlation_by_traces(float **data0,
                              float **data1,
@@ -25,64 +194,14 @@ void x_correlation_by_traces(float **data0,
                              int col_beg,
                              int col_end,
                              int lag,
-                             std::vector<double> &xcorrelation)
+                             const double *const mu[2],
+                             const double *const sigma[2],
+                             double *xcorrelation,
+                             Arena *scratch = nullptr)
 {
-  // average and standard deviation for every time log, i.e. every trace,
-  // of each dataset
-  std::vector<double> mu[2];
-  std::vector<double> sigma[2];
-  for (int i = 0; i < 2; ++i)
-  {
-    mu[i].resize(col_end - col_beg, 0.);
-    sigma[i].resize(col_end - col_beg, 0.);
-  }
-
-  // compute an average and sigma for every time series of every dataset
-  for (int j = col_beg; j < col_end; ++j)
-  {
-    double part0 = 0.;
-    double part1 = 0.;
-    for (int i = row_beg; i < row_end; ++i)
-    {
-      const double d0 = data0[i][j];
-      const double d1 = data1[i][j];
-
-      mu[0][j - col_beg] += d0;
-      mu[1][j - col_beg] += d1;
-      part0 += d0 * d0;
-      part1 += d1 * d1;
-    }
-    mu[0][j - col_beg] /= row_end - row_beg;
-    mu[1][j - col_beg] /= row_end - row_beg;
-    part0 /= row_end - row_beg;
-    part1 /= row_end - row_beg;
-
-    sigma[0][j - col_beg] = sqrt(part0 - pow(mu[0][j-col_beg],2));
-    sigma[1][j - col_beg] = sqrt(part1 - pow(mu[1][j-col_beg],2));
-  }
-
-  // compute the normalized cross correlation
-  xcorrelation.resize(col_end - col_beg, 0.);
-  for (int j = col_beg; j < col_end; ++j)
-  {
-    double mu0 = mu[0][j - col_beg];
-    double mu1 = mu[1][j - col_beg];
-    double sum = 0.;
-    for (int i = row_beg; i < row_end; ++i)
-    {
-      const double d0 = data0[i][j]; // we take the data from the first dataset
-                                     // as is
-      double d1 = 0.; // for the second dataset we shift the sample index
-      if (i + lag < row_end && i + lag >= row_beg) // according to the lag value
-        d1 = data1[i+lag][j]; // and pad the other values with the zero
-
-      sum += (d0 - mu0) * (d1 - mu1);
-    }
-
-    sum /= row_end - row_beg;
-
-    xcorrelation[j-col_beg] = sum / (sigma[0][j-col_beg]*sigma[1][j-col_beg]);
-  }
+  XCorrelationTiles kernel(data0, data1, row_beg, row_end, col_beg, lag, mu,
+                           sigma, xcorrelation);
+  traverse_tiles(row_beg, row_end, col_beg, col_end, kernel, scratch);
 }
 
 
@@ -0,0 +1,121 @@
+#ifndef DIRECT_READER_HPP
+#define DIRECT_READER_HPP
+
+#include <string>
+#include <vector>
+
+
+
+/// Backends of reading the raw files
+enum IoBackend
+{
+  IO_STREAM, ///< std::ifstream through the page cache (portable)
+  IO_DIRECT, ///< pread() with O_DIRECT, bypassing the page cache
+  IO_URING   ///< io_uring with O_DIRECT, several reads in flight
+};
+
+/**
+ * Get the backend by its name: "stream", "direct" or "uring".
+ */
+IoBackend io_backend(const std::string &name);
+
+/// Size of a read request of the direct backends
+const int DIRECT_CHUNK_BYTES = 1 << 18;
+
+/// Alignment of the offsets, the lengths and the buffers of the direct reads
+/// (a multiple of the logical block size of the devices)
+const int DIRECT_ALIGNMENT = 4096;
+
+
+
+//==============================================================================
+//
+// Reader of the ranges of bytes of a file opened with O_DIRECT, so the data
+// go from the device to the memory of the program without the page cache (and
+// they don't evict the pages of the other programs). The ranges are read by
+// chunks of DIRECT_CHUNK_BYTES into an aligned buffer, which covers the range
+// extended to the aligned boundaries, and copied from it to the destination.
+//
+// With io_uring up to queue_depth chunks are in flight at once, and reading
+// is split into start() and finish(), so the reads of several files overlap
+// even in one thread. The ring is set up by the system calls directly (no
+// liburing is needed). If io_uring isn't available, the chunks are read by
+// pread() one after another in start(). If the file can't be opened with
+// O_DIRECT (e.g. the file system doesn't support it), ok() is false, and the
+// caller should read the file as usual.
+//
+//==============================================================================
+class DirectReader
+{
+public:
+
+  DirectReader(const std::string &filename, IoBackend backend,
+               int queue_depth);
+
+  ~DirectReader();
+
+  bool ok() const { return _fd >= 0; }
+
+  /// The backend which is actually used
+  IoBackend backend() const { return _backend; }
+
+  /// Start reading n_bytes from the offset in the file into the buffer. The
+  /// buffer is filled by finish().
+  void start(long long offset, long long n_bytes, char *buffer);
+
+  /// Wait for the reads which were started, and copy the data to the buffer
+  void finish();
+
+protected:
+
+  std::string _filename;
+
+  int _fd;
+
+  /// The file opened without O_DIRECT (if it's needed) for the rest of a
+  /// chunk after a short read of an unaligned length
+  int _buffered_fd;
+
+  IoBackend _backend;
+
+  int _queue_depth;
+
+  /// Aligned buffer of the current range (with the room for the alignment)
+  std::vector<char> _storage;
+  char *_aligned;
+
+  /// The current range: the aligned beginning and end in the file, the
+  /// requested offset, size and destination
+  long long _aligned_beg, _aligned_end, _offset, _n_bytes;
+  char *_buffer;
+
+  /// The chunks of the current range which are submitted and completed
+  int _n_chunks, _n_submitted, _n_completed, _n_in_flight;
+
+  /// io_uring: the descriptor of the ring and its mapped parts
+  int _ring;
+  void *_sq_map, *_cq_map, *_sqes;
+  size_t _sq_map_size, _cq_map_size, _sqes_size;
+  unsigned *_sq_tail, *_sq_mask, *_sq_array;
+  unsigned *_cq_head, *_cq_tail, *_cq_mask;
+  void *_cqes;
+
+  /// Size of the file (the aligned end of the last range may be beyond it)
+  long long _file_size;
+
+  bool setup_ring();
+  void release_ring();
+  void submit_chunks();
+  void reap_chunks(bool wait);
+  void drain();
+  void chunk_range(int chunk, long long &offset, long long &size) const;
+  void read_sync(long long offset, long long size);
+  void read_buffered(long long offset, long long size);
+
+  DirectReader(const DirectReader&);
+  DirectReader& operator =(const DirectReader&);
+};
+
+
+
+#endif // DIRECT_READER_HPP
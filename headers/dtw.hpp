@@ -0,0 +1,377 @@
+#ifndef DTW_HPP
+#define DTW_HPP
+
+#include "progress.hpp"
+#include "tiles.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+
+
+/// Maximal size of the steps (one byte per cell of the band) of a part of a
+/// warping path which is traced back at once
+const size_t DTW_STEP_BYTES = 1 << 20;
+
+/// Size of the lags of a stripe of traces which are aligned at once
+const size_t DTW_LAG_BYTES = 1 << 26;
+
+
+
+//==============================================================================
+//
+// Warping path of two traces of n samples by dynamic time warping in the
+// Sakoe-Chiba band |i - j| <= band. The steps are (i-1, j-1), (i-1, j) and
+// (i, j-1), and the cost of a cell is the squared difference of the samples.
+// The accumulated costs are kept for two rows of the band only. If the steps
+// of a part of the path from (i0, j0) to (i1, j1) take at most DTW_STEP_BYTES,
+// it's traced back from them. Otherwise the costs of the middle row m from
+// (i0, j0) and to (i1, j1) give the cell (m, j) of the path (Hirschberg), and
+// the parts before and after it are found in the same way. So the memory is
+// linear in the number of rows, and the costs are computed about twice more
+// often for the long traces.
+//
+//==============================================================================
+class WarpingPath
+{
+public:
+
+  WarpingPath(int n, int band)
+    : _n(n),
+      _band(band),
+      _width(2 * band + 1),
+      _x0(nullptr),
+      _x1(nullptr),
+      _match(nullptr),
+      _prev(_width + 2),
+      _cur(_width + 2),
+      _forward(_width + 2),
+      _steps()
+  { }
+
+  /// Find the path of the traces x0, x1, and match every sample i of x0 with
+  /// the sample match[i] of x1 on the path (with the smallest difference, if
+  /// there are several)
+  void find(const float *x0, const float *x1, int *match)
+  {
+    _x0 = x0;
+    _x1 = x1;
+    _match = match;
+    std::fill(match, match + _n, -1);
+    trace(0, 0, _n - 1, _n - 1);
+  }
+
+protected:
+
+  enum { DIAGONAL, UP, LEFT };
+
+  int _n, _band, _width;
+
+  const float *_x0, *_x1;
+  int *_match;
+
+  /// Accumulated costs of two rows of the band (the cell k of the row i is
+  /// j = i - band + k, and it's kept at k + 1). There is one extra cell on
+  /// every side, which is never on a path.
+  std::vector<double> _prev, _cur;
+
+  /// Costs of the middle row from the beginning of the part
+  std::vector<double> _forward;
+
+  std::vector<unsigned char> _steps;
+
+  WarpingPath(const WarpingPath&);
+  WarpingPath& operator =(const WarpingPath&);
+
+  double cost(int i, int j) const
+  {
+    const double d = (double)_x0[i] - _x1[j];
+    return d * d;
+  }
+
+  /// Cells [k_beg, k_end) of the row i which are in the columns [j0, j1]
+  int k_begin(int i, int j0) const
+  { return std::max(0, j0 - i + _band); }
+  int k_end(int i, int j1) const
+  { return std::min(_width, j1 - i + _band + 1); }
+
+  /// Accumulate the costs of the row i of the part from (i0, j0) to (i, j1)
+  /// into _cur from _prev, and keep the steps, if step isn't null
+  void forward_row(int i, int i0, int j0, int j1, unsigned char *step)
+  {
+    const int beg = k_begin(i, j0), end = k_end(i, j1);
+    // the members are read once, since the steps may alias them
+    const double x0 = _x0[i];
+    const float *x1 = _x1 + i - _band;
+    const double *prev = &_prev[0];
+    double *cur = &_cur[0];
+    const int k_first = (i == i0 ? j0 - i + _band : -1);
+    std::fill(cur, cur + beg + 1, DBL_MAX);
+    std::fill(cur + std::max(beg, end) + 1, cur + _width + 2, DBL_MAX);
+    for (int k = beg; k < end; ++k)
+    {
+      // (i-1, j-1) is the cell k of the previous row, (i-1, j) is the cell
+      // k+1, and (i, j-1) is the cell k-1 of the current row
+      double best = prev[k + 1];
+      unsigned char s = DIAGONAL;
+      if (prev[k + 2] < best) { best = prev[k + 2]; s = UP; }
+      if (cur[k] < best) { best = cur[k]; s = LEFT; }
+      if (k == k_first)
+        best = 0.;
+      const double d = x0 - x1[k];
+      cur[k + 1] = best + d * d;
+      if (step)
+        step[k] = s;
+    }
+    _prev.swap(_cur);
+  }
+
+  /// Accumulate the costs of the row i of the part from (i, j0) to (i1, j1)
+  /// into _cur from _prev (the costs of the row i+1)
+  void backward_row(int i, int i1, int j0, int j1)
+  {
+    const int beg = k_begin(i, j0), end = k_end(i, j1);
+    const double x0 = _x0[i];
+    const float *x1 = _x1 + i - _band;
+    const double *next = &_prev[0];
+    double *cur = &_cur[0];
+    const int k_last = (i == i1 ? j1 - i + _band : -1);
+    std::fill(cur, cur + beg + 1, DBL_MAX);
+    std::fill(cur + std::max(beg, end) + 1, cur + _width + 2, DBL_MAX);
+    for (int k = end - 1; k >= beg; --k)
+    {
+      // (i+1, j+1) is the cell k of the next row, (i+1, j) is the cell k-1,
+      // and (i, j+1) is the cell k+1 of the current row
+      double best = std::min(next[k + 1], std::min(next[k], cur[k + 2]));
+      if (k == k_last)
+        best = 0.;
+      const double d = x0 - x1[k];
+      cur[k + 1] = best + d * d;
+    }
+    _prev.swap(_cur);
+  }
+
+  /// Keep the sample j, if it's the best match of the sample i so far
+  void keep(int i, int j)
+  {
+    if (_match[i] < 0 || std::abs(_x0[i] - _x1[j]) <
+                         std::abs(_x0[i] - _x1[_match[i]]))
+      _match[i] = j;
+  }
+
+  /// Find the part of the path from (i0, j0) to (i1, j1). The cells are kept
+  /// from the end, as they're traced back.
+  void trace(int i0, int j0, int i1, int j1)
+  {
+    const int n_rows = i1 - i0 + 1;
+    if (n_rows <= 2 || (size_t)n_rows * _width <= DTW_STEP_BYTES)
+    {
+      trace_directly(i0, j0, i1, j1);
+      return;
+    }
+
+    const int m = i0 + n_rows / 2;
+    std::fill(_prev.begin(), _prev.end(), DBL_MAX);
+    for (int i = i0; i <= m; ++i)
+      forward_row(i, i0, j0, j1, nullptr);
+    _forward = _prev;
+
+    std::fill(_prev.begin(), _prev.end(), DBL_MAX);
+    for (int i = i1; i >= m; --i)
+      backward_row(i, i1, j0, j1);
+
+    // the cell of the path in the middle row: the smallest cost of the whole
+    // path through it (the cost of the cell is in both halves)
+    int best_j = -1;
+    double best = DBL_MAX;
+    for (int k = k_begin(m, j0); k < k_end(m, j1); ++k)
+    {
+      const int j = m - _band + k;
+      if (_forward[k + 1] == DBL_MAX || _prev[k + 1] == DBL_MAX)
+        continue;
+      const double total = _forward[k + 1] + _prev[k + 1] - cost(m, j);
+      if (best_j < 0 || total < best ||
+          (total == best && std::abs(j - m) < std::abs(best_j - m)))
+      {
+        best = total;
+        best_j = j;
+      }
+    }
+
+    trace(m, best_j, i1, j1);
+    trace(i0, j0, m, best_j);
+  }
+
+  /// Find the part of the path from (i0, j0) to (i1, j1) by its steps
+  void trace_directly(int i0, int j0, int i1, int j1)
+  {
+    _steps.resize((size_t)(i1 - i0 + 1) * _width);
+    std::fill(_prev.begin(), _prev.end(), DBL_MAX);
+    for (int i = i0; i <= i1; ++i)
+      forward_row(i, i0, j0, j1, &_steps[(size_t)(i - i0) * _width]);
+
+    for (int i = i1, j = j1; ; )
+    {
+      keep(i, j);
+      if (i == i0 && j == j0)
+        break;
+      switch (_steps[(size_t)(i - i0) * _width + j - i + _band])
+      {
+        case DIAGONAL: --i; --j; break;
+        case UP:       --i;      break;
+        default:            --j; break;
+      }
+    }
+  }
+};
+
+
+
+/**
+ *
+ * Alignment of every trace of the second dataset to the same trace of the
+ * first one by dynamic time warping. The warping path is constrained by the
+ * Sakoe-Chiba band: the sample i of the first trace can be matched with the
+ * samples j of the second trace only if |i - j| <= band, so every trace costs
+ * O(rows * band), and a thread needs O(rows + band) memory besides at most
+ * DTW_STEP_BYTES for the steps (see WarpingPath). The traces are processed in
+ * parallel by stripes of DTW_LAG_BYTES of lags, and the columns of a stripe
+ * are gathered by batches, so the rows are read by contiguous pieces.
+ *
+ * Every sample i of the first trace is matched with the sample j(i) of the
+ * second trace on the optimal path (with the smallest difference, if there
+ * are several), and the lag j(i) - i is given to the output, so the aligned
+ * trace is data1[i + lag(i)]. When the traces [j_beg, j_end) of a stripe are
+ * aligned, output.stripe(j_beg, j_end, lags) is called with their lags
+ * lags[(i - row_beg) * (j_end - j_beg) + j - j_beg].
+ *
+ * @param data0[in] First (reference) dataset
+ * @param data1[in] Second dataset, which is aligned
+ * @param row_beg[in] Starting row in the datasets
+ * @param row_end[in] Ending row (not including) in the datasets
+ * @param col_beg[in] Starting trace in the datasets
+ * @param col_end[in] Ending trace (not including) in the datasets
+ * @param band[in] Half-width of the Sakoe-Chiba band (in rows)
+ * @param output[in] Receiver of the lags of the stripes of the traces
+ * @param diff_before[out] Sum of the squared differences of the traces
+ * @param diff_after[out] Sum of the squared differences of the aligned traces
+ * @param energy_0[out] Sum of the squared values of the traces of data0
+ * @param max_lag[out] Maximal absolute lag of the samples of every trace
+ * @param mean_lag[out] Mean lag of the samples of every trace
+ * @param progress[in] Progress to count the traces in (if it's given). If the
+ *                     run is cancelled, the rest of the traces is skipped.
+ */
+template <class Output>
+void dtw_alignment(float **data0,
+                   float **data1,
+                   int row_beg,
+                   int row_end,
+                   int col_beg,
+                   int col_end,
+                   int band,
+                   Output &output,
+                   std::vector<double> &diff_before,
+                   std::vector<double> &diff_after,
+                   std::vector<double> &energy_0,
+                   std::vector<int> &max_lag,
+                   std::vector<double> &mean_lag,
+                   Progress *progress = nullptr)
+{
+  const int n_traces = col_end - col_beg;
+  const int n = row_end - row_beg;
+  band = std::min(band, n - 1);
+
+  diff_before.assign(n_traces, 0.);
+  diff_after.assign(n_traces, 0.);
+  energy_0.assign(n_traces, 0.);
+  max_lag.assign(n_traces, 0);
+  mean_lag.assign(n_traces, 0.);
+
+  // the number of columns gathered at once: 16 floats make a cache line
+  const int batch = 16;
+
+  // the traces of a stripe: a multiple of the batch, and a batch per thread
+  // at least
+  int n_threads = 1;
+#if defined(_OPENMP)
+  n_threads = omp_get_max_threads();
+#endif
+  const long long fit = DTW_LAG_BYTES / ((size_t)n * sizeof(short));
+  const int stripe = std::min((long long)n_traces,
+                              std::max((long long)batch * n_threads,
+                                       fit / batch * batch));
+  std::vector<short> lags((size_t)n * stripe);
+
+  for (int s_beg = col_beg; s_beg < col_end; s_beg += stripe)
+  {
+    const int s_end = std::min(s_beg + stripe, col_end);
+    const int s_width = s_end - s_beg;
+
+#pragma omp parallel
+    {
+      std::vector<float> traces0((size_t)batch * n);
+      std::vector<float> traces1((size_t)batch * n);
+      std::vector<int> match(n);
+      WarpingPath path(n, band);
+
+#pragma omp for schedule(static)
+      for (int c = s_beg; c < s_end; c += batch)
+      {
+        // the rest of the batches is skipped, if the run is cancelled (the
+        // caller throws Cancelled)
+        if (cancelled())
+          continue;
+
+        const int n_cols = std::min(batch, s_end - c);
+        transpose_traces(data0, row_beg, row_end, c, c + n_cols, &traces0[0]);
+        transpose_traces(data1, row_beg, row_end, c, c + n_cols, &traces1[0]);
+
+        for (int tr = 0; tr < n_cols; ++tr)
+        {
+          const float *x0 = &traces0[(size_t)tr * n];
+          const float *x1 = &traces1[(size_t)tr * n];
+          path.find(x0, x1, &match[0]);
+
+          const int t = c + tr - col_beg;
+          double s_before = 0., s_after = 0., s_energy = 0., s_lag = 0.;
+          int s_max_lag = 0;
+          for (int i = 0; i < n; ++i)
+          {
+            const int lag = match[i] - i;
+            lags[(size_t)i * s_width + c + tr - s_beg] = lag;
+            const double d0 = (double)x1[i] - x0[i];
+            const double d1 = (double)x1[match[i]] - x0[i];
+            s_before += d0 * d0;
+            s_after += d1 * d1;
+            s_energy += (double)x0[i] * x0[i];
+            s_lag += lag;
+            s_max_lag = std::max(s_max_lag, std::abs(lag));
+          }
+          diff_before[t] = s_before;
+          diff_after[t] = s_after;
+          energy_0[t] = s_energy;
+          max_lag[t] = s_max_lag;
+          mean_lag[t] = s_lag / n;
+        }
+
+        if (progress)
+        {
+          progress->add(n_cols);
+          progress->poll();
+        }
+      }
+    }
+
+    if (cancelled())
+      return;
+    output.stripe(s_beg, s_end, &lags[0]);
+  }
+}
+
+
+
+#endif // DTW_HPP
@@ -0,0 +1,70 @@
+#ifndef FFT_HPP
+#define FFT_HPP
+
+#include <complex>
+#include <vector>
+
+
+
+typedef std::complex<double> Complex;
+
+//==============================================================================
+//
+// Plan of the fast Fourier transform of complex sequences of a power of two
+// length (radix-2, in place). The twiddle factors and the bit reversal
+// permutation are computed once, and the plan is only read by the transforms,
+// so one plan is shared by all the threads, and every thread transforms its
+// own buffers.
+//
+//==============================================================================
+class FftPlan
+{
+public:
+
+  /// The length must be a power of two
+  FftPlan(int length);
+
+  int size() const { return _n; }
+
+  /// Forward transform: X_k = sum_t x_t exp(-2 pi i k t / n)
+  void forward(Complex *data) const;
+
+  /// Inverse transform (normalized by 1/n)
+  void inverse(Complex *data) const;
+
+  /// The least power of two which is not less than n
+  static int next_power_of_two(int n);
+
+protected:
+
+  int _n;
+
+  /// exp(-2 pi i k / len), k = 0, ..., len/2-1, for len = 2, 4, ..., n
+  std::vector<Complex> _twiddles;
+
+  /// The pairs of the indices swapped by the bit reversal permutation
+  std::vector<std::pair<int, int> > _swaps;
+};
+
+
+
+/**
+ * Spectra of two real sequences x and y of length n from the spectrum of the
+ * complex sequence z = x + iy. The spectra are Hermitian, so only their
+ * halves, k = 0, ..., n/2, are computed.
+ */
+inline void split_spectra(const Complex *Z, int n, Complex *X, Complex *Y)
+{
+  for (int k = 0; k <= n/2; ++k)
+  {
+    const Complex z = Z[k];
+    const Complex zc = std::conj(Z[(n - k) & (n - 1)]);
+    X[k] = Complex(0.5 * (z.real() + zc.real()), 0.5 * (z.imag() + zc.imag()));
+    // (z - zc) / 2i
+    Y[k] = Complex(0.5 * (z.imag() - zc.imag()), -0.5 * (z.real() - zc.real()));
+  }
+}
+
+
+
+#endif // FFT_HPP
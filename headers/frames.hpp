@@ -0,0 +1,85 @@
+#ifndef FRAMES_HPP
+#define FRAMES_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+
+//==============================================================================
+//
+// Framed compressed files (.l2z). The rows of a table are split into frames of
+// the same number of rows, and every frame is compressed independently, so the
+// frames can be compressed and decompressed in parallel, and a range of rows
+// can be read by decompressing only the frames which contain it.
+//
+// Layout of a file:
+//   FramedHeader
+//   compressed frames one after another
+//   index: (n_frames + 1) offsets of the frames from the beginning of the file
+//          (the last one is the end of the last frame)
+//
+//==============================================================================
+
+/// Codecs of the frames
+enum FrameCodec
+{
+  CODEC_DEFLATE = 0,  ///< lossless zlib compression of the values
+  CODEC_QUANTIZED = 1 ///< lossy compression of single precision values: they
+                      ///< are quantized with the step equal to the tolerance,
+                      ///< so the error of every value is within the tolerance,
+                      ///< and the integers are compressed by zlib
+};
+
+struct FramedHeader
+{
+  char     magic[4];       ///< "L2Z1"
+  uint32_t version;        ///< version of the format
+  uint32_t type;           ///< ElementType of the values
+  uint32_t codec;          ///< FrameCodec of the frames
+  uint64_t n_rows;         ///< number of rows in the table
+  uint64_t n_cols;         ///< number of columns in the table
+  uint64_t rows_per_frame; ///< number of rows in every frame but the last one
+  uint64_t n_frames;       ///< number of frames
+  uint64_t index_offset;   ///< offset of the index from the beginning
+  double   tolerance;      ///< parameter of the codec (if needed)
+};
+
+/// Default size of a frame before compression (in bytes)
+const int DEFAULT_FRAME_BYTES = 1 << 20;
+
+/**
+ * Check if the file begins with the signature of a framed compressed file.
+ */
+bool is_framed_file(const std::string &filename);
+
+/**
+ * Check if the file begins with the signature of a gzip file.
+ */
+bool is_gzip_file(const std::string &filename);
+
+/**
+ * Compress a frame of the given size (in bytes). The tolerance is used by the
+ * lossy codec only.
+ */
+void compress_frame(FrameCodec codec,
+                    double tolerance,
+                    const char *frame,
+                    long long frame_bytes,
+                    std::vector<char> &compressed);
+
+/**
+ * Decompress a frame which must have the given size (in bytes) when it's
+ * decompressed.
+ */
+void decompress_frame(FrameCodec codec,
+                      double tolerance,
+                      const char *compressed,
+                      long long compressed_bytes,
+                      char *frame,
+                      long long frame_bytes);
+
+
+
+#endif // FRAMES_HPP
@@ -0,0 +1,145 @@
+#ifndef HILBERT_HPP
+#define HILBERT_HPP
+
+#include "fft.hpp"
+#include "progress.hpp"
+#include "tiles.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+
+
+/**
+ *
+ * Envelope and instantaneous phase misfits of each trace of the two datasets.
+ * The analytic signals of the traces are computed by the Hilbert transform
+ * via FFT. The traces are padded with zeros to a power of two length which
+ * is at least twice as long, so there is no wrap-around of the periodic
+ * transform. The traces of the two datasets in the same column are
+ * transformed together as the real and the imaginary parts of one complex
+ * sequence, so every pair of traces costs one forward and two inverse
+ * transforms. The columns are gathered by batches (transposed by tiles), so
+ * the rows are read by contiguous pieces. One FFT plan is shared by all the
+ * threads, and every thread has its own buffers.
+ *
+ * The sums are returned for every trace, so the misfits of the traces and of
+ * the whole datasets can be found:
+ *   envelope misfit = sqrt(env_diff / env_0)
+ *   phase misfit    = sqrt(phase_diff / weight) (in radians)
+ * The squared phase difference is weighted by the product of the envelopes,
+ * so the phase of the samples with vanishing amplitude (where it's undefined)
+ * doesn't matter.
+ *
+ * @param data0[in] First dataset
+ * @param data1[in] Second dataset
+ * @param row_beg[in] Starting row in the datasets
+ * @param row_end[in] Ending row (not including) in the datasets
+ * @param col_beg[in] Starting trace in the datasets
+ * @param col_end[in] Ending trace (not including) in the datasets
+ * @param env_diff[out] Sum of the squared differences of the envelopes
+ * @param env_0[out] Sum of the squared envelope of the first dataset
+ * @param phase_diff[out] Weighted sum of the squared phase differences
+ * @param weight[out] Sum of the weights of the phase differences
+ * @param progress[in] Progress to count the traces in (if it's given). If the
+ *                     run is cancelled, the rest of the traces is skipped.
+ */
+void hilbert_misfits(float **data0,
+                     float **data1,
+                     int row_beg,
+                     int row_end,
+                     int col_beg,
+                     int col_end,
+                     std::vector<double> &env_diff,
+                     std::vector<double> &env_0,
+                     std::vector<double> &phase_diff,
+                     std::vector<double> &weight,
+                     Progress *progress = nullptr)
+{
+  const int n_traces = col_end - col_beg;
+  env_diff.assign(n_traces, 0.);
+  env_0.assign(n_traces, 0.);
+  phase_diff.assign(n_traces, 0.);
+  weight.assign(n_traces, 0.);
+
+  const int n = row_end - row_beg;
+  const FftPlan plan(FftPlan::next_power_of_two(std::max(2 * n, 2)));
+  const int N = plan.size();
+
+  // the number of columns gathered at once: 16 floats make a cache line
+  const int batch = 16;
+
+#pragma omp parallel
+  {
+    std::vector<float> traces0((size_t)batch * n), traces1((size_t)batch * n);
+    std::vector<Complex> z(N), a(N), b(N);
+
+#pragma omp for schedule(static)
+    for (int c = col_beg; c < col_end; c += batch)
+    {
+      // the rest of the batches is skipped, if the run is cancelled (the
+      // caller throws Cancelled)
+      if (cancelled())
+        continue;
+      const int width = std::min(batch, col_end - c);
+      transpose_traces(data0, row_beg, row_end, c, c + width, &traces0[0]);
+      transpose_traces(data1, row_beg, row_end, c, c + width, &traces1[0]);
+
+      for (int k = 0; k < width; ++k)
+      {
+        const float *x0 = &traces0[(size_t)k * n];
+        const float *x1 = &traces1[(size_t)k * n];
+        for (int t = 0; t < n; ++t)
+          z[t] = Complex(x0[t], x1[t]);
+        std::fill(z.begin() + n, z.end(), Complex(0., 0.));
+        plan.forward(&z[0]);
+
+        // the analytic signals have no negative frequencies, and the positive
+        // ones are doubled
+        split_spectra(&z[0], N, &a[0], &b[0]);
+        for (int f = 1; f < N/2; ++f)
+        {
+          a[f] *= 2.;
+          b[f] *= 2.;
+        }
+        std::fill(a.begin() + N/2 + 1, a.end(), Complex(0., 0.));
+        std::fill(b.begin() + N/2 + 1, b.end(), Complex(0., 0.));
+        plan.inverse(&a[0]);
+        plan.inverse(&b[0]);
+
+        double s_env_diff = 0., s_env_0 = 0., s_phase = 0., s_weight = 0.;
+        for (int t = 0; t < n; ++t)
+        {
+          const double e0 = sqrt(std::norm(a[t]));
+          const double e1 = sqrt(std::norm(b[t]));
+          s_env_diff += (e1 - e0) * (e1 - e0);
+          s_env_0 += e0 * e0;
+
+          // the phase difference is the argument of b * conj(a)
+          const double re = b[t].real()*a[t].real() + b[t].imag()*a[t].imag();
+          const double im = b[t].imag()*a[t].real() - b[t].real()*a[t].imag();
+          const double dphi = std::atan2(im, re);
+          s_phase += e0 * e1 * dphi * dphi;
+          s_weight += e0 * e1;
+        }
+
+        const int j = c + k - col_beg;
+        env_diff[j] = s_env_diff;
+        env_0[j] = s_env_0;
+        phase_diff[j] = s_phase;
+        weight[j] = s_weight;
+      }
+
+      if (progress)
+      {
+        progress->add(width);
+        progress->poll();
+      }
+    }
+  }
+}
+
+
+
+#endif // HILBERT_HPP
@@ -0,0 +1,113 @@
+#ifndef MASK_HPP
+#define MASK_HPP
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+
+/// Columns [beg, end) of a row which are compared
+struct Span
+{
+  int beg, end;
+};
+
+
+
+//==============================================================================
+//
+// Mask and weights of the compared samples of a table. They are made of
+//
+//   the weights of the traces: a text file of the lines "trace weight" or
+//   "first_trace last_trace weight" (the traces which aren't listed have the
+//   weight 1, and the traces of the zero weight are dead);
+//
+//   a mute curve: a text file of the lines "trace first_row [end_row]" - the
+//   rows [first_row, end_row) of the trace are compared, the curve is
+//   interpolated linearly between the listed traces, and it's constant
+//   outside them (e.g. the first breaks, or the absorbing zone at the
+//   bottom);
+//
+//   a bitmask of the samples: a binary file of the rows of the table, every
+//   row of (n_cols + 7) / 8 bytes, and the bit j % 8 (from the lowest) of the
+//   byte j / 8 is 1, if the sample of the column j is compared.
+//
+// The compared samples of every row are kept as the spans of the columns (a
+// sparse form: a mute curve and a few dead traces make a few spans per row),
+// so the kernels go over the spans only, and the rows without any span aren't
+// read at all. The rows of the same spans share them, so the mask takes a few
+// bytes per row besides the distinct patterns of the spans. The values of both
+// datasets are multiplied by the weights of their traces before they are
+// compared.
+//
+//==============================================================================
+class Mask
+{
+public:
+
+  /// Make the mask of the rows [row_beg, row_end) and the columns
+  /// [col_beg, col_end) of the table n_rows x n_cols. The files which aren't
+  /// given are empty strings.
+  Mask(const std::string &weights_file,
+       const std::string &mute_file,
+       const std::string &bitmask_file,
+       int n_rows, int n_cols,
+       int row_beg, int row_end,
+       int col_beg, int col_end);
+
+  /// Spans of the row: [spans_begin(row), spans_end(row))
+  const Span* spans_begin(int row) const
+  { return _spans.data() + _offsets[_patterns[row - _row_beg]]; }
+  const Span* spans_end(int row) const
+  { return _spans.data() + _offsets[_patterns[row - _row_beg] + 1]; }
+
+  /// Whether the rows [row, row + n_rows) have no compared samples
+  bool masked(int row, int n_rows) const
+  {
+    const int beg = std::max(row, _row_beg) - _row_beg;
+    const int end = std::min(row + n_rows, _row_end) - _row_beg;
+    return beg >= end || _live_rows[beg] == _live_rows[end];
+  }
+
+  /// Weights of the columns, or nullptr if all of them are 1
+  const double* weights() const
+  { return (_weighted ? &_weights[0] : nullptr); }
+
+  /// Number of the compared samples of the column, and of all of them
+  long long n_live(int col) const { return _n_live[col]; }
+  long long n_live() const;
+
+  /// Weigh the rows [row, row + n_rows) of the data (full rows of n_cols
+  /// values) and zero the samples which aren't compared, for the
+  /// computations over the whole data
+  void apply(float *rows, int row, int n_rows) const;
+
+protected:
+
+  int _n_cols, _row_beg, _row_end;
+
+  std::vector<double> _weights;
+  bool _weighted;
+
+  /// The spans of the pattern p are [_offsets[p], _offsets[p + 1]) of _spans,
+  /// and the row i has the pattern _patterns[i - _row_beg]. The number of the
+  /// rows before the row i which have any span is _live_rows[i - _row_beg].
+  std::vector<long long> _offsets;
+  std::vector<Span> _spans;
+  std::vector<int> _patterns;
+  std::vector<int> _live_rows;
+
+  std::vector<long long> _n_live;
+
+  int add_pattern(const std::vector<Span> &spans,
+                  std::unordered_multimap<size_t, int> &known);
+  void read_weights(const std::string &filename);
+  void read_mute(const std::string &filename, int n_rows,
+                 std::vector<int> &first, std::vector<int> &end) const;
+};
+
+
+
+#endif // MASK_HPP
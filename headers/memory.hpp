@@ -0,0 +1,98 @@
+#ifndef MEMORY_HPP
+#define MEMORY_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+
+
+/// Pages of the large buffers
+enum PagePolicy
+{
+  PAGES_SMALL,      ///< the usual pages
+  PAGES_TRANSPARENT,///< transparent huge pages (advised to the kernel)
+  PAGES_HUGE        ///< explicit huge pages (from the pool of the system)
+};
+
+/// Placement of the pages of the large buffers on the NUMA nodes
+enum NumaPolicy
+{
+  NUMA_DEFAULT,     ///< as the system places them
+  NUMA_INTERLEAVE,  ///< interleaved between all the nodes
+  NUMA_FIRST_TOUCH  ///< on the nodes of the threads which own the rows
+};
+
+/// Binding of the threads to the CPUs
+enum PinPolicy
+{
+  PIN_NONE,         ///< the threads aren't bound
+  PIN_COMPACT,      ///< the consecutive threads on the consecutive CPUs
+  PIN_SCATTER       ///< the consecutive threads on the different NUMA nodes
+};
+
+PagePolicy page_policy(const std::string &name);
+NumaPolicy numa_policy(const std::string &name);
+PinPolicy pin_policy(const std::string &name);
+
+
+
+//==============================================================================
+//
+// Buffer of n_rows rows of row_bytes bytes for the whole datasets. It's mapped
+// directly from the system, so its pages can be huge, and they can be spread
+// between the NUMA nodes, so all the memory controllers are used by the
+// multithreaded computations. The pages are mapped at the first touch, which
+// is done by the threads according to the static partition of every row into
+// contiguous parts (the one of the parallel loops over the traces), if the
+// first touch placement is requested, and otherwise they are touched when the
+// buffer is filled. If the
+// huge pages can't be used, the buffer falls back to the usual ones with a
+// warning.
+//
+//==============================================================================
+class LargeBuffer
+{
+public:
+
+  LargeBuffer(size_t n_rows, size_t row_bytes, PagePolicy pages,
+              NumaPolicy numa);
+
+  ~LargeBuffer();
+
+  char* data() const { return _data; }
+
+  /// The pages which were actually given
+  PagePolicy pages() const { return _pages; }
+
+protected:
+
+  char *_data;
+
+  /// The size of the mapping (a multiple of the page size)
+  size_t _mapped;
+
+  PagePolicy _pages;
+
+  LargeBuffer(const LargeBuffer&);
+  LargeBuffer& operator =(const LargeBuffer&);
+};
+
+
+
+/// The NUMA nodes which are online (the node 0 if it's unknown)
+std::vector<int> numa_nodes();
+
+/// The CPUs of the list like "0-3,8,10-11"
+std::vector<int> parse_cpu_list(const std::string &list);
+
+/**
+ * Bind the threads of the OpenMP parallel regions to the CPUs which the
+ * process is allowed to use. It's done once, before the computations, and the
+ * threads keep their binding in the following parallel regions.
+ */
+void pin_threads(PinPolicy policy, int verbose);
+
+
+
+#endif // MEMORY_HPP
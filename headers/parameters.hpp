@@ -160,15 +160,38 @@ public:
   /// Two files for comparison or two components of one solution. In case we
   /// compute relative errors we assume that the _file_0 will contain a
   /// reference solution. The files are in binary format with floating point
-  /// numbers in SINGLE precision. If the files represent seismograms we assume
-  /// that columns represent traces and each row is a time step.
+  /// numbers (see _type_0 and _type_1 for their precision). If the files
+  /// represent seismograms we assume that columns represent traces and each
+  /// row is a time step.
   std::string _file_0, _file_1;
 
+  /// Format of the files: raw (a table of floats without any headers), su
+  /// (Seismic Unix), segy (SEG-Y with IBM or IEEE floats), or auto (default),
+  /// which means that the format is defined by the extension of every file
+  /// (.su, .sgy or .segy, otherwise raw).
+  std::string _format;
+
+  /// Types of the numbers in the raw files _file_0 and _file_1: f32 (single
+  /// precision, default), f64 (double precision), f16 (half precision), or bf16
+  /// (brain floating point). The files of different types can be compared.
+  std::string _type_0, _type_1;
+
+  /// Order of bytes of the numbers in the input files: native, little, big,
+  /// auto (default), which means that it's detected by the headers of the
+  /// files and the raw files are native, or guess, which is auto with the
+  /// order of the raw files guessed by their values (with a warning, if they
+  /// are swapped). _endian_0 and _endian_1 are the orders of _file_0 and
+  /// _file_1, and _endian (-endian) is the order of both, unless they're given
+  /// (e.g. a big-endian raw file compared with a native reference). The output
+  /// files (difference, scaled and shifted data) are written in the order
+  /// _out_endian (native by default).
+  std::string _endian, _endian_0, _endian_1, _out_endian;
+
   /// The files are binary, in form of a table. However, in general case, we
   /// don't need to know the number of the columns to compute the errors.
   /// Nevertheless, sometimes we need to know the errors in specific columns,
   /// therefore we need to keep the data from the files in a table (2D array)
-  /// format.
+  /// format. For the SU and SEG-Y files this number is taken from the files.
   int _n_cols;
 
   /// Compute the errors in a specific region of columns [_col_beg, _col_end)
@@ -186,9 +209,21 @@ public:
 
   /// The name of the file representing the difference between two datasets from
   /// the files _file_0 and _file_1. The data in the difference file are also
-  /// saved in single precision.
+  /// saved in single precision. If the name has the .l2z extension, the file
+  /// is compressed.
   std::string _diff_file;
 
+  /// The name of the framed compressed file (.l2z) which is created from the
+  /// _file_0. Such files are read transparently (as well as gzip-compressed
+  /// raw files), but unlike gzip they can be decompressed in parallel, and
+  /// only the frames with the requested rows are decompressed.
+  std::string _pack_file;
+
+  /// If it's positive, the difference file is compressed with loss: every
+  /// value is stored with the error not exceeding this tolerance. Such file
+  /// must have the .l2z extension, and it can be read as an input later.
+  double _diff_tolerance;
+
   /// Whether to scale the data from the _file_1 in such a way that it might be
   /// closer to the data from the _file_0. That creates a new file with the
   /// suffix 'scaled' (or similar). This works when _scale_file_1 == 1, but when
@@ -223,11 +258,155 @@ public:
   /// rms = 1 (compute 2 RMS arrays for each input file)
   /// rms = 2 (compute 1 RMS array of amplitude of a vector solution - based on
   ///          two input files representing Ux and Uz components of the field)
+  /// rms = 3 (compute 1 RMS array of the difference between the files; it's
+  ///          done by streaming the files)
   int _rms;
 
+  /// Length of the time window (in rows) for time-gated RMS and L2 misfit of
+  /// the traces. If it's 0 (default) the time-gated values are not computed.
+  /// Otherwise the result is a (windows x traces) table for every dataset and
+  /// for their difference.
+  int _win_len;
+
+  /// Step (in rows) between the beginnings of the consecutive time windows. If
+  /// it's 0 (default) the windows don't overlap, i.e. _win_hop = _win_len.
+  int _win_hop;
+
+  /// Components of a vector solution (for example, "ux.bin,uy.bin,uz.bin")
+  /// given as a comma separated list of file names. If defined, the RMS of the
+  /// amplitude of the vector solution is computed for each trace. The files are
+  /// processed by blocks of rows, so none of them is loaded in memory as a
+  /// whole.
+  std::string _vec_files_0;
+
+  /// Components of the second vector solution in the same order as in the
+  /// _vec_files_0. If defined, vector L2 and L1 norms of the difference between
+  /// the solutions and their vector cross correlation are computed as well.
+  std::string _vec_files_1;
+
   /// Check if the traces in the selected range are symmetric. This is useful
   /// when the wavefield should be symmetric, and so should be the seismograms.
-  bool _check_symmetry;
+  /// 0 (default) - do not check
+  /// 1 - show the summary: max and mean difference between the mirrored
+  ///     traces, a histogram of the differences and the worst pairs
+  /// 2 - show the summary and the difference for every pair of traces
+  int _check_symmetry;
+
+  /// Number of the worst pairs of the mirrored traces shown in the summary of
+  /// the symmetry check.
+  int _sym_worst;
+
+  /// Level of the decimated pyramid for the preview. If it's positive, the
+  /// L2 and L1 norms of the difference (and the RMS and the cross correlation,
+  /// if they are requested) are first estimated by every 2^level-th sample of
+  /// every 2^level-th trace, with 95% confidence intervals, and then (if
+  /// _refine is true) they are computed at the full resolution.
+  int _preview;
+
+  /// Budget (in megabytes of the files) of the sampling estimator. If it's
+  /// positive, the L2 and L1 norms of the difference (and the global cross
+  /// correlation and the RMS, if they are requested) are only estimated by
+  /// random blocks of rows drawn from the strata of the rows, with
+  /// approximate 95% confidence intervals. _seed is the seed of the random
+  /// draws.
+  double _sample_budget;
+  int _seed;
+
+  /// Whether the levels of the pyramid are cached on disk next to the files
+  bool _preview_cache;
+
+  /// Whether the full resolution computations follow the preview
+  bool _refine;
+
+  /// Tolerances of the relative L2 norm of the difference and of the max
+  /// absolute difference. If any of them is non-negative, the files are only
+  /// checked against the tolerances (the other computations are skipped), and
+  /// the program returns EXIT_TOLERANCE_FAILED if a tolerance is exceeded.
+  /// The check stops as soon as it's proven.
+  double _tol_l2, _tol_max;
+
+  /// Half-width (in rows) of the Sakoe-Chiba band of the dynamic time warping
+  /// alignment of every trace of data 1 to data 0 (0 means no alignment). The
+  /// aligned data 1 are written to <f1>_dtw.bin, and the summary of the
+  /// warping paths of the traces to dtw_<f0>_<f1>.bin.
+  int _dtw_band;
+
+  /// Whether the envelope and instantaneous phase misfits of every trace are
+  /// computed (via the Hilbert transform)
+  bool _hilbert;
+
+  /// Whether the amplitude spectra and the phase differences of every trace
+  /// are computed, and the L2 misfits of the spectra in the frequency bands.
+  /// The bands are given as comma separated ranges of frequencies lo-hi (in
+  /// the units of 1/_dt, e.g. Hz if the time step _dt is in seconds). The
+  /// misfit of the whole spectrum is always computed.
+  bool _spectrum;
+  double _dt;
+  std::string _bands;
+
+  /// Whether the statistics of the difference are computed (in the same pass
+  /// over the files as the L2 and L1 norms): histograms and percentiles of the
+  /// absolute and relative differences, misfits of every trace, and the
+  /// _stats_worst worst locations.
+  bool _stats;
+  int _stats_worst;
+
+  /// Whether the indexes of the blocks of the input files (<file>.l2i) are
+  /// used to skip the blocks which are equal in both files. The indexes are
+  /// built during the first comparison of the files.
+  bool _block_index;
+
+  /// Allocation of the whole data (for the computations which need them): the
+  /// pages (small, thp - transparent huge pages, huge - explicit huge pages
+  /// from the pool of the system), their placement on the NUMA nodes
+  /// (default, interleave, firsttouch - by the threads which own the rows),
+  /// and the binding of the threads to the CPUs (none, compact, scatter - the
+  /// consecutive threads on the different nodes).
+  std::string _pages, _numa, _pin;
+
+  /// Whether the profile of the run is printed: the time and the allocations
+  /// on the heap of every stage
+  bool _profile;
+
+  /// Backend of reading the raw files: stream (through the page cache),
+  /// direct (O_DIRECT), uring (io_uring with O_DIRECT), and the number of the
+  /// reads in flight for io_uring
+  std::string _io;
+  int _queue_depth;
+
+  /// File of the checkpoints of the run (no checkpoints, if it's not given),
+  /// the interval between them in seconds, and whether the run is resumed
+  /// from the checkpoint. The checkpoints keep the state of the streamed
+  /// metrics and of the lags of the cross correlation, and the file is
+  /// removed when the run is complete.
+  std::string _checkpoint_file;
+  double _checkpoint_interval;
+  bool _resume;
+
+  /// Mask and weights of the compared samples (see Mask): a text file of the
+  /// weights of the traces (the traces of the zero weight are dead), a text
+  /// file of the mute curve (the compared rows of the traces), and a binary
+  /// bitmask of the samples. The rows and the blocks of the rows without any
+  /// compared sample aren't read by the streamed computations. The mask is
+  /// applied to all the components of the vector solutions too.
+  std::string _weights_file, _mute_file, _mask_file;
+
+  /// Reports of the progress of the long stages on stderr (none, text, or
+  /// json - a JSON object per line), and the interval between them in
+  /// seconds
+  std::string _progress;
+  double _progress_interval;
+
+  /// Sharded execution: the run computes only the shard _shard of _n_shards,
+  /// split by rows (by whole blocks of rows) or by traces, and writes its
+  /// partial results in _partial_files. "l2l1 merge" with the options of the
+  /// shards and the comma separated partial results of all of them combines
+  /// them into the results of the whole run (_merge). Only the streamed
+  /// metrics and the statistics of the difference are sharded.
+  int _shard, _n_shards;
+  std::string _shard_by;
+  std::string _partial_files;
+  bool _merge;
 
 
   typedef std::map<std::string, ParamBasePtr> ParaMap;
@@ -0,0 +1,50 @@
+#ifndef PROFILE_HPP
+#define PROFILE_HPP
+
+#include <cstddef>
+#include <string>
+
+
+
+/// Number and total size of the allocations on the heap made by the program
+/// since the first enabled profile (all the operators new are counted, but
+/// only while the profile is enabled)
+struct HeapCounts
+{
+  size_t allocations, bytes;
+};
+
+HeapCounts heap_counts();
+
+
+
+//==============================================================================
+//
+// Profile of the stages of a run: the wall time and the allocations on the
+// heap of every stage are printed when the stage is over. The stages follow
+// each other, so every one is measured from the end of the previous one.
+//
+//==============================================================================
+class Profile
+{
+public:
+
+  explicit Profile(bool enabled);
+
+  bool enabled() const { return _enabled; }
+
+  /// Print the stage which is over, and start the next one
+  void stage(const char *name);
+
+protected:
+
+  bool _enabled;
+
+  double _start; ///< wall time of the start of the stage
+
+  HeapCounts _heap;
+};
+
+
+
+#endif // PROFILE_HPP
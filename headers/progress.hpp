@@ -0,0 +1,185 @@
+#ifndef PROGRESS_HPP
+#define PROGRESS_HPP
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(_OPENMP)
+  #include <omp.h>
+#endif
+
+
+
+/// Size of a cache line, which the counters of the threads don't share
+const int CACHE_LINE_BYTES = 64;
+
+/// Formats of the progress reports
+enum ProgressFormat
+{
+  PROGRESS_NONE, ///< no reports
+  PROGRESS_TEXT, ///< a line of text on stderr
+  PROGRESS_JSON  ///< a JSON object per line on stderr
+};
+
+/**
+ * Get the format by its name: "none", "text" or "json".
+ */
+ProgressFormat progress_format(const std::string &name);
+
+
+
+//==============================================================================
+//
+// Progress of the stages of a long run: the items (rows, lags) which are done,
+// the throughput and the estimated time to the end of the stage are reported
+// at the given interval. The items are counted by every thread in its own
+// atomic counter (on its own cache line) with relaxed increments, and the
+// counters are summed only when a report is due, so counting costs an
+// addition. The threads call poll() after their pieces of work, and only the
+// main thread (the thread 0 of a parallel region) reports.
+//
+//==============================================================================
+class Progress
+{
+public:
+
+  Progress(ProgressFormat format, double interval);
+
+  bool enabled() const { return _format != PROGRESS_NONE; }
+
+  /// Start a stage of n_total items. If the size of an item is given, the
+  /// throughput is reported in MB/s too.
+  void start(const char *stage, long long n_total, const char *unit,
+             double item_bytes = 0.);
+
+  /// Count the items done by the calling thread
+  void add(long long n)
+  {
+    int thread = 0;
+#if defined(_OPENMP)
+    thread = omp_get_thread_num();
+#endif
+    _counters[thread].n_items.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  /// Report the progress, if the interval has passed since the previous
+  /// report (the other threads than the main one return at once)
+  void poll();
+
+  /// Report the end of the stage (if its progress was reported)
+  void finish();
+
+protected:
+
+  /// The items of a thread, alone on a cache line
+  struct Counter
+  {
+    std::atomic<long long> n_items;
+    char padding[CACHE_LINE_BYTES - sizeof(std::atomic<long long>)];
+  };
+
+  ProgressFormat _format;
+
+  double _interval;
+
+  /// The counters of the threads in the storage aligned to a cache line
+  std::vector<char> _storage;
+  Counter *_counters;
+  int _n_counters;
+
+  std::string _stage, _unit;
+  long long _n_total;
+  double _item_bytes;
+
+  /// Wall time of the start of the stage and of the previous report
+  double _start, _last_report;
+
+  bool _reported; ///< whether anything of the stage was reported
+
+  void report(bool finished);
+
+  Progress(const Progress&);
+  Progress& operator =(const Progress&);
+};
+
+
+
+//==============================================================================
+//
+// Cancellation of a run by SIGINT or SIGTERM: the handler only sets a flag,
+// and the long loops check it between the pieces of work. The run is stopped
+// by the exception Cancelled, so the outputs of the stages are closed (and the
+// incomplete ones are removed by their guards) on the way out. The second
+// signal terminates the program at once.
+//
+//==============================================================================
+class Cancelled : public std::runtime_error
+{
+public:
+
+  explicit Cancelled(int signal_number);
+
+  int signal_number() const { return _signal_number; }
+
+protected:
+
+  int _signal_number;
+};
+
+/// Exit code of the program cancelled by a signal is 128 + its number
+const int EXIT_CANCELLED_BASE = 128;
+
+/**
+ * Install the handlers of SIGINT and SIGTERM.
+ */
+void cancel_on_signals();
+
+/**
+ * The number of the signal which cancelled the run, or 0.
+ */
+int cancel_signal();
+
+inline bool cancelled() { return cancel_signal() != 0; }
+
+/**
+ * Throw Cancelled, if the run is cancelled.
+ */
+void check_cancelled();
+
+
+
+//==============================================================================
+//
+// Guard of an output file which is being written: if it's destroyed before
+// the file is complete (the run is cancelled, or a write fails), the file is
+// removed, so no partial files are left behind.
+//
+//==============================================================================
+class OutputGuard
+{
+public:
+
+  explicit OutputGuard(const std::string &filename)
+    : _filename(filename), _complete(false)
+  { }
+
+  ~OutputGuard();
+
+  /// The file is complete (or it's kept to be continued)
+  void complete() { _complete = true; }
+
+protected:
+
+  std::string _filename;
+
+  bool _complete;
+
+  OutputGuard(const OutputGuard&);
+  OutputGuard& operator =(const OutputGuard&);
+};
+
+
+
+#endif // PROGRESS_HPP
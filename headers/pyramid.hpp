@@ -0,0 +1,73 @@
+#ifndef PYRAMID_HPP
+#define PYRAMID_HPP
+
+#include <string>
+#include <vector>
+
+class BlockReader;
+
+
+
+//==============================================================================
+//
+// Decimated copy of a table for the previews. The level L of the pyramid
+// contains every 2^L-th row (time step) of every 2^L-th column (trace) of the
+// whole table, so the metrics computed on it are the estimates of the full
+// resolution ones by a systematic sample of 1/4^L of the values. The samples
+// aren't filtered before the decimation, since the differences between the
+// files are often of high frequency, and a filter would hide them.
+//
+// The level may be cached on disk next to the original file as a framed
+// compressed file (see frames.hpp), so the next preview of the same file
+// doesn't read the original file at all. The cache is rebuilt when it's older
+// than the original file.
+//
+//==============================================================================
+class Pyramid
+{
+public:
+
+  /// Build (or read from the cache) the given level of the pyramid of the file
+  /// opened by the reader
+  Pyramid(BlockReader &in, int level, bool use_cache);
+
+  int level() const { return _level; }
+
+  /// Decimation factor in both directions
+  int factor() const { return 1 << _level; }
+
+  int n_rows() const { return _n_rows; }
+  int n_cols() const { return _n_cols; }
+
+  /// Whether the level was read from the cache rather than built
+  bool cached() const { return _cached; }
+
+  /// Rows of the decimated table
+  float** rows() { return &_rows[0]; }
+
+  /// Name of the file where the level of the pyramid of the file is cached
+  static std::string cache_name(const std::string &filename, int level);
+
+protected:
+
+  int _level;
+
+  int _n_rows, _n_cols;
+
+  bool _cached;
+
+  /// The values of the decimated table, and the pointers to its rows
+  std::vector<float> _values;
+  std::vector<float*> _rows;
+
+  void build(BlockReader &in);
+  bool read_cache(const std::string &filename, const std::string &cache);
+  void write_cache(const std::string &cache) const;
+
+  Pyramid(const Pyramid&);
+  Pyramid& operator =(const Pyramid&);
+};
+
+
+
+#endif // PYRAMID_HPP
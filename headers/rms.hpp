@@ -1,6 +1,70 @@
 #ifndef RMS_H
 #define RMS_H
 
+#include "progress.hpp"
+#include "tiles.hpp"
+
+
+
+/// Kernel of the tiled traversal for the RMS of the traces of two datasets
+/// (separately, or as the components of a vector field)
+template <bool AMPLITUDE>
+class RmsTiles
+{
+public:
+
+  static const int N_SUMS = (AMPLITUDE ? 1 : 2);
+
+  RmsTiles(float **data0, float **data1, int row_beg, int row_end,
+           int col_beg, std::vector<double> &RMS_0, std::vector<double> &RMS_1)
+    : _data0(data0), _data1(data1), _n_rows(row_end - row_beg),
+      _col_beg(col_beg), _RMS_0(RMS_0), _RMS_1(RMS_1)
+  { }
+
+  void tile(int i_beg, int i_end, int j_beg, int j_end, double *sums,
+            int stride)
+  {
+    double *sum0 = sums - j_beg;
+    double *sum1 = sums + (N_SUMS - 1) * stride - j_beg;
+    for (int i = i_beg; i < i_end; ++i)
+    {
+      const float *row0 = _data0[i];
+      const float *row1 = _data1[i];
+      for (int j = j_beg; j < j_end; ++j)
+      {
+        const double d0 = row0[j];
+        const double d1 = row1[j];
+        if (AMPLITUDE)
+          sum0[j] += (d0*d0 + d1*d1);
+        else
+        {
+          sum0[j] += d0*d0;
+          sum1[j] += d1*d1;
+        }
+      }
+    }
+  }
+
+  void stripe(int j_beg, int j_end, const double *sums, int stride)
+  {
+    for (int j = j_beg; j < j_end; ++j)
+    {
+      _RMS_0[j - _col_beg] = sqrt(sums[j - j_beg] / _n_rows);
+      if (!AMPLITUDE)
+        _RMS_1[j - _col_beg] = sqrt(sums[stride + j - j_beg] / _n_rows);
+    }
+  }
+
+protected:
+
+  float **_data0, **_data1;
+  int _n_rows, _col_beg;
+  std::vector<double> &_RMS_0, &_RMS_1;
+
+  RmsTiles(const RmsTiles&);
+  RmsTiles& operator =(const RmsTiles&);
+};
+
 
 
 void compute_rms_diff_files(float **data0,
@@ -17,26 +81,8 @@ void compute_rms_diff_files(float **data0,
   RMS_1.clear();
   RMS_1.resize(col_end - col_beg, 0.0);
 
-  for (int i = row_beg; i < row_end; ++i)
-  {
-    for (int j = col_beg; j < col_end; ++j)
-    {
-      const double d0 = data0[i][j];
-      const double d1 = data1[i][j];
-
-      RMS_0[j - col_beg] += d0*d0;
-      RMS_1[j - col_beg] += d1*d1;
-    }
-  }
-
-  for (size_t i = 0; i < RMS_0.size(); ++i)
-  {
-    RMS_0[i] /= row_end - row_beg;
-    RMS_1[i] /= row_end - row_beg;
-
-    RMS_0[i] = sqrt(RMS_0[i]);
-    RMS_1[i] = sqrt(RMS_1[i]);
-  }
+  RmsTiles<false> kernel(data0, data1, row_beg, row_end, col_beg, RMS_0, RMS_1);
+  traverse_tiles(row_beg, row_end, col_beg, col_end, kernel);
 }
 
 
@@ -52,22 +98,140 @@ void compute_rms_amplitude(float **data0,
 {
   RMS.clear();
   RMS.resize(col_end - col_beg, 0.0);
-  
-  for (int i = row_beg; i < row_end; ++i)
+
+  RmsTiles<true> kernel(data0, data1, row_beg, row_end, col_beg, RMS, RMS);
+  traverse_tiles(row_beg, row_end, col_beg, col_end, kernel);
+}
+
+
+
+/**
+ *
+ * Time-gated RMS of each trace of the two datasets and L2 norm of their
+ * difference in sliding windows. The window [beg, beg + win_len) starts at
+ * row_beg and moves with the step hop, so there are
+ * (row_end - row_beg - win_len) / hop + 1 windows. The sums are updated by
+ * adding the rows entering the window and subtracting the rows leaving it,
+ * therefore every row is touched at most twice regardless of the window
+ * length.
+ *
+ * The results are stored window by window, i.e. the value for window w and
+ * trace j is at [w * (col_end - col_beg) + j - col_beg].
+ *
+ * @param data0[in] First dataset
+ * @param data1[in] Second dataset
+ * @param row_beg[in] Starting row in the datasets
+ * @param row_end[in] Ending row (not including) in the datasets
+ * @param col_beg[in] Starting trace in the datasets
+ * @param col_end[in] Ending trace (not including) in the datasets
+ * @param win_len[in] Length of the window (in rows)
+ * @param hop[in] Step between the beginnings of the consecutive windows
+ * @param RMS_0[out] RMS of the first dataset in every window
+ * @param RMS_1[out] RMS of the second dataset in every window
+ * @param L2_diff[out] L2 norm of the difference in every window
+ * @param progress[in] Progress to count the traces in (if it's given). If the
+ *                     run is cancelled, the rest of the windows is skipped.
+ */
+void compute_rms_windows(float **data0,
+                         float **data1,
+                         int row_beg,
+                         int row_end,
+                         int col_beg,
+                         int col_end,
+                         int win_len,
+                         int hop,
+                         std::vector<double> &RMS_0,
+                         std::vector<double> &RMS_1,
+                         std::vector<double> &L2_diff,
+                         Progress *progress = nullptr)
+{
+  const int n_traces = col_end - col_beg;
+  const int n_windows = (row_end - row_beg - win_len) / hop + 1;
+
+  RMS_0.clear();
+  RMS_0.resize(n_windows * n_traces, 0.0);
+  RMS_1.clear();
+  RMS_1.resize(n_windows * n_traces, 0.0);
+  L2_diff.clear();
+  L2_diff.resize(n_windows * n_traces, 0.0);
+
+  // the traces are processed in chunks, so the running sums of a chunk stay in
+  // cache while we go down the rows of the row-major datasets
+  const int chunk = 512;
+  const int n_chunks = (n_traces + chunk - 1) / chunk;
+
+#pragma omp parallel for schedule(static)
+  for (int ch = 0; ch < n_chunks; ++ch)
   {
-    for (int j = col_beg; j < col_end; ++j)
-    {
-      const double d0 = data0[i][j];
-      const double d1 = data1[i][j];
+    const int j_beg = col_beg + ch * chunk;
+    const int j_end = std::min(j_beg + chunk, col_end);
+
+    std::vector<double> sum0(j_end - j_beg, 0.0);
+    std::vector<double> sum1(j_end - j_beg, 0.0);
+    std::vector<double> sumd(j_end - j_beg, 0.0);
 
-      RMS[j - col_beg] += (d0*d0 + d1*d1);
+    // the rows [cur_beg, cur_end) are currently in the running sums
+    int cur_beg = row_beg, cur_end = row_beg;
+
+    for (int w = 0; w < n_windows; ++w)
+    {
+      // the caller throws Cancelled
+      if (cancelled())
+        break;
+
+      const int beg = row_beg + w * hop;
+      const int end = beg + win_len;
+
+      if (beg >= cur_end) // no overlap with the previous window (hop>=win_len)
+      {
+        std::fill(sum0.begin(), sum0.end(), 0.0);
+        std::fill(sum1.begin(), sum1.end(), 0.0);
+        std::fill(sumd.begin(), sumd.end(), 0.0);
+        cur_beg = cur_end = beg;
+      }
+
+      for (int i = cur_beg; i < beg; ++i) // the rows leaving the window
+      {
+        for (int j = j_beg; j < j_end; ++j)
+        {
+          const double d0 = data0[i][j];
+          const double d1 = data1[i][j];
+          sum0[j - j_beg] -= d0*d0;
+          sum1[j - j_beg] -= d1*d1;
+          sumd[j - j_beg] -= (d0-d1)*(d0-d1);
+        }
+      }
+
+      for (int i = cur_end; i < end; ++i) // the rows entering the window
+      {
+        for (int j = j_beg; j < j_end; ++j)
+        {
+          const double d0 = data0[i][j];
+          const double d1 = data1[i][j];
+          sum0[j - j_beg] += d0*d0;
+          sum1[j - j_beg] += d1*d1;
+          sumd[j - j_beg] += (d0-d1)*(d0-d1);
+        }
+      }
+
+      cur_beg = beg;
+      cur_end = end;
+
+      // the subtraction may leave tiny negative round-off instead of zero
+      for (int j = j_beg; j < j_end; ++j)
+      {
+        const int k = w * n_traces + j - col_beg;
+        RMS_0[k]   = sqrt(std::max(sum0[j - j_beg], 0.0) / win_len);
+        RMS_1[k]   = sqrt(std::max(sum1[j - j_beg], 0.0) / win_len);
+        L2_diff[k] = sqrt(std::max(sumd[j - j_beg], 0.0));
+      }
     }
-  }
 
-  for (size_t i = 0; i < RMS.size(); ++i)
-  {
-    RMS[i] /= row_end - row_beg;
-    RMS[i] = sqrt(RMS[i]);
+    if (progress)
+    {
+      progress->add(j_end - j_beg);
+      progress->poll();
+    }
   }
 }
 
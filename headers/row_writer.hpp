@@ -0,0 +1,167 @@
+#ifndef ROW_WRITER_HPP
+#define ROW_WRITER_HPP
+
+#include "conversion.hpp"
+#include "frames.hpp"
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+
+//==============================================================================
+//
+// Writer of a table of single precision numbers by blocks of rows
+//
+//==============================================================================
+class RowWriter
+{
+public:
+
+  RowWriter(const std::string &filename, int n_cols)
+    : _filename(filename),
+      _n_cols(n_cols)
+  { }
+
+  virtual ~RowWriter() { }
+
+  const std::string& name() const { return _filename; }
+
+  /// Write n_rows rows (n_rows * n_cols values) of the table
+  virtual void write_rows(const float *rows, int n_rows) = 0;
+
+  /// Finish writing the file
+  virtual void close() = 0;
+
+  /// Push the written rows to the file
+  virtual void flush() { }
+
+protected:
+
+  std::string _filename;
+
+  int _n_cols;
+};
+
+
+
+//==============================================================================
+//
+// Writer of a raw binary file. The values are written in the given order of
+// bytes.
+//
+//==============================================================================
+class RawWriter : public RowWriter
+{
+public:
+
+  /// If first_row is positive, the file is kept, and the rows are written
+  /// from that row on (to continue writing an interrupted file)
+  RawWriter(const std::string &filename,
+            int n_cols,
+            ByteOrder order = ORDER_NATIVE,
+            long long first_row = 0);
+
+  virtual ~RawWriter();
+
+  virtual void write_rows(const float *rows, int n_rows);
+
+  /// Write the columns [col, col + width) of the rows [row, row + n_rows) of
+  /// the table from the block of n_rows x width values
+  void write_columns(const float *block, long long row, int n_rows,
+                     int col, int width);
+
+  virtual void close();
+
+  virtual void flush();
+
+protected:
+
+  std::ofstream _out;
+
+  /// Whether the bytes of the values are swapped before writing
+  bool _swap;
+
+  /// Copy of the rows with the swapped bytes
+  std::vector<float> _swapped;
+};
+
+
+
+//==============================================================================
+//
+// Writer of a framed compressed file (see frames.hpp). The rows are collected
+// in frames, and when there are as many full frames as threads, they are
+// compressed in parallel and written. The values may be of any type, then
+// they are given by write_block().
+//
+//==============================================================================
+class FrameWriter : public RowWriter
+{
+public:
+
+  FrameWriter(const std::string &filename,
+              int n_cols,
+              FrameCodec codec = CODEC_DEFLATE,
+              ElementType type = FLOAT32,
+              double tolerance = 0.0);
+
+  virtual ~FrameWriter();
+
+  virtual void write_rows(const float *rows, int n_rows);
+
+  /// Write n_rows rows of values of the type given in the constructor
+  void write_block(const char *rows, int n_rows);
+
+  virtual void close();
+
+protected:
+
+  std::ofstream _out;
+
+  FramedHeader _header;
+
+  /// Offsets of the written frames
+  std::vector<uint64_t> _offsets;
+
+  /// Size of a row in bytes
+  long long _row_bytes;
+
+  /// Rows which are not written yet
+  std::vector<char> _pending;
+
+  /// Number of rows in _pending
+  long long _n_pending;
+
+  /// Maximal number of rows in _pending
+  long long _max_pending;
+
+  bool _closed;
+
+  /// Compress and write the full frames from _pending (and the last partial
+  /// one, if it's the end of the file)
+  void flush(bool last);
+};
+
+
+
+/**
+ * Create a writer for the file. If the tolerance is positive, it's a framed
+ * file with the values quantized within the tolerance. If the file has the
+ * extension .l2z, it's a framed losslessly compressed file. Otherwise it's a
+ * raw binary one with the given order of bytes. The framed files are always
+ * written in the native order, since it's recognized by their header. If
+ * first_row is positive, the raw file is continued from that row (the framed
+ * files can't be continued).
+ */
+std::shared_ptr<RowWriter> create_row_writer(const std::string &filename,
+                                             int n_cols,
+                                             double tolerance = 0.0,
+                                             ByteOrder order = ORDER_NATIVE,
+                                             long long first_row = 0);
+
+
+
+#endif // ROW_WRITER_HPP
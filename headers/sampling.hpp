@@ -0,0 +1,137 @@
+#ifndef SAMPLING_HPP
+#define SAMPLING_HPP
+
+#include <cmath>
+#include <vector>
+
+/// Size of a sampled block of rows of a file (at least one row)
+const int SAMPLE_UNIT_BYTES = 1 << 18;
+
+/// Number of the sampled units of a stratum (about)
+const int UNITS_PER_STRATUM = 8;
+
+
+
+/**
+ * Draw a stratified random sample of n of the units 0, ..., n_units-1: the
+ * units are split into n / UNITS_PER_STRATUM strata of consecutive units (one
+ * at least), and about UNITS_PER_STRATUM distinct units are drawn at random
+ * from every stratum, so every part of the range is in the sample, and the
+ * variance of every stratum is estimated by several units. If n >= n_units,
+ * all the units are taken (in one stratum).
+ * The units are given in increasing order with the numbers of their strata,
+ * and the sizes of the strata are given in stratum_sizes.
+ */
+void draw_stratified(long long n_units,
+                     long long n,
+                     unsigned seed,
+                     std::vector<long long> &units,
+                     std::vector<int> &strata,
+                     std::vector<long long> &stratum_sizes);
+
+/**
+ * The 97.5% quantile of Student's t distribution with the degrees of freedom
+ * (1.96 of the normal distribution for the large numbers of them)
+ */
+double student_quantile_975(int degrees_of_freedom);
+
+
+
+//==============================================================================
+//
+// Stratified sample of the units of a population (e.g. the blocks of rows of
+// a table): every sampled unit gives a vector of its totals (sums of the
+// values, of their squares, and so on), and the totals of the population are
+// estimated by the sizes of the strata times the means of their samples. A
+// metric is a function of the totals (e.g. a ratio of two of them), and the
+// approximate 95% confidence interval of its estimate is found by the
+// stratified
+// jackknife: the metric is recomputed without every unit in turn (with the
+// other units of its stratum weighted up), and the variance is found by the
+// spread of these replicates, with the finite population correction. So any
+// smooth metric (a norm, a correlation) gets its interval by the same way.
+// There are few strata in a small sample, so the interval is made by the
+// quantile of Student's t distribution with n - (number of strata) degrees of
+// freedom. The interval is approximate: the metrics are nonlinear, and the
+// totals of the blocks are often skewed, so the interval of a small sample
+// may cover the true value less often than 95% (88 - 96% by 4 - 32 blocks of
+// 62 in the tests).
+//
+//==============================================================================
+class StratifiedSample
+{
+public:
+
+  StratifiedSample(int n_totals, const std::vector<long long> &stratum_sizes);
+
+  int n_totals() const { return _n_totals; }
+
+  /// Add the totals of a unit of the stratum
+  void add(int stratum, const double *totals);
+
+  /// Estimated totals of the population
+  std::vector<double> totals() const;
+
+  /// Estimate the metric (a functor of the vector of the totals), and the
+  /// half width of its approximate 95% confidence interval (0, if all the
+  /// units are in the sample)
+  template <class Metric>
+  void estimate(const Metric &metric, double &value, double &half_width) const
+  {
+    const std::vector<double> all = totals();
+    value = metric(all);
+
+    double variance = 0.;
+    int degrees_of_freedom = 0;
+    std::vector<double> replicate;
+    std::vector<double> thetas;
+    for (size_t h = 0; h < _units.size(); ++h)
+    {
+      const int n_h = _units[h].size() / _n_totals;
+      const double N_h = _stratum_sizes[h];
+      if (n_h < 2 || n_h >= N_h)
+        continue; // no variance, or it can't be estimated by this stratum
+
+      // the replicate without the unit j: the estimate of the stratum is
+      // N_h times the mean of the other units
+      thetas.assign(n_h, 0.);
+      double mean_theta = 0.;
+      for (int j = 0; j < n_h; ++j)
+      {
+        replicate = all;
+        for (int k = 0; k < _n_totals; ++k)
+        {
+          const double unit = _units[h][j * _n_totals + k];
+          const double stratum = N_h * _sums[h][k] / n_h;
+          const double without = N_h * (_sums[h][k] - unit) / (n_h - 1);
+          replicate[k] += without - stratum;
+        }
+        thetas[j] = metric(replicate);
+        mean_theta += thetas[j] / n_h;
+      }
+      double spread = 0.;
+      for (int j = 0; j < n_h; ++j)
+        spread += (thetas[j] - mean_theta) * (thetas[j] - mean_theta);
+      variance += (1. - n_h / N_h) * (n_h - 1.) / n_h * spread;
+      degrees_of_freedom += n_h - 1;
+    }
+    half_width = (degrees_of_freedom > 0 ?
+                  student_quantile_975(degrees_of_freedom) * sqrt(variance) :
+                  0.);
+  }
+
+protected:
+
+  int _n_totals;
+
+  std::vector<long long> _stratum_sizes;
+
+  /// The totals of the sampled units of every stratum (one after another),
+  /// and their sums
+  std::vector<std::vector<double> > _units;
+  std::vector<std::vector<double> > _sums;
+};
+
+
+
+#endif // SAMPLING_HPP
@@ -0,0 +1,147 @@
+#ifndef SPECTRUM_HPP
+#define SPECTRUM_HPP
+
+#include "fft.hpp"
+#include "progress.hpp"
+#include "tiles.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+
+
+/**
+ *
+ * Amplitude spectra and phase differences of each trace of the two datasets,
+ * and the L2 misfits of the spectra in the frequency bands. The traces are
+ * padded with zeros to the length of the plan, and the traces of the two
+ * datasets in the same column are transformed together as the real and the
+ * imaginary parts of one complex sequence, so every pair of traces costs one
+ * transform. The columns are gathered by batches, so the rows are read by
+ * contiguous pieces. The plan is shared by all the threads, and every thread
+ * has its own buffers.
+ *
+ * The spectra of every trace are stored one after another as 3 rows of
+ * n_bins = N/2+1 floats: the amplitude spectrum of the first dataset, the one
+ * of the second dataset, and the phase difference (of the second dataset with
+ * respect to the first one, in radians).
+ *
+ * The sums of the bands are returned for every trace (the bins of the band b
+ * of the trace t are at t*n_bands + b), so the misfits of the traces and of
+ * the whole datasets in each band can be found:
+ *   misfit = sqrt(band_diff / band_0)
+ * The bins except 0 and N/2 stand for the negative frequencies too, so they
+ * are counted twice, and the misfit of all the bins is the relative L2 misfit
+ * of the traces.
+ *
+ * @param data0[in] First dataset
+ * @param data1[in] Second dataset
+ * @param plan[in] FFT plan of the length at least row_end - row_beg
+ * @param row_beg[in] Starting row in the datasets
+ * @param row_end[in] Ending row (not including) in the datasets
+ * @param col_beg[in] Starting trace in the datasets
+ * @param col_end[in] Ending trace (not including) in the datasets
+ * @param bands[in] Ranges [beg, end) of the bins of the frequency bands
+ * @param spectra[out] Spectra of the traces
+ * @param band_diff[out] Sums of the squared differences of the spectra
+ * @param band_0[out] Sums of the squared amplitude spectra of the first dataset
+ * @param progress[in] Progress to count the traces in (if it's given). If the
+ *                     run is cancelled, the rest of the traces is skipped.
+ */
+void spectral_misfits(float **data0,
+                      float **data1,
+                      const FftPlan &plan,
+                      int row_beg,
+                      int row_end,
+                      int col_beg,
+                      int col_end,
+                      const std::vector<std::pair<int, int> > &bands,
+                      std::vector<float> &spectra,
+                      std::vector<double> &band_diff,
+                      std::vector<double> &band_0,
+                      Progress *progress = nullptr)
+{
+  const int n_traces = col_end - col_beg;
+  const int n_bands = bands.size();
+  const int n = row_end - row_beg;
+  const int N = plan.size();
+  const int n_bins = N/2 + 1;
+
+  spectra.resize((size_t)n_traces * 3 * n_bins);
+  band_diff.assign((size_t)n_traces * n_bands, 0.);
+  band_0.assign((size_t)n_traces * n_bands, 0.);
+
+  // the number of columns gathered at once: 16 floats make a cache line
+  const int batch = 16;
+
+#pragma omp parallel
+  {
+    std::vector<float> traces0((size_t)batch * n), traces1((size_t)batch * n);
+    std::vector<Complex> z(N), X0(n_bins), X1(n_bins);
+    std::vector<double> diff2(n_bins), amp2(n_bins);
+
+#pragma omp for schedule(static)
+    for (int c = col_beg; c < col_end; c += batch)
+    {
+      // the rest of the batches is skipped, if the run is cancelled (the
+      // caller throws Cancelled)
+      if (cancelled())
+        continue;
+      const int width = std::min(batch, col_end - c);
+      transpose_traces(data0, row_beg, row_end, c, c + width, &traces0[0]);
+      transpose_traces(data1, row_beg, row_end, c, c + width, &traces1[0]);
+
+      for (int k = 0; k < width; ++k)
+      {
+        const float *x0 = &traces0[(size_t)k * n];
+        const float *x1 = &traces1[(size_t)k * n];
+        for (int t = 0; t < n; ++t)
+          z[t] = Complex(x0[t], x1[t]);
+        std::fill(z.begin() + n, z.end(), Complex(0., 0.));
+        plan.forward(&z[0]);
+        split_spectra(&z[0], N, &X0[0], &X1[0]);
+
+        const int j = c + k - col_beg;
+        float *amp0 = &spectra[(size_t)j * 3 * n_bins];
+        float *amp1 = amp0 + n_bins;
+        float *phase = amp1 + n_bins;
+        for (int f = 0; f < n_bins; ++f)
+        {
+          const double w = (f == 0 || f == N/2 ? 1. : 2.);
+          const double re0 = X0[f].real(), im0 = X0[f].imag();
+          const double re1 = X1[f].real(), im1 = X1[f].imag();
+          amp2[f] = w * (re0 * re0 + im0 * im0);
+          diff2[f] = w * ((re1 - re0) * (re1 - re0) + (im1 - im0) * (im1 - im0));
+          amp0[f] = sqrt(re0 * re0 + im0 * im0);
+          amp1[f] = sqrt(re1 * re1 + im1 * im1);
+          // the argument of X1 * conj(X0)
+          phase[f] = std::atan2(im1 * re0 - re1 * im0, re1 * re0 + im1 * im0);
+        }
+
+        for (int b = 0; b < n_bands; ++b)
+        {
+          double s_diff = 0., s_0 = 0.;
+          for (int f = bands[b].first; f < bands[b].second; ++f)
+          {
+            s_diff += diff2[f];
+            s_0 += amp2[f];
+          }
+          band_diff[(size_t)j * n_bands + b] = s_diff;
+          band_0[(size_t)j * n_bands + b] = s_0;
+        }
+      }
+
+      if (progress)
+      {
+        progress->add(width);
+        progress->poll();
+      }
+    }
+  }
+}
+
+
+
+#endif // SPECTRUM_HPP
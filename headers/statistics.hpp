@@ -0,0 +1,168 @@
+#ifndef STATISTICS_HPP
+#define STATISTICS_HPP
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+class Checkpoint;
+
+
+
+//==============================================================================
+//
+// Histogram of non-negative values by decades: [0], (0, 1e<min>),
+// [1e<min>, 1e<min+1>), ..., [1e<max-1>, 1e<max>), [1e<max>, inf], and the
+// number of NaNs. The histograms of the parts of the data can be merged.
+//
+//==============================================================================
+class DecadeHistogram
+{
+public:
+
+  DecadeHistogram(int min_exp, int max_exp);
+
+  void add(double value)
+  {
+    if (value == 0.)
+      ++_counts[0];
+    else if (value != value)
+      ++_n_nan;
+    else
+      ++_counts[bin(value)];
+  }
+
+  void add_zeros(long long n) { _counts[0] += n; }
+
+  void merge(const DecadeHistogram &other);
+
+  /// Save and load the counts (e.g. of the partial results of a shard)
+  void save(Checkpoint &checkpoint, const std::string &name) const;
+  void load(const Checkpoint &checkpoint, const std::string &name);
+
+  /// Number of the values (including NaNs)
+  long long n_values() const;
+
+  /// Print the non-empty bins
+  void print(std::ostream &out, const std::string &indent) const;
+
+protected:
+
+  int _min_exp, _max_exp;
+
+  std::vector<long long> _counts;
+
+  long long _n_nan;
+
+  /// The bounds of the decades: 1e<min_exp>, ..., 1e<max_exp>
+  std::vector<double> _bounds;
+
+  /// Bin of a positive value
+  int bin(double value) const;
+};
+
+
+
+//==============================================================================
+//
+// Streaming sketch of the distribution of non-negative values for approximate
+// quantiles. The values are counted in the logarithmic buckets made of the
+// bits of their single precision representation: the exponent and the upper
+// mantissa bits, so every octave is split into 2^MANTISSA_BITS buckets, and a
+// quantile is found within the relative error of 2^-MANTISSA_BITS. The
+// sketches of the parts of the data are merged by adding the counts, so the
+// result doesn't depend on how the data are split between the threads.
+//
+//==============================================================================
+class QuantileSketch
+{
+public:
+
+  static const int MANTISSA_BITS = 6;
+
+  QuantileSketch();
+
+  void add(double value)
+  {
+    if (value == 0.)
+      ++_n_zeros;
+    else if (value != value)
+      ++_n_nan;
+    else
+      ++_counts[bucket(value)];
+  }
+
+  void add_zeros(long long n) { _n_zeros += n; }
+
+  void merge(const QuantileSketch &other);
+
+  /// Save and load the counts (e.g. of the partial results of a shard)
+  void save(Checkpoint &checkpoint, const std::string &name) const;
+  void load(const Checkpoint &checkpoint, const std::string &name);
+
+  /// Number of the values except NaNs
+  long long n_values() const;
+
+  /// Approximate q-quantile (0 <= q <= 1) of the values
+  double quantile(double q) const;
+
+  /// Relative error of the quantiles
+  static double relative_error() { return 1.0 / (1 << MANTISSA_BITS); }
+
+protected:
+
+  std::vector<long long> _counts;
+
+  long long _n_zeros, _n_nan;
+
+  static int bucket(double value);
+};
+
+
+
+/// A value at a location in the table
+struct Location
+{
+  double value; ///< the value by which the locations are compared
+  int row, col;
+  double value0, value1; ///< the values of the datasets at the location
+};
+
+//==============================================================================
+//
+// The N locations with the largest values, kept in a bounded min-heap, so a
+// new value costs one comparison unless it's among the largest ones.
+//
+//==============================================================================
+class WorstLocations
+{
+public:
+
+  WorstLocations(int n_max);
+
+  /// The smallest of the kept values, if there are n_max of them
+  double threshold() const { return _threshold; }
+
+  void add(const Location &location);
+
+  void merge(const WorstLocations &other);
+
+  /// Save and load the kept locations
+  void save(Checkpoint &checkpoint, const std::string &name) const;
+  void load(const Checkpoint &checkpoint, const std::string &name);
+
+  /// The kept locations from the worst one
+  std::vector<Location> sorted() const;
+
+protected:
+
+  int _n_max;
+
+  std::vector<Location> _heap;
+
+  double _threshold;
+};
+
+
+
+#endif // STATISTICS_HPP
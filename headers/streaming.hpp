@@ -0,0 +1,1156 @@
+#ifndef STREAMING_HPP
+#define STREAMING_HPP
+
+#include "block_index.hpp"
+#include "block_reader.hpp"
+#include "checkpoint.hpp"
+#include "conversion.hpp"
+#include "mask.hpp"
+#include "progress.hpp"
+#include "row_writer.hpp"
+#include "statistics.hpp"
+#include "utilities.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(_OPENMP)
+  #include <omp.h>
+#endif
+
+
+
+//==============================================================================
+//
+// Computations over two files which are streamed by blocks of rows. The
+// blocks are given to a kernel as they are read, i.e. with the elements of
+// their own types, and the kernel converts the elements when it uses them.
+// Therefore a kernel is a class with a template operator
+//
+//   template <typename T0, typename T1>
+//   void operator()(const T0 *block0, const T1 *block1, int row, int n_rows);
+//
+// where row is the first row of the blocks in the files, and the blocks
+// contain n_rows full rows, and a method
+//
+//   bool finished() const;
+//
+// which tells that the kernel doesn't need the rest of the files, and a method
+//
+//   bool equal_rows(int row, int n_rows, const BlockStats *stats);
+//
+// which is called for the rows which are known to be equal in both files. The
+// stats of the rows are given, if the rows make a whole block. If the kernel
+// needs the values of the rows anyway, it returns false, and then the rows
+// are read from the file 0 only and given to the operator() as both blocks.
+// And a method
+//
+//   bool masked_rows(int row, int n_rows);
+//
+// which is called first for every block: if the kernel compares only the
+// samples of a mask (see Mask), and the rows have none of them, it returns
+// true, and the rows aren't read at all.
+//
+//==============================================================================
+
+template <class Kernel, typename T0>
+void apply_kernel(Kernel &kernel, const T0 *block0,
+                  ElementType type1, const char *block1,
+                  int row, int n_rows)
+{
+  switch (type1)
+  {
+    case FLOAT32:
+      kernel(block0, (const float*)block1, row, n_rows);
+      break;
+    case FLOAT64:
+      kernel(block0, (const double*)block1, row, n_rows);
+      break;
+    case FLOAT16:
+      kernel(block0, (const float16*)block1, row, n_rows);
+      break;
+    case BFLOAT16:
+      kernel(block0, (const bfloat16*)block1, row, n_rows);
+      break;
+  }
+}
+
+
+
+template <class Kernel>
+void apply_kernel(Kernel &kernel,
+                  ElementType type0, const char *block0,
+                  ElementType type1, const char *block1,
+                  int row, int n_rows)
+{
+  switch (type0)
+  {
+    case FLOAT32:
+      apply_kernel(kernel, (const float*)block0, type1, block1, row, n_rows);
+      break;
+    case FLOAT64:
+      apply_kernel(kernel, (const double*)block0, type1, block1, row, n_rows);
+      break;
+    case FLOAT16:
+      apply_kernel(kernel, (const float16*)block0, type1, block1, row, n_rows);
+      break;
+    case BFLOAT16:
+      apply_kernel(kernel, (const bfloat16*)block0, type1, block1, row, n_rows);
+      break;
+  }
+}
+
+
+
+/**
+ * Read the rows [row_beg, row_end) of the two files by blocks (the files are
+ * read at the same time) and apply the kernel to every pair of blocks, until
+ * the kernel is finished. The blocks begin at the multiples of the block size,
+ * so that they correspond to the blocks of the indexes of the files (if they
+ * are given). The blocks which are equal according to the indexes are given to
+ * the kernel's equal_rows() rather than read, and the complete blocks which
+ * are read are added to the indexes. Return the number of the rows which are
+ * equal according to the indexes.
+ */
+template <class Kernel>
+int stream_blocks(BlockReader &in0,
+                  BlockReader &in1,
+                  int row_beg,
+                  int row_end,
+                  Kernel &kernel,
+                  BlockIndex *index0 = nullptr,
+                  BlockIndex *index1 = nullptr)
+{
+  const int n_cols = in0.n_cols();
+  const int block_rows = BlockReader::rows_per_block(n_cols);
+  std::vector<char> block0((size_t)block_rows*n_cols*element_size(in0.type()));
+  std::vector<char> block1((size_t)block_rows*n_cols*element_size(in1.type()));
+  const bool same_type = (in0.type() == in1.type());
+  int n_equal_rows = 0;
+
+  for (int i_beg = row_beg; i_beg < row_end && !kernel.finished(); )
+  {
+    const int b = i_beg / block_rows;
+    const int i_end = std::min((b + 1) * block_rows, row_end);
+    const bool whole = (i_beg == b * block_rows &&
+                        i_end == std::min((b + 1) * block_rows, in0.n_rows()));
+
+    if (kernel.masked_rows(i_beg, i_end - i_beg))
+    {
+      i_beg = i_end;
+      continue;
+    }
+
+    const BlockStats *stats0 = (index0 ? index0->stats(b) : nullptr);
+    const BlockStats *stats1 = (index1 ? index1->stats(b) : nullptr);
+    const bool equal = (same_type && stats0 && stats1 &&
+                        stats0->hash == stats1->hash);
+    if (equal)
+      n_equal_rows += i_end - i_beg;
+
+    // the equal rows are read only if the kernel needs the values
+    if (equal && kernel.equal_rows(i_beg, i_end - i_beg,
+                                   whole ? stats0 : nullptr))
+    {
+      i_beg = i_end;
+      continue;
+    }
+
+    if (in0.is_asynchronous() || in1.is_asynchronous())
+    {
+      // the reads of both files are in flight at once
+      in0.start_block(i_beg, i_end, &block0[0]);
+      if (!equal) in1.start_block(i_beg, i_end, &block1[0]);
+      in0.finish_block();
+      if (!equal) in1.finish_block();
+    }
+    else
+    {
+      // the exceptions can't leave the parallel region, so we catch them
+      // here and rethrow afterwards. The readers which use the threads
+      // themselves are called one after another.
+      std::string error;
+#pragma omp parallel for schedule(static, 1) \
+      if(!in0.is_parallel() && !in1.is_parallel() && !equal)
+      for (int f = 0; f < 2; ++f)
+      {
+        try
+        {
+          if (f == 0) in0.read_block(i_beg, i_end, &block0[0]);
+          else if (!equal) in1.read_block(i_beg, i_end, &block1[0]);
+        }
+        catch (const std::exception &e)
+        {
+#pragma omp critical
+          error = e.what();
+        }
+      }
+      require(error.empty(), error);
+    }
+
+    const long long n_values = (long long)(i_end - i_beg) * n_cols;
+    if (whole && index0 && !stats0)
+      index0->set_stats(b, block_stats(&block0[0], n_values, in0.type()));
+    if (whole && index1 && !stats1 && !equal)
+      index1->set_stats(b, block_stats(&block1[0], n_values, in1.type()));
+
+    apply_kernel(kernel, in0.type(), &block0[0],
+                 in1.type(), equal ? &block0[0] : &block1[0],
+                 i_beg, i_end - i_beg);
+    i_beg = i_end;
+  }
+  return n_equal_rows;
+}
+
+
+
+//==============================================================================
+//
+// Fused kernels: the metrics which are computed in the same pass over the
+// files are the policies of one kernel, FusedKernel<Norms, Rms, Diff>, which
+// goes over the values once and gives every pair of them to every policy. A
+// metric which isn't requested is NoMetric, which does nothing, so every
+// combination of the requested metrics is a separate specialization, and its
+// inner loop contains only their work. A policy is a class with
+//
+//   Policy(int n_cols, int col_beg, int col_end, RowWriter *out);
+//   static const bool BY_TRACES; // whether a thread must own whole traces
+//   struct Local;   // what a thread accumulates during a block
+//   void begin(int n_rows);
+//   void add(Local &local, int i, int t, double d0, double d1);
+//   void merge(const Local &local);
+//   void end(int n_rows);
+//   bool skips(const BlockStats *stats) const;
+//   void skip(int n_rows, const BlockStats *stats);
+//   void masked(int n_rows);
+//   void save(Checkpoint &checkpoint) const;
+//   void load(const Checkpoint &checkpoint);
+//
+// where i is the row in the block, t is the trace in the compared range,
+// skips() tells whether the rows which are equal in both files can be
+// accounted by skip() without their values, masked() accounts the rows which
+// have no compared samples, and save() and load() keep what is accumulated
+// between the blocks, so the pass can be resumed. If the kernel has a mask,
+// add() is called only for the compared samples (with the weighted values).
+//
+//==============================================================================
+class NoMetric
+{
+public:
+
+  static const bool BY_TRACES = false;
+
+  struct Local { };
+
+  NoMetric(int, int, int, RowWriter*) { }
+  void begin(int) { }
+  void add(Local&, int, int, double, double) { }
+  void merge(const Local&) { }
+  void end(int) { }
+  bool skips(const BlockStats*) const { return true; }
+  void skip(int, const BlockStats*) { }
+  void masked(int) { }
+  void save(Checkpoint&) const { }
+  void load(const Checkpoint&) { }
+};
+
+
+
+//==============================================================================
+//
+// L2 and L1 norms of the datasets and their difference (a policy of the fused
+// kernels)
+//
+//==============================================================================
+class NormsMetric
+{
+public:
+
+  static const bool BY_TRACES = false;
+
+  struct Local
+  {
+    Local()
+      : s2_0(0.), s2_1(0.), s2_diff(0.), s1_0(0.), s1_1(0.), s1_diff(0.)
+    { }
+    double s2_0, s2_1, s2_diff;
+    double s1_0, s1_1, s1_diff;
+  };
+
+  NormsMetric(int n_cols, int col_beg, int col_end, RowWriter*)
+    : l2_0(0.), l2_1(0.), l2_diff(0.),
+      l1_0(0.), l1_1(0.), l1_diff(0.),
+      _whole_rows(col_beg == 0 && col_end == n_cols)
+  { }
+
+  /// Sums of the squares (L2) and the absolute values (L1)
+  double l2_0, l2_1, l2_diff;
+  double l1_0, l1_1, l1_diff;
+
+  void begin(int) { }
+
+  void add(Local &local, int, int, double d0, double d1)
+  {
+    const double d01 = d0 - d1;
+    local.s2_0 += d0 * d0;
+    local.s2_1 += d1 * d1;
+    local.s2_diff += d01 * d01;
+    local.s1_0 += fabs(d0);
+    local.s1_1 += fabs(d1);
+    local.s1_diff += fabs(d01);
+  }
+
+  void merge(const Local &local)
+  {
+    l2_0 += local.s2_0; l2_1 += local.s2_1; l2_diff += local.s2_diff;
+    l1_0 += local.s1_0; l1_1 += local.s1_1; l1_diff += local.s1_diff;
+  }
+
+  /// Merge the sums of another part of the table (e.g. of another shard)
+  void merge(const NormsMetric &other)
+  {
+    l2_0 += other.l2_0; l2_1 += other.l2_1; l2_diff += other.l2_diff;
+    l1_0 += other.l1_0; l1_1 += other.l1_1; l1_diff += other.l1_diff;
+  }
+
+  void end(int) { }
+
+  /// The sums of the equal rows can be taken from the index, if the whole
+  /// rows are compared
+  bool skips(const BlockStats *stats) const
+  { return stats != nullptr && _whole_rows; }
+
+  void skip(int, const BlockStats *stats)
+  {
+    l2_0 += stats->sum2; l2_1 += stats->sum2;
+    l1_0 += stats->sum1; l1_1 += stats->sum1;
+  }
+
+  void masked(int) { }
+
+  void save(Checkpoint &checkpoint) const
+  {
+    const double sums[] = { l2_0, l2_1, l2_diff, l1_0, l1_1, l1_diff };
+    checkpoint.set("stream.norms", sums, 6);
+  }
+
+  void load(const Checkpoint &checkpoint)
+  {
+    const std::vector<double> &sums = checkpoint.values("stream.norms");
+    l2_0 = sums[0]; l2_1 = sums[1]; l2_diff = sums[2];
+    l1_0 = sums[3]; l1_1 = sums[4]; l1_diff = sums[5];
+  }
+
+protected:
+
+  bool _whole_rows;
+};
+
+
+
+//==============================================================================
+//
+// RMS of the difference between the datasets for every trace
+//
+//==============================================================================
+class RmsDiffMetric
+{
+public:
+
+  /// The sums of the traces are accumulated in place
+  static const bool BY_TRACES = true;
+
+  struct Local { };
+
+  RmsDiffMetric(int, int col_beg, int col_end, RowWriter*)
+    : sum2(col_end - col_beg, 0.), _col_beg(col_beg)
+  { }
+
+  /// Sums of the squares of the difference for every trace
+  std::vector<double> sum2;
+
+  void begin(int) { }
+
+  void add(Local&, int, int t, double d0, double d1)
+  { sum2[t] += (d0 - d1) * (d0 - d1); }
+
+  void merge(const Local&) { }
+  void end(int) { }
+
+  /// Merge the sums of another part of the table: of other rows of the same
+  /// traces, or of some of the traces
+  void merge(const RmsDiffMetric &other)
+  {
+    const int offset = other._col_beg - _col_beg;
+    for (size_t t = 0; t < other.sum2.size(); ++t)
+      sum2[offset + t] += other.sum2[t];
+  }
+
+  /// The equal rows and the masked ones add nothing
+  bool skips(const BlockStats*) const { return true; }
+  void skip(int, const BlockStats*) { }
+  void masked(int) { }
+
+  void save(Checkpoint &checkpoint) const
+  { checkpoint.set("stream.rms", sum2); }
+
+  void load(const Checkpoint &checkpoint)
+  { sum2 = checkpoint.values("stream.rms"); }
+
+protected:
+
+  int _col_beg;
+};
+
+
+
+//==============================================================================
+//
+// Difference between the datasets written in a file in single precision
+//
+//==============================================================================
+class DiffMetric
+{
+public:
+
+  static const bool BY_TRACES = false;
+
+  struct Local { };
+
+  DiffMetric(int, int col_beg, int col_end, RowWriter *out)
+    : _out(out), _width(col_end - col_beg), _diff()
+  { }
+
+  /// The samples which aren't compared are zeros
+  void begin(int n_rows) { _diff.assign((size_t)n_rows * _width, 0.f); }
+
+  void add(Local&, int i, int t, double d0, double d1)
+  { _diff[(size_t)i * _width + t] = d0 - d1; }
+
+  void merge(const Local&) { }
+
+  void end(int n_rows) { _out->write_rows(&_diff[0], n_rows); }
+
+  bool skips(const BlockStats*) const { return true; }
+
+  /// The equal rows are written as zeros
+  void skip(int n_rows, const BlockStats*)
+  {
+    _diff.assign((size_t)n_rows * _width, 0.f);
+    _out->write_rows(&_diff[0], n_rows);
+  }
+
+  /// The masked rows are written as zeros too
+  void masked(int n_rows) { skip(n_rows, nullptr); }
+
+  /// The rows are in the file when the checkpoint says so, and the writer of
+  /// a resumed pass begins after them
+  void save(Checkpoint&) const { _out->flush(); }
+  void load(const Checkpoint&) { }
+
+protected:
+
+  RowWriter *_out;
+  int _width;
+  std::vector<float> _diff;
+
+  DiffMetric(const DiffMetric&);
+  DiffMetric& operator =(const DiffMetric&);
+};
+
+
+
+template <class Norms, class Rms, class Diff>
+class FusedKernel
+{
+public:
+
+  FusedKernel(int n_cols, int col_beg, int col_end, RowWriter *out = nullptr,
+              const Mask *mask = nullptr)
+    : norms(n_cols, col_beg, col_end, out),
+      rms(n_cols, col_beg, col_end, out),
+      diff(n_cols, col_beg, col_end, out),
+      _n_cols(n_cols), _col_beg(col_beg), _col_end(col_end), _mask(mask)
+  { }
+
+  Norms norms;
+  Rms rms;
+  Diff diff;
+
+  template <typename T0, typename T1>
+  void operator()(const T0 *block0, const T1 *block1, int row, int n_rows)
+  {
+    norms.begin(n_rows);
+    rms.begin(n_rows);
+    diff.begin(n_rows);
+
+    // if a metric needs whole traces, the traces are split between the
+    // threads by chunks, and every thread goes along the rows over its own
+    // chunks. Otherwise the rows are split, and they are read contiguously.
+    const bool by_traces = (Norms::BY_TRACES || Rms::BY_TRACES ||
+                            Diff::BY_TRACES);
+    const int chunk = 256;
+#pragma omp parallel
+    {
+      typename Norms::Local norms_local;
+      typename Rms::Local rms_local;
+      typename Diff::Local diff_local;
+
+      if (by_traces)
+      {
+#pragma omp for schedule(static)
+        for (int c = _col_beg; c < _col_end; c += chunk)
+          add(block0, block1, row, 0, n_rows, c, std::min(c + chunk, _col_end),
+              norms_local, rms_local, diff_local);
+      }
+      else
+      {
+#pragma omp for schedule(static)
+        for (int i = 0; i < n_rows; ++i)
+          add(block0, block1, row, i, i + 1, _col_beg, _col_end,
+              norms_local, rms_local, diff_local);
+      }
+
+#pragma omp critical
+      {
+        norms.merge(norms_local);
+        rms.merge(rms_local);
+        diff.merge(diff_local);
+      }
+    }
+
+    norms.end(n_rows);
+    rms.end(n_rows);
+    diff.end(n_rows);
+  }
+
+  bool finished() const { return false; }
+
+  /// The equal rows are skipped only if all the metrics can skip them. The
+  /// stats of the index are of the whole rows, so they aren't used with a
+  /// mask.
+  bool equal_rows(int, int n_rows, const BlockStats *stats)
+  {
+    if (_mask)
+      stats = nullptr;
+    if (!norms.skips(stats) || !rms.skips(stats) || !diff.skips(stats))
+      return false;
+    norms.skip(n_rows, stats);
+    rms.skip(n_rows, stats);
+    diff.skip(n_rows, stats);
+    return true;
+  }
+
+  bool masked_rows(int row, int n_rows)
+  {
+    if (!_mask || !_mask->masked(row, n_rows))
+      return false;
+    norms.masked(n_rows);
+    rms.masked(n_rows);
+    diff.masked(n_rows);
+    return true;
+  }
+
+  void save(Checkpoint &checkpoint) const
+  {
+    norms.save(checkpoint);
+    rms.save(checkpoint);
+    diff.save(checkpoint);
+  }
+
+  void load(const Checkpoint &checkpoint)
+  {
+    norms.load(checkpoint);
+    rms.load(checkpoint);
+    diff.load(checkpoint);
+  }
+
+protected:
+
+  int _n_cols, _col_beg, _col_end;
+
+  const Mask *_mask;
+
+  /// Give the values of the rows [i_beg, i_end) and the columns
+  /// [c_beg, c_end) of the blocks (of the first row row) to the metrics
+  template <typename T0, typename T1>
+  void add(const T0 *block0, const T1 *block1, int row,
+           int i_beg, int i_end, int c_beg, int c_end,
+           typename Norms::Local &norms_local,
+           typename Rms::Local &rms_local,
+           typename Diff::Local &diff_local)
+  {
+    for (int i = i_beg; i < i_end; ++i)
+    {
+      const T0 *row0 = block0 + (size_t)i * _n_cols;
+      const T1 *row1 = block1 + (size_t)i * _n_cols;
+      if (!_mask)
+      {
+        add(row0, row1, i, c_beg, c_end, nullptr,
+            norms_local, rms_local, diff_local);
+        continue;
+      }
+      const Span *span_end = _mask->spans_end(row + i);
+      for (const Span *span = _mask->spans_begin(row + i); span != span_end;
+           ++span)
+        add(row0, row1, i, std::max(span->beg, c_beg),
+            std::min(span->end, c_end), _mask->weights(),
+            norms_local, rms_local, diff_local);
+    }
+  }
+
+  /// Give the values of the columns [j_beg, j_end) of the rows (multiplied
+  /// by the weights of the columns, if they are given) to the metrics
+  template <typename T0, typename T1>
+  void add(const T0 *row0, const T1 *row1, int i, int j_beg, int j_end,
+           const double *weights,
+           typename Norms::Local &norms_local,
+           typename Rms::Local &rms_local,
+           typename Diff::Local &diff_local)
+  {
+    for (int j = j_beg; j < j_end; ++j)
+    {
+      double d0 = to_double(row0[j]);
+      double d1 = to_double(row1[j]);
+      if (weights)
+      {
+        d0 *= weights[j];
+        d1 *= weights[j];
+      }
+      const int t = j - _col_beg;
+      norms.add(norms_local, i, t, d0, d1);
+      rms.add(rms_local, i, t, d0, d1);
+      diff.add(diff_local, i, t, d0, d1);
+    }
+  }
+
+  FusedKernel(const FusedKernel&);
+  FusedKernel& operator =(const FusedKernel&);
+};
+
+
+
+//==============================================================================
+//
+// Kernel of a streaming pass which can be resumed: it gives the blocks to the
+// kernel, and after them it puts the state of the kernel (its save()), the
+// next row and the number of the equal rows in the checkpoint, which is
+// written when it's due. A resumed pass is started from next_row() with the
+// state restored by resume().
+//
+//==============================================================================
+template <class Kernel>
+class CheckpointedKernel
+{
+public:
+
+  CheckpointedKernel(Kernel &kernel, Checkpoint &checkpoint, int row_beg)
+    : _kernel(kernel), _checkpoint(checkpoint), _next_row(row_beg),
+      _n_equal_rows(0)
+  { }
+
+  /// Restore the state of the kernel, if the checkpoint has it
+  void resume()
+  {
+    if (!_checkpoint.has("stream.row"))
+      return;
+    _kernel.load(_checkpoint);
+    _next_row = _checkpoint.value("stream.row");
+    _n_equal_rows = _checkpoint.value("stream.equal_rows");
+  }
+
+  /// The row where the pass continues, and the equal rows of the whole pass
+  int next_row() const { return _next_row; }
+  int n_equal_rows() const { return _n_equal_rows; }
+
+  template <typename T0, typename T1>
+  void operator()(const T0 *block0, const T1 *block1, int row, int n_rows)
+  {
+    _kernel(block0, block1, row, n_rows);
+    passed(row + n_rows, false);
+  }
+
+  bool finished() const { return _kernel.finished(); }
+
+  /// The equal rows are counted, even if the kernel reads them
+  bool equal_rows(int row, int n_rows, const BlockStats *stats)
+  {
+    _n_equal_rows += n_rows;
+    const bool skipped = _kernel.equal_rows(row, n_rows, stats);
+    if (skipped)
+      passed(row + n_rows, false);
+    return skipped;
+  }
+
+  bool masked_rows(int row, int n_rows)
+  {
+    const bool skipped = _kernel.masked_rows(row, n_rows);
+    if (skipped)
+      passed(row + n_rows, false);
+    return skipped;
+  }
+
+  /// Write the state when the pass is over
+  void finish() { passed(_next_row, true); }
+
+protected:
+
+  Kernel &_kernel;
+  Checkpoint &_checkpoint;
+  int _next_row, _n_equal_rows;
+
+  void passed(int next_row, bool force)
+  {
+    _next_row = next_row;
+    if (!force && !_checkpoint.due())
+      return;
+    _kernel.save(_checkpoint);
+    _checkpoint.set("stream.row", _next_row);
+    _checkpoint.set("stream.equal_rows", _n_equal_rows);
+    _checkpoint.save();
+  }
+
+  CheckpointedKernel(const CheckpointedKernel&);
+  CheckpointedKernel& operator =(const CheckpointedKernel&);
+};
+
+
+
+//==============================================================================
+//
+// Kernel of a streaming pass which reports the progress of the rows, and
+// which is finished (after the current block), when the run is cancelled.
+// next_row() is the row where the pass has stopped.
+//
+//==============================================================================
+template <class Kernel>
+class ProgressKernel
+{
+public:
+
+  ProgressKernel(Kernel &kernel, Progress &progress, int row_beg)
+    : _kernel(kernel), _progress(progress), _next_row(row_beg)
+  { }
+
+  int next_row() const { return _next_row; }
+
+  template <typename T0, typename T1>
+  void operator()(const T0 *block0, const T1 *block1, int row, int n_rows)
+  {
+    _kernel(block0, block1, row, n_rows);
+    passed(row, n_rows);
+  }
+
+  bool finished() const { return _kernel.finished() || cancelled(); }
+
+  bool equal_rows(int row, int n_rows, const BlockStats *stats)
+  {
+    const bool skipped = _kernel.equal_rows(row, n_rows, stats);
+    if (skipped)
+      passed(row, n_rows);
+    return skipped;
+  }
+
+  bool masked_rows(int row, int n_rows)
+  {
+    const bool skipped = _kernel.masked_rows(row, n_rows);
+    if (skipped)
+      passed(row, n_rows);
+    return skipped;
+  }
+
+protected:
+
+  Kernel &_kernel;
+  Progress &_progress;
+  int _next_row;
+
+  void passed(int row, int n_rows)
+  {
+    _next_row = row + n_rows;
+    _progress.add(n_rows);
+    _progress.poll();
+  }
+
+  ProgressKernel(const ProgressKernel&);
+  ProgressKernel& operator =(const ProgressKernel&);
+};
+
+
+
+//==============================================================================
+//
+// Statistics of the difference: the L2 and L1 norms, the histograms and the
+// quantile sketches of the absolute and relative differences, the misfits of
+// every trace, and the worst locations. The histograms, the sketches and the
+// worst locations are accumulated by every thread separately, and merged by
+// merge() in the end. The traces are split between the threads by chunks, so
+// the misfits of the traces are accumulated in place.
+//
+//==============================================================================
+class StatsKernel
+{
+public:
+
+  /// Ranges of the decades of the histograms
+  static const int ABS_MIN_EXP = -12, ABS_MAX_EXP = 6;
+  static const int REL_MIN_EXP = -9,  REL_MAX_EXP = 3;
+
+  /// The statistics accumulated by a thread
+  struct Part
+  {
+    Part(int n_worst)
+      : abs_hist(ABS_MIN_EXP, ABS_MAX_EXP), rel_hist(REL_MIN_EXP, REL_MAX_EXP),
+        abs_sketch(), rel_sketch(), worst(n_worst), n_undefined(0)
+    { }
+
+    DecadeHistogram abs_hist, rel_hist;
+    QuantileSketch abs_sketch, rel_sketch;
+    WorstLocations worst;
+    long long n_undefined; ///< number of relative differences with zero ref
+
+    void merge(const Part &other)
+    {
+      abs_hist.merge(other.abs_hist);
+      rel_hist.merge(other.rel_hist);
+      abs_sketch.merge(other.abs_sketch);
+      rel_sketch.merge(other.rel_sketch);
+      worst.merge(other.worst);
+      n_undefined += other.n_undefined;
+    }
+  };
+
+  StatsKernel(int n_cols, int col_beg, int col_end, int n_worst,
+              const Mask *mask = nullptr)
+    : norms(n_cols, col_beg, col_end, nullptr, mask),
+      l2(col_end - col_beg, 0.), l1(col_end - col_beg, 0.),
+      linf(col_end - col_beg, 0.), l2_0(col_end - col_beg, 0.),
+      parts(),
+      _n_cols(n_cols), _col_beg(col_beg), _col_end(col_end), _mask(mask)
+  {
+    int n_threads = 1;
+#if defined(_OPENMP)
+    n_threads = omp_get_max_threads();
+#endif
+    parts.assign(n_threads, Part(n_worst));
+  }
+
+  /// The L2 and L1 norms of the datasets and the difference
+  FusedKernel<NormsMetric, NoMetric, NoMetric> norms;
+
+  /// Misfits of every trace: sums of the squares and the absolute values of
+  /// the difference, its max absolute value, and the sum of the squares of
+  /// the dataset 0
+  std::vector<double> l2, l1, linf, l2_0;
+
+  /// Statistics of the threads (after merge() all of them are in the first)
+  std::vector<Part> parts;
+
+  template <typename T0, typename T1>
+  void operator()(const T0 *block0, const T1 *block1, int row, int n_rows)
+  {
+    norms(block0, block1, row, n_rows);
+
+    const int chunk = 256;
+#pragma omp parallel
+    {
+      int thread = 0;
+#if defined(_OPENMP)
+      thread = omp_get_thread_num();
+#endif
+      Part &part = parts[thread];
+
+#pragma omp for schedule(static)
+      for (int c = _col_beg; c < _col_end; c += chunk)
+      {
+        const int c_end = std::min(c + chunk, _col_end);
+        for (int i = 0; i < n_rows; ++i)
+        {
+          const T0 *row0 = block0 + (size_t)i * _n_cols;
+          const T1 *row1 = block1 + (size_t)i * _n_cols;
+          if (!_mask)
+          {
+            add(part, row0, row1, row + i, c, c_end, nullptr);
+            continue;
+          }
+          const Span *span_end = _mask->spans_end(row + i);
+          for (const Span *span = _mask->spans_begin(row + i); span != span_end;
+               ++span)
+            add(part, row0, row1, row + i, std::max(span->beg, c),
+                std::min(span->end, c_end), _mask->weights());
+        }
+      }
+    }
+  }
+
+  bool finished() const { return false; }
+
+  /// The misfits of the traces need the values of the dataset 0
+  bool equal_rows(int, int, const BlockStats*) { return false; }
+
+  /// The masked rows add nothing
+  bool masked_rows(int row, int n_rows)
+  { return _mask && _mask->masked(row, n_rows); }
+
+  /// Merge the statistics of the threads into the first part
+  void merge()
+  {
+    for (size_t k = 1; k < parts.size(); ++k)
+      parts[0].merge(parts[k]);
+    parts.resize(1, parts[0]);
+  }
+
+  /// Merge the (merged) statistics of another part of the table: of other
+  /// rows of the same traces, or of some of the traces
+  void merge(const StatsKernel &other)
+  {
+    norms.norms.merge(other.norms.norms);
+    const int offset = other._col_beg - _col_beg;
+    for (size_t t = 0; t < other.l2.size(); ++t)
+    {
+      l2[offset + t] += other.l2[t];
+      l1[offset + t] += other.l1[t];
+      linf[offset + t] = std::max(linf[offset + t], other.linf[t]);
+      l2_0[offset + t] += other.l2_0[t];
+    }
+    parts[0].merge(other.parts[0]);
+  }
+
+  /// Save the (merged) statistics, and load them into the first part
+  void save(Checkpoint &checkpoint) const
+  {
+    norms.save(checkpoint);
+    checkpoint.set("stats.l2", l2);
+    checkpoint.set("stats.l1", l1);
+    checkpoint.set("stats.linf", linf);
+    checkpoint.set("stats.l2_0", l2_0);
+    const Part &part = parts[0];
+    part.abs_hist.save(checkpoint, "stats.abs_hist");
+    part.rel_hist.save(checkpoint, "stats.rel_hist");
+    part.abs_sketch.save(checkpoint, "stats.abs_sketch");
+    part.rel_sketch.save(checkpoint, "stats.rel_sketch");
+    part.worst.save(checkpoint, "stats.worst");
+    checkpoint.set("stats.undefined", part.n_undefined);
+  }
+
+  void load(const Checkpoint &checkpoint)
+  {
+    norms.load(checkpoint);
+    l2 = checkpoint.values("stats.l2");
+    l1 = checkpoint.values("stats.l1");
+    linf = checkpoint.values("stats.linf");
+    l2_0 = checkpoint.values("stats.l2_0");
+    Part &part = parts[0];
+    part.abs_hist.load(checkpoint, "stats.abs_hist");
+    part.rel_hist.load(checkpoint, "stats.rel_hist");
+    part.abs_sketch.load(checkpoint, "stats.abs_sketch");
+    part.rel_sketch.load(checkpoint, "stats.rel_sketch");
+    part.worst.load(checkpoint, "stats.worst");
+    part.n_undefined = checkpoint.value("stats.undefined");
+  }
+
+protected:
+
+  int _n_cols, _col_beg, _col_end;
+
+  const Mask *_mask;
+
+  /// Add the columns [j_beg, j_end) of the row (multiplied by the weights of
+  /// the columns, if they are given) to the statistics of a thread
+  template <typename T0, typename T1>
+  void add(Part &part, const T0 *row0, const T1 *row1, int row,
+           int j_beg, int j_end, const double *weights)
+  {
+    for (int j = j_beg; j < j_end; ++j)
+    {
+      double d0 = to_double(row0[j]);
+      double d1 = to_double(row1[j]);
+      if (weights)
+      {
+        d0 *= weights[j];
+        d1 *= weights[j];
+      }
+      const double diff = fabs(d0 - d1);
+      const int t = j - _col_beg;
+
+      l2[t] += diff * diff;
+      l1[t] += diff;
+      if (diff > linf[t]) linf[t] = diff;
+      l2_0[t] += d0 * d0;
+
+      part.abs_hist.add(diff);
+      part.abs_sketch.add(diff);
+      if (d0 != 0.)
+      {
+        part.rel_hist.add(diff / fabs(d0));
+        part.rel_sketch.add(diff / fabs(d0));
+      }
+      else if (diff != 0.)
+        ++part.n_undefined;
+      else
+      {
+        part.rel_hist.add_zeros(1);
+        part.rel_sketch.add_zeros(1);
+      }
+
+      if (diff > part.worst.threshold())
+      {
+        const Location location = { diff, row, j, d0, d1 };
+        part.worst.add(location);
+      }
+    }
+  }
+
+  StatsKernel(const StatsKernel&);
+  StatsKernel& operator =(const StatsKernel&);
+};
+
+
+
+//==============================================================================
+//
+// Check that the relative L2 norm of the difference and the max absolute
+// difference are within the tolerances (negative tolerances aren't checked).
+// The rows which are equal byte by byte (if the files have the same type) are
+// skipped without any arithmetic. The kernel is finished as soon as the
+// accumulated difference proves that a tolerance is exceeded. For the L2 norm
+// it needs the L2 norm of the whole dataset 0, which is computed only if the
+// files differ: when the kernel meets the first difference, it's finished
+// with need_energy() true, and it continues (from next_row()) after the norm
+// is given by set_energy().
+//
+//==============================================================================
+class ToleranceKernel
+{
+public:
+
+  ToleranceKernel(int n_cols, int col_beg, int col_end,
+                  double tol_l2, double tol_max, const Mask *mask = nullptr)
+    : l2_diff(0.), max_diff(0.), n_nan(0), n_equal_rows(0),
+      _n_cols(n_cols), _col_beg(col_beg), _col_end(col_end),
+      _tol_l2(tol_l2), _tol_max(tol_max), _mask(mask), _energy(-1.),
+      _next_row(-1), _exceeded(false)
+  { }
+
+  /// Sum of the squares and the max of the absolute values of the difference,
+  /// and the number of NaN differences
+  double l2_diff, max_diff;
+  long long n_nan;
+
+  /// Number of rows which are equal byte by byte
+  long long n_equal_rows;
+
+  template <typename T0, typename T1>
+  void operator()(const T0 *block0, const T1 *block1, int row, int n_rows)
+  {
+    const bool same_type = std::is_same<T0, T1>::value;
+    const size_t row_bytes = (size_t)(_col_end - _col_beg) * sizeof(T0);
+    double s2 = 0., max_abs = max_diff;
+    long long nan = 0, equal = 0;
+
+#pragma omp parallel for reduction(+:s2,nan,equal) reduction(max:max_abs)
+    for (int i = 0; i < n_rows; ++i)
+    {
+      const T0 *row0 = block0 + (size_t)i * _n_cols;
+      const T1 *row1 = block1 + (size_t)i * _n_cols;
+      if (same_type &&
+          memcmp(row0 + _col_beg, row1 + _col_beg, row_bytes) == 0)
+      {
+        ++equal;
+        continue;
+      }
+      if (!_mask)
+      {
+        add(row0, row1, _col_beg, _col_end, nullptr, s2, max_abs, nan);
+        continue;
+      }
+      const Span *span_end = _mask->spans_end(row + i);
+      for (const Span *span = _mask->spans_begin(row + i); span != span_end;
+           ++span)
+        add(row0, row1, span->beg, span->end, _mask->weights(),
+            s2, max_abs, nan);
+    }
+
+    l2_diff += s2;
+    max_diff = max_abs;
+    n_nan += nan;
+    n_equal_rows += equal;
+    _next_row = row + n_rows;
+
+    update();
+  }
+
+  bool finished() const { return _exceeded || need_energy(); }
+
+  bool equal_rows(int row, int n_rows, const BlockStats*)
+  {
+    n_equal_rows += n_rows;
+    _next_row = row + n_rows;
+    return true;
+  }
+
+  bool masked_rows(int row, int n_rows)
+  {
+    if (!_mask || !_mask->masked(row, n_rows))
+      return false;
+    _next_row = row + n_rows;
+    return true;
+  }
+
+  /// Whether a tolerance is proven to be exceeded
+  bool exceeded() const { return _exceeded; }
+
+  /// Whether the L2 norm of the dataset 0 is needed to continue
+  bool need_energy() const
+  { return _tol_l2 >= 0. && _energy < 0. && l2_diff > 0.; }
+
+  /// Set the sum of the squares of the dataset 0
+  void set_energy(double energy) { _energy = energy; update(); }
+
+  /// The row after the last checked one
+  int next_row() const { return _next_row; }
+
+protected:
+
+  int _n_cols, _col_beg, _col_end;
+  double _tol_l2, _tol_max;
+  const Mask *_mask;
+  double _energy;
+  int _next_row;
+  bool _exceeded;
+
+  /// Add the difference of the columns [j_beg, j_end) of the rows
+  /// (multiplied by the weights of the columns, if they are given)
+  template <typename T0, typename T1>
+  static void add(const T0 *row0, const T1 *row1, int j_beg, int j_end,
+                  const double *weights, double &s2, double &max_abs,
+                  long long &nan)
+  {
+    for (int j = j_beg; j < j_end; ++j)
+    {
+      double d01 = to_double(row0[j]) - to_double(row1[j]);
+      if (weights)
+        d01 *= weights[j];
+      const double a = fabs(d01);
+      s2 += d01 * d01;
+      if (a > max_abs) max_abs = a;
+      if (a != a) ++nan;
+    }
+  }
+
+  void update()
+  {
+    _exceeded = (n_nan > 0 || (_tol_max >= 0. && max_diff > _tol_max) ||
+                 (_tol_l2 >= 0. && _energy >= 0. &&
+                  l2_diff > _tol_l2 * _tol_l2 * _energy));
+  }
+};
+
+
+
+#endif // STREAMING_HPP
@@ -0,0 +1,74 @@
+#ifndef SYMMETRY_HPP
+#define SYMMETRY_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+
+
+/**
+ *
+ * Differences between the mirrored traces of the dataset. A pair number c
+ * consists of the traces (col_beg + c) and (col_end - 1 - c). The difference
+ * between the samples d0 and d1 of the traces is relative, |d0 - d1| / |d0|,
+ * unless |d0| is smaller than the tolerance, and then it's absolute. For every
+ * pair the maximal difference over the rows is found.
+ *
+ * The rows are swept only once, and all the pairs are evaluated for every row
+ * at the same time: the left half of the row is read forward, the right half
+ * is read backward, both contiguously, so the loop is vectorized (with the
+ * reversal of the right segment in registers) instead of going down the
+ * columns. The rows are distributed between the threads, and every thread
+ * keeps its own maximal differences which are merged at the end.
+ *
+ * @param data[in] Dataset
+ * @param row_beg[in] Starting row in the dataset
+ * @param row_end[in] Ending row (not including) in the dataset
+ * @param col_beg[in] Starting trace in the dataset
+ * @param col_end[in] Ending trace (not including) in the dataset
+ * @param max_diff[out] Maximal difference for every pair of traces
+ */
+void symmetry_differences(float **data,
+                          int row_beg,
+                          int row_end,
+                          int col_beg,
+                          int col_end,
+                          std::vector<double> &max_diff)
+{
+  const float tol = 1e-5;
+  const int n_pairs = (col_end - col_beg) / 2;
+
+  max_diff.clear();
+  max_diff.resize(n_pairs, 0.0);
+
+#pragma omp parallel
+  {
+    std::vector<float> thread_max(n_pairs, 0.0f);
+    float *pmax = n_pairs > 0 ? &thread_max[0] : nullptr;
+
+#pragma omp for schedule(static)
+    for (int i = row_beg; i < row_end; ++i)
+    {
+      const float *left  = data[i] + col_beg;
+      const float *right = data[i] + col_end - 1;
+      for (int c = 0; c < n_pairs; ++c)
+      {
+        const float d0 = left[c];
+        const float d1 = right[-c];
+        const float abs_d0 = fabsf(d0);
+        const float diff = fabsf(d0 - d1);
+        const float rel = (abs_d0 > tol ? diff / abs_d0 : diff);
+        pmax[c] = (rel > pmax[c] ? rel : pmax[c]);
+      }
+    }
+
+#pragma omp critical
+    for (int c = 0; c < n_pairs; ++c)
+      max_diff[c] = std::max(max_diff[c], (double)thread_max[c]);
+  }
+}
+
+
+
+#endif // SYMMETRY_HPP
@@ -0,0 +1,146 @@
+#ifndef TILES_HPP
+#define TILES_HPP
+
+#include "arena.hpp"
+
+#include <algorithm>
+#include <vector>
+
+#if defined(_OPENMP)
+  #include <omp.h>
+#endif
+
+
+
+//==============================================================================
+//
+// Tiled traversal of the row-major datasets for the computations by traces.
+// Going down a column of a row-major matrix touches a new cache line (and
+// often a new page) with every sample, and going along the whole rows with an
+// accumulator per trace sweeps all the accumulators through the cache with
+// every row, and they don't fit it for wide gathers. Therefore the range is
+// split into stripes of traces, and every stripe is traversed by tiles of
+// TILE_ROWS rows: the rows of a tile are read by contiguous pieces (of several
+// pages), and the partial sums of the stripe (STRIPE_SUM_BYTES) stay in L2
+// cache. The stripes are distributed between the threads statically, so
+// every trace is accumulated by one thread, the results don't depend on the
+// number of threads, and every thread reads the same contiguous part of every
+// row (the pages of which it has placed, see LargeBuffer).
+//
+// A kernel of the traversal is a class with
+//
+//   static const int N_SUMS; // number of the sums of every trace
+//   void tile(int i_beg, int i_end, int j_beg, int j_end, double *sums,
+//             int stride);
+//   void stripe(int j_beg, int j_end, const double *sums, int stride);
+//
+// where the sum s of the trace j is sums[s * stride + j - j_beg]. The sums
+// are zeroed for every stripe, tile() adds the rows [i_beg, i_end) of the
+// traces [j_beg, j_end) to them, and stripe() takes the results of the
+// stripe. The kernel is called by several threads for the different stripes.
+// The sums of the threads are taken from the scratch arena, if it's given, so
+// the repeated traversals don't allocate them.
+//
+//==============================================================================
+
+/// Size of the partial sums of a stripe of traces
+const int STRIPE_SUM_BYTES = 1 << 16;
+
+/// The least number of the traces of a stripe
+const int MIN_STRIPE_TRACES = 256;
+
+/// Number of the rows of a tile
+const int TILE_ROWS = 64;
+
+
+
+template <class Kernel>
+void traverse_tiles(int row_beg,
+                    int row_end,
+                    int col_beg,
+                    int col_end,
+                    Kernel &kernel,
+                    Arena *scratch = nullptr)
+{
+  // the stripes are as wide as the sums allow, but there are enough of them
+  // for all the threads
+  int n_threads = 1;
+#if defined(_OPENMP)
+  n_threads = omp_get_max_threads();
+#endif
+  const int per_thread = (col_end - col_beg + 4*n_threads - 1) / (4*n_threads);
+  const int stride = std::min((int)(STRIPE_SUM_BYTES /
+                                    (Kernel::N_SUMS * sizeof(double))),
+                              std::max(MIN_STRIPE_TRACES, per_thread));
+
+  const size_t n_sums = (size_t)Kernel::N_SUMS * stride;
+  Arena::Mark mark = Arena::Mark();
+  double *all_sums = nullptr;
+  if (scratch != nullptr)
+  {
+    mark = scratch->mark();
+    all_sums = scratch->allocate<double>(n_threads * n_sums);
+  }
+
+#pragma omp parallel
+  {
+    std::vector<double> own_sums;
+    double *sums = all_sums;
+    if (sums == nullptr)
+    {
+      own_sums.resize(n_sums);
+      sums = &own_sums[0];
+    }
+#if defined(_OPENMP)
+    else
+      sums += omp_get_thread_num() * n_sums;
+#endif
+
+#pragma omp for schedule(static)
+    for (int j_beg = col_beg; j_beg < col_end; j_beg += stride)
+    {
+      const int j_end = std::min(j_beg + stride, col_end);
+      std::fill(sums, sums + n_sums, 0.);
+      for (int i_beg = row_beg; i_beg < row_end; i_beg += TILE_ROWS)
+        kernel.tile(i_beg, std::min(i_beg + TILE_ROWS, row_end), j_beg, j_end,
+                    sums, stride);
+      kernel.stripe(j_beg, j_end, sums, stride);
+    }
+  }
+
+  if (scratch != nullptr)
+    scratch->release(mark);
+}
+
+
+
+/**
+ * Transpose the rows [i_beg, i_end) of the traces [j_beg, j_end) of the
+ * dataset into the trace-major buffer: the sample i of the trace j is at
+ * traces[(j - j_beg) * (i_end - i_beg) + i - i_beg]. The rows are read by
+ * tiles of TILE_ROWS rows, so the lines of the buffer which are written stay
+ * in cache.
+ */
+inline void transpose_traces(float **data,
+                             int i_beg,
+                             int i_end,
+                             int j_beg,
+                             int j_end,
+                             float *traces)
+{
+  const size_t n = i_end - i_beg;
+  for (int ib = i_beg; ib < i_end; ib += TILE_ROWS)
+  {
+    const int ie = std::min(ib + TILE_ROWS, i_end);
+    for (int j = j_beg; j < j_end; ++j)
+    {
+      float *trace = traces + (j - j_beg) * n - i_beg;
+      for (int i = ib; i < ie; ++i)
+        trace[i] = data[i][j];
+    }
+  }
+}
+
+
+
+#endif // TILES_HPP
@@ -4,6 +4,8 @@
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
 //------------------------------------------------------------------------------
 //
@@ -98,6 +100,11 @@ std::string file_extension(const std::string &path);
 
 bool file_exists(const std::string &path);
 
+bool same_file(const std::string &path0, const std::string &path1);
+
+bool file_version(const std::string &path, long long &size,
+                  long long &time_ns);
+
 std::string absolute_path(const std::string &rel_path);
 
 bool is_big_endian();
@@ -124,6 +131,12 @@ int argcheck(int argc, char **argv, const char *arg);
  */
 std::string add_space(const std::string &str, int length);
 
+/**
+ * @brief Split the string into the parts separated by the delimiter. Empty
+ * parts are skipped.
+ */
+std::vector<std::string> split(const std::string &str, char delimiter);
+
 /**
  * @brief Get memory consumption
  *
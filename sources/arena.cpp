@@ -0,0 +1,78 @@
+#include "arena.hpp"
+
+#include <algorithm>
+
+
+
+/// Alignment of the arrays (a cache line)
+static const size_t ARENA_ALIGNMENT = 64;
+
+
+
+Arena::Arena(size_t block_bytes)
+  : _blocks(),
+    _current(0),
+    _used(0),
+    _before(0),
+    _block_bytes(block_bytes),
+    _peak(0)
+{ }
+
+
+
+Arena::~Arena()
+{
+  for (size_t b = 0; b < _blocks.size(); ++b)
+    delete[] _blocks[b].data;
+}
+
+
+
+Arena::Mark Arena::mark() const
+{
+  Mark m;
+  m.block = _current;
+  m.used = _used;
+  m.before = _before;
+  return m;
+}
+
+
+
+void Arena::release(const Mark &m)
+{
+  _current = m.block;
+  _used = m.used;
+  _before = m.before;
+}
+
+
+
+void* Arena::allocate_bytes(size_t bytes)
+{
+  bytes = (bytes + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+
+  // the following blocks are tried, and a new one is taken from the heap if
+  // none of them is large enough
+  while (_current < _blocks.size() && _used + bytes > _blocks[_current].size)
+  {
+    _before += _used;
+    ++_current;
+    _used = 0;
+  }
+  if (_current == _blocks.size())
+  {
+    Block block;
+    block.size = std::max(_block_bytes, bytes);
+    // one more line to align the beginning of the block
+    block.data = new char[block.size + ARENA_ALIGNMENT];
+    _blocks.push_back(block);
+  }
+
+  char *base = _blocks[_current].data;
+  base += (ARENA_ALIGNMENT - (size_t)base % ARENA_ALIGNMENT) % ARENA_ALIGNMENT;
+  void *ptr = base + _used;
+  _used += bytes;
+  _peak = std::max(_peak, _before + _used);
+  return ptr;
+}
@@ -0,0 +1,201 @@
+#include "block_index.hpp"
+#include "block_reader.hpp"
+#include "utilities.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+
+
+static const uint64_t PRIME_1 = 11400714785074694791ULL;
+static const uint64_t PRIME_2 = 14029467366897019727ULL;
+static const uint64_t PRIME_3 =  1609587929392839161ULL;
+static const uint64_t PRIME_4 =  9650029242287828579ULL;
+static const uint64_t PRIME_5 =  2870177450012600261ULL;
+
+
+
+static inline uint64_t rotate_left(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t word)
+{
+  return rotate_left(acc + word * PRIME_2, 31) * PRIME_1;
+}
+
+static inline uint64_t load_word(const char *bytes)
+{
+  uint64_t word;
+  memcpy(&word, bytes, sizeof(word));
+  return word;
+}
+
+
+
+uint64_t hash_bytes(const char *bytes, size_t n_bytes)
+{
+  uint64_t acc[4] = { PRIME_1 + PRIME_2, PRIME_2, 0, 0 - PRIME_1 };
+
+  // the bulk of the bytes goes by the 32-byte stripes, one word per lane
+  size_t pos = 0;
+  for (; pos + 32 <= n_bytes; pos += 32)
+    for (int k = 0; k < 4; ++k)
+      acc[k] = hash_round(acc[k], load_word(bytes + pos + 8*k));
+
+  uint64_t h = rotate_left(acc[0], 1) + rotate_left(acc[1], 7) +
+               rotate_left(acc[2], 12) + rotate_left(acc[3], 18);
+  for (int k = 0; k < 4; ++k)
+    h = (h ^ hash_round(0, acc[k])) * PRIME_1 + PRIME_4;
+  h += n_bytes;
+
+  // the tail
+  for (; pos + 8 <= n_bytes; pos += 8)
+    h = rotate_left(h ^ hash_round(0, load_word(bytes + pos)), 27) * PRIME_1 +
+        PRIME_4;
+  for (; pos < n_bytes; ++pos)
+    h = rotate_left(h ^ ((unsigned char)bytes[pos] * PRIME_5), 11) * PRIME_1;
+
+  // the final mixing
+  h ^= h >> 33;
+  h *= PRIME_2;
+  h ^= h >> 29;
+  h *= PRIME_3;
+  h ^= h >> 32;
+  return h;
+}
+
+
+
+template <typename T>
+static void sum_values(const T *values, long long n_values,
+                       double &sum2, double &sum1)
+{
+  double s2 = 0., s1 = 0.;
+#pragma omp parallel for reduction(+:s2,s1)
+  for (long long i = 0; i < n_values; ++i)
+  {
+    const double v = to_double(values[i]);
+    s2 += v * v;
+    s1 += fabs(v);
+  }
+  sum2 = s2;
+  sum1 = s1;
+}
+
+
+
+BlockStats block_stats(const char *values, long long n_values,
+                       ElementType type)
+{
+  BlockStats stats;
+  stats.hash = hash_bytes(values, n_values * element_size(type));
+  stats.known = 1;
+  switch (type)
+  {
+    case FLOAT32:
+      sum_values((const float*)values, n_values, stats.sum2, stats.sum1);
+      break;
+    case FLOAT64:
+      sum_values((const double*)values, n_values, stats.sum2, stats.sum1);
+      break;
+    case FLOAT16:
+      sum_values((const float16*)values, n_values, stats.sum2, stats.sum1);
+      break;
+    case BFLOAT16:
+      sum_values((const bfloat16*)values, n_values, stats.sum2, stats.sum1);
+      break;
+  }
+  return stats;
+}
+
+
+
+//==============================================================================
+//
+// BlockIndex
+//
+//==============================================================================
+BlockIndex::BlockIndex(const BlockReader &in)
+  : _filename(index_name(in.name())),
+    _header(),
+    _blocks(),
+    _modified(false)
+{
+  long long size, time_ns;
+  require(file_version(in.name(), size, time_ns), "File '" + in.name() +
+          "' can't be found");
+
+  memcpy(_header.magic, "L2I1", 4);
+  _header.version = INDEX_VERSION;
+  _header.byte_order = INDEX_BYTE_ORDER;
+  _header.type = in.type();
+  _header.format = in.format();
+  _header.swapped = in.swapped();
+  _header.n_rows = in.n_rows();
+  _header.n_cols = in.n_cols();
+  _header.block_rows = BlockReader::rows_per_block(in.n_cols());
+  _header.file_size = size;
+  _header.file_time = time_ns;
+
+  const int n_blocks = (in.n_rows() + block_rows() - 1) / block_rows();
+  BlockStats unknown;
+  memset(&unknown, 0, sizeof(unknown));
+  _blocks.assign(n_blocks, unknown);
+
+  // the stored index is taken only if it describes the file as it is now
+  std::ifstream index(_filename.c_str(), std::ios::binary);
+  IndexHeader stored;
+  if (!index || !index.read((char*)&stored, sizeof(stored)) ||
+      memcmp(&stored, &_header, sizeof(stored)) != 0)
+    return;
+
+  std::vector<BlockStats> blocks(n_blocks);
+  if (index.read((char*)&blocks[0], n_blocks * sizeof(BlockStats)))
+    _blocks.swap(blocks);
+}
+
+
+
+std::string BlockIndex::index_name(const std::string &filename)
+{
+  return filename + ".l2i";
+}
+
+
+
+void BlockIndex::set_stats(int block, const BlockStats &stats)
+{
+  _blocks[block] = stats;
+  _modified = true;
+}
+
+
+
+int BlockIndex::n_known() const
+{
+  int n = 0;
+  for (size_t b = 0; b < _blocks.size(); ++b)
+    n += _blocks[b].known;
+  return n;
+}
+
+
+
+void BlockIndex::save()
+{
+  if (!_modified)
+    return;
+
+  // the comparison doesn't fail, if the index can't be written
+  std::ofstream out(_filename.c_str(), std::ios::binary);
+  out.write((const char*)&_header, sizeof(_header));
+  out.write((const char*)&_blocks[0], _blocks.size() * sizeof(BlockStats));
+  if (!out)
+    std::cerr << "Warning: the index can't be written in '" << _filename
+              << "'\n";
+  _modified = false;
+}
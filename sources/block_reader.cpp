@@ -0,0 +1,721 @@
+#include "block_reader.hpp"
+#include "conversion.hpp"
+#include "utilities.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <iostream>
+
+#if defined(__linux__) || defined(__APPLE__)
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+#if defined(HAVE_ZLIB)
+  #include <zlib.h>
+#endif
+
+
+
+/// Size of the textual and binary headers in the beginning of a SEG-Y file
+const int SEGY_FILE_HEADER_BYTES = 3600;
+
+/// Size of an extended textual header of a SEG-Y file
+const int SEGY_EXT_HEADER_BYTES = 3200;
+
+/// Size of a trace header in SU and SEG-Y files
+const int TRACE_HEADER_BYTES = 240;
+
+/// Number of traces which are converted together before being transposed into
+/// rows of the table. The samples of one row of these traces fill a cache line.
+const int TRACE_GROUP = 16;
+
+
+
+FileFormat file_format(const std::string &filename, const std::string &format)
+{
+  if (format == "raw")  return FORMAT_RAW;
+  if (format == "su")   return FORMAT_SU;
+  if (format == "segy") return FORMAT_SEGY;
+  if (format == "l2z")  return FORMAT_L2Z;
+  if (format == "gz")   return FORMAT_GZIP;
+  require(format == "auto", "Unknown format of the file: '" + format + "'. The "
+          "known formats are: auto, raw, su, segy, l2z, gz");
+
+  if (is_framed_file(filename)) return FORMAT_L2Z;
+  if (is_gzip_file(filename))   return FORMAT_GZIP;
+
+  std::string ext = file_extension(filename);
+  std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+  if (ext == ".su") return FORMAT_SU;
+  if (ext == ".sgy" || ext == ".segy") return FORMAT_SEGY;
+  return FORMAT_RAW;
+}
+
+
+
+/**
+ * Get a 2-byte unsigned integer from the buffer.
+ */
+static int get_uint16(const char *buffer, bool swap)
+{
+  uint16_t value;
+  memcpy(&value, buffer, sizeof(value));
+  if (swap)
+    value = (uint16_t)((value >> 8) | (value << 8));
+  return value;
+}
+
+
+
+/**
+ * Get a 2-byte integer from the buffer.
+ */
+static int get_int16(const char *buffer, bool swap)
+{
+  return (int16_t)get_uint16(buffer, swap);
+}
+
+
+
+/**
+ * Guess the order of bytes of a raw file by a sample of its values (only if
+ * it's requested, since the guess may be wrong for the values of unusual
+ * magnitudes, e.g. the tiny ones or mostly zeros), and warn if the values are
+ * going to be swapped.
+ */
+static bool guess_swap(const std::string &filename, const char *values,
+                       long long n_values, ElementType type)
+{
+  const bool swap = looks_swapped(values, n_values, type);
+  if (swap)
+    std::cerr << "Warning: the values of the file '" << filename << "' look "
+                 "byte-swapped, so they are swapped (give -endian explicitly "
+                 "if it's wrong)" << std::endl;
+  return swap;
+}
+
+
+
+BlockReader::BlockReader(const std::string &filename,
+                         int n_cols,
+                         const std::string &format,
+                         ElementType type,
+                         ByteOrder order,
+                         IoBackend io,
+                         int queue_depth)
+  : _filename(filename),
+    _format(file_format(filename, format)),
+    _type(_format == FORMAT_SU || _format == FORMAT_SEGY ? FLOAT32 : type),
+    _order(order),
+    _in(),
+    _io(io),
+    _queue_depth(queue_depth),
+    _direct(),
+    _pending(nullptr),
+    _pending_values(0),
+    _n_cols(n_cols),
+    _n_rows(0),
+    _map(nullptr),
+    _map_size(0),
+    _first_trace(0),
+    _trace_bytes(0),
+    _ibm(false),
+    _swap(false),
+    _samples(),
+    _traces(),
+    _raw(),
+    _fd(-1),
+    _header(),
+    _frame_offsets(),
+    _gz(nullptr),
+    _gz_position(0)
+{
+  if (_format == FORMAT_RAW)
+    open_raw();
+  else if (_format == FORMAT_L2Z)
+    open_framed();
+  else if (_format == FORMAT_GZIP)
+    open_gzip();
+  else
+    open_traces();
+
+  require(_n_rows > 0, "The number of rows in the file '" + _filename +
+          "' should be positive: " + d2s(_n_rows));
+}
+
+
+
+BlockReader::~BlockReader()
+{
+#if defined(__linux__) || defined(__APPLE__)
+  if (_map != nullptr)
+    munmap((void*)_map, _map_size);
+  if (_fd >= 0)
+    close(_fd);
+#endif
+#if defined(HAVE_ZLIB)
+  if (_gz != nullptr)
+    gzclose((gzFile)_gz);
+#endif
+  _in.close();
+}
+
+
+
+void BlockReader::open_raw()
+{
+  _in.open(_filename.c_str(), std::ios::binary);
+  require(_in, "File '" + _filename + "' can't be opened. Check that it "
+          "exists.");
+  require(_n_cols > 0, "The number of columns should be positive: " +
+          d2s(_n_cols) + ". It must be given for a raw binary file");
+
+  _in.seekg(0, _in.end);
+  const long long length = _in.tellg(); // total length of the file in bytes
+  _in.seekg(0, _in.beg);
+
+  // since we know the type of the numbers, we get the total number of rows in
+  // the file
+  const int size = element_size(_type);
+  _n_rows = length / size / _n_cols;
+
+  // the stream stays for the guess of the order of bytes, and in case the
+  // file can't be read directly
+  if (_io != IO_STREAM)
+  {
+    _direct.reset(new DirectReader(_filename, _io, _queue_depth));
+    if (!_direct->ok())
+      _direct.reset();
+  }
+
+  if (_order != ORDER_GUESS)
+  {
+    _swap = (_order != ORDER_AUTO && need_swap(_order));
+    return;
+  }
+
+  // the order of bytes is guessed by the values in the middle of the file,
+  // since the seismograms often begin with zeros
+  const long long n_values = std::min(length / size / 2, 1LL << 14);
+  std::vector<char> sample(n_values * size);
+  _in.seekg(length / size / 2 * size, _in.beg);
+  _in.read(&sample[0], sample.size());
+  _swap = guess_swap(_filename, &sample[0], _in.gcount() / size, _type);
+  _in.clear();
+  _in.seekg(0, _in.beg);
+}
+
+
+
+void BlockReader::open_traces()
+{
+#if defined(__linux__) || defined(__APPLE__)
+  const int fd = open(_filename.c_str(), O_RDONLY);
+  require(fd >= 0, "File '" + _filename + "' can't be opened. Check that it "
+          "exists.");
+  struct stat st;
+  require(fstat(fd, &st) == 0, "Can't get the size of the file '" +
+          _filename + "'");
+  _map_size = st.st_size;
+  require(_map_size > TRACE_HEADER_BYTES, "File '" + _filename + "' is too "
+          "short to contain a trace");
+
+  void *map = mmap(nullptr, _map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  require(map != MAP_FAILED, "File '" + _filename + "' can't be mapped in "
+          "memory");
+  _map = (const char*)map;
+#else
+  require(false, "Reading SU and SEG-Y files is not implemented for this OS");
+#endif
+
+  int n_samples = 0;
+  if (_format == FORMAT_SEGY)
+  {
+    require(_map_size > SEGY_FILE_HEADER_BYTES, "File '" + _filename + "' is "
+            "too short for a SEG-Y file");
+
+    // the numbers in SEG-Y are big-endian by the standard, but the files
+    // written as little-endian are recognized by the format of the samples
+    const char *binary_header = _map + 3200;
+    if (_order == ORDER_AUTO || _order == ORDER_GUESS)
+    {
+      const int code = get_int16(binary_header + 24, !is_big_endian());
+      _swap = (code >= 1 && code <= 16 ? !is_big_endian() : is_big_endian());
+    }
+    else
+      _swap = need_swap(_order);
+
+    n_samples = get_uint16(binary_header + 20, _swap);
+    const int sample_format = get_int16(binary_header + 24, _swap);
+    const int n_ext_headers = get_int16(binary_header + 304, _swap);
+
+    require(sample_format == 1 || sample_format == 5, "The format of the "
+            "samples (" + d2s(sample_format) + ") in the SEG-Y file '" +
+            _filename + "' is not supported. Supported ones are: 1 (IBM "
+            "float), 5 (IEEE float)");
+    _ibm = (sample_format == 1);
+    _first_trace = SEGY_FILE_HEADER_BYTES +
+                   (long long)std::max(n_ext_headers, 0) * SEGY_EXT_HEADER_BYTES;
+  }
+  else // SU: the headers of the SEG-Y traces usually in native byte order
+  {
+    if (_order == ORDER_AUTO || _order == ORDER_GUESS)
+    {
+      // the number of samples is right, if the traces fill the file
+      const int n = get_uint16(_map + 114, false);
+      const long long trace_bytes = TRACE_HEADER_BYTES + (long long)n * 4;
+      _swap = !(n > 0 && _map_size % trace_bytes == 0);
+    }
+    else
+      _swap = need_swap(_order);
+
+    n_samples = get_uint16(_map + 114, _swap);
+    _first_trace = 0;
+  }
+
+  require(n_samples > 0, "The number of samples per trace (" + d2s(n_samples) +
+          ") in the file '" + _filename + "' should be positive");
+
+  _trace_bytes = TRACE_HEADER_BYTES + (long long)n_samples * sizeof(float);
+  const long long n_traces = (_map_size - _first_trace) / _trace_bytes;
+  require((_map_size - _first_trace) % _trace_bytes == 0, "The size of the "
+          "file '" + _filename + "' doesn't correspond to " + d2s(n_samples) +
+          " samples per trace");
+  require(_n_cols <= 0 || _n_cols == n_traces, "The number of columns (" +
+          d2s(_n_cols) + ") doesn't coincide with the number of traces (" +
+          d2s(n_traces) + ") in the file '" + _filename + "'");
+
+  _n_cols = n_traces;
+  _n_rows = n_samples;
+}
+
+
+
+void BlockReader::open_framed()
+{
+#if defined(__linux__) || defined(__APPLE__)
+  _fd = open(_filename.c_str(), O_RDONLY);
+  require(_fd >= 0, "File '" + _filename + "' can't be opened. Check that it "
+          "exists.");
+  require(pread(_fd, &_header, sizeof(_header), 0) == sizeof(_header) &&
+          memcmp(_header.magic, "L2Z1", 4) == 0, "File '" + _filename +
+          "' is not a framed compressed file");
+
+  // the file is written in the order of bytes of the machine which wrote it,
+  // and it's recognized by the version number
+  _swap = (_header.version != 1);
+  if (_swap)
+  {
+    byte_swap_32(&_header.version, 3);
+    byte_swap_64(&_header.n_rows, 5);
+    byte_swap_64((uint64_t*)&_header.tolerance, 1);
+  }
+  require(_header.version == 1, "Unknown version of the framed compressed "
+          "file '" + _filename + "'");
+  require(!_swap || _header.codec == CODEC_DEFLATE, "The lossy compressed file "
+          "'" + _filename + "' was written with another order of bytes");
+
+  // the fields which drive the reading are checked, so a damaged header can't
+  // make an unknown type or an index of arbitrary size
+  struct stat st;
+  require(fstat(_fd, &st) == 0, "Can't get the size of the file '" +
+          _filename + "'");
+  const uint64_t file_size = st.st_size;
+  require(_header.type <= BFLOAT16 && _header.codec <= CODEC_QUANTIZED &&
+          (_header.codec == CODEC_DEFLATE || _header.type == FLOAT32),
+          "Unknown type of the values or codec in the framed compressed "
+          "file '" + _filename + "'");
+  require(_header.n_cols > 0 && _header.n_cols <= INT_MAX &&
+          _header.n_rows <= INT_MAX && _header.rows_per_frame > 0,
+          "Wrong size of the table in the framed compressed file '" +
+          _filename + "'");
+  require(_header.n_frames == (_header.n_rows + _header.rows_per_frame - 1) /
+                              _header.rows_per_frame &&
+          _header.index_offset <= file_size &&
+          _header.n_frames < (file_size - _header.index_offset) /
+                             sizeof(uint64_t),
+          "Wrong number of the frames in the framed compressed file '" +
+          _filename + "'");
+
+  _frame_offsets.resize(_header.n_frames + 1);
+  const long long index_bytes = _frame_offsets.size() * sizeof(uint64_t);
+  require(pread(_fd, &_frame_offsets[0], index_bytes, _header.index_offset) ==
+          index_bytes, "The index of the frames can't be read from the file '" +
+          _filename + "'");
+  if (_swap)
+    byte_swap_64(&_frame_offsets[0], _frame_offsets.size());
+  for (size_t f = 0; f + 1 < _frame_offsets.size(); ++f)
+    require(_frame_offsets[f] <= _frame_offsets[f + 1] &&
+            _frame_offsets[f + 1] <= _header.index_offset, "Wrong index of "
+            "the frames in the file '" + _filename + "'");
+#else
+  require(false, "Reading framed compressed files is not implemented for this "
+          "OS");
+#endif
+
+  _type = (ElementType)_header.type;
+  require(_n_cols <= 0 || _n_cols == (int)_header.n_cols, "The number of "
+          "columns (" + d2s(_n_cols) + ") doesn't coincide with the one (" +
+          d2s(_header.n_cols) + ") in the file '" + _filename + "'");
+  _n_cols = _header.n_cols;
+  _n_rows = _header.n_rows;
+}
+
+
+
+#if defined(HAVE_ZLIB)
+/**
+ * The length of the uncompressed data of a gzip file taken from its trailer
+ * (ISIZE), without the decompression. The trailer keeps the length modulo 4 GiB
+ * of the last member only, so it's trusted for a file compressed into less than
+ * 4 GiB, and if it's not shorter than the compressed data (deflate expands them
+ * by 5 bytes per stored block of 64 KiB at most). Otherwise -1 is returned. The
+ * data of several members, or of more than 4 GiB compressed very well, are
+ * still longer than the trailer says, that's checked when the last row is read.
+ */
+static long long gzip_trailer_length(const std::string &filename)
+{
+  std::ifstream in(filename.c_str(), std::ios::binary);
+  in.seekg(0, in.end);
+  const long long compressed = in.tellg();
+  if (!in || compressed < 18 || compressed >= (1LL << 32))
+    return -1;
+
+  unsigned char trailer[4];
+  in.seekg(compressed - 4, in.beg);
+  in.read((char*)trailer, 4);
+  if (!in)
+    return -1;
+  const long long length = (long long)trailer[0] | trailer[1] << 8 |
+                           trailer[2] << 16 | (long long)trailer[3] << 24;
+
+  // 10 bytes of the header and 8 bytes of the trailer
+  if (compressed > length + (length / 65535 + 1) * 5 + 18)
+    return -1;
+  return length;
+}
+#endif
+
+
+
+void BlockReader::open_gzip()
+{
+  require(_n_cols > 0, "The number of columns should be positive: " +
+          d2s(_n_cols) + ". It must be given for a gzip file");
+#if defined(HAVE_ZLIB)
+  gzFile gz = gzopen(_filename.c_str(), "rb");
+  require(gz != nullptr, "File '" + _filename + "' can't be opened. Check "
+          "that it exists.");
+  _gz = gz;
+  gzbuffer(gz, 1 << 20);
+
+  // the length of the data is taken from the trailer of the file, if it can
+  // be trusted, otherwise it's known after the decompression only
+  long long length = gzip_trailer_length(_filename);
+  if (length < 0)
+  {
+    std::vector<char> chunk(1 << 20);
+    int n_read = 0;
+    length = 0;
+    while ((n_read = gzread(gz, &chunk[0], chunk.size())) > 0)
+      length += n_read;
+    require(n_read == 0, "File '" + _filename + "' can't be decompressed");
+    gzrewind(gz);
+  }
+
+  const int size = element_size(_type);
+  _n_rows = length / size / _n_cols;
+
+  if (_order != ORDER_GUESS)
+  {
+    _swap = (_order != ORDER_AUTO && need_swap(_order));
+    return;
+  }
+
+  // the order of bytes is guessed by the values in the middle of the file,
+  // since the seismograms often begin with zeros
+  const long long n_values = std::min(length / size / 2, 1LL << 14);
+  std::vector<char> sample(n_values * size);
+  const long long middle = length / size / 2 * size;
+  require(gzseek(gz, middle, SEEK_SET) == middle, "Can't seek in the file '" +
+          _filename + "'");
+  const int n_read = gzread(gz, &sample[0], sample.size());
+  require(n_read >= 0, "File '" + _filename + "' can't be decompressed");
+  _swap = guess_swap(_filename, &sample[0], n_read / size, _type);
+  gzrewind(gz);
+#else
+  require(false, "The program was built without zlib, gzip files can't be "
+          "read");
+#endif
+}
+
+
+
+void BlockReader::read_frames(int row_beg, int row_end, char *buffer)
+{
+  const long long row_bytes = (long long)_n_cols * element_size(_type);
+  const long long rpf = _header.rows_per_frame;
+  const int frame_beg = row_beg / rpf;
+  const int frame_end = (row_end + rpf - 1) / rpf;
+
+  // only the frames containing the requested rows are decompressed
+  std::string error;
+#pragma omp parallel
+  {
+    std::vector<char> compressed, frame;
+
+#pragma omp for schedule(dynamic)
+    for (int f = frame_beg; f < frame_end; ++f)
+    {
+      try
+      {
+        const long long first = f * rpf; // first row of the frame
+        const long long rows = std::min(rpf, (long long)_n_rows - first);
+        const long long beg = std::max((long long)row_beg, first);
+        const long long end = std::min((long long)row_end, first + rows);
+
+        const long long n_bytes = _frame_offsets[f+1] - _frame_offsets[f];
+        compressed.resize(n_bytes);
+        require(pread(_fd, &compressed[0], n_bytes, _frame_offsets[f]) ==
+                n_bytes, "Frame " + d2s(f) + " can't be read from the file '" +
+                _filename + "'");
+
+        // if the whole frame is needed, it's decompressed right in place
+        char *out = buffer + (first - row_beg) * row_bytes;
+        if (beg != first || end != first + rows)
+        {
+          frame.resize(rows * row_bytes);
+          out = &frame[0];
+        }
+        decompress_frame((FrameCodec)_header.codec, _header.tolerance,
+                         &compressed[0], n_bytes, out, rows * row_bytes);
+        if (_swap)
+          byte_swap(out, rows * _n_cols, element_size(_type));
+        if (out != buffer + (first - row_beg) * row_bytes)
+          memcpy(buffer + (beg - row_beg) * row_bytes,
+                 out + (beg - first) * row_bytes, (end - beg) * row_bytes);
+      }
+      catch (const std::exception &e)
+      {
+#pragma omp critical
+        error = e.what();
+      }
+    }
+  }
+  require(error.empty(), error);
+}
+
+
+
+void BlockReader::read_gzip(int row_beg, int row_end, char *buffer)
+{
+#if defined(HAVE_ZLIB)
+  gzFile gz = (gzFile)_gz;
+  const long long row_bytes = (long long)_n_cols * element_size(_type);
+  const long long offset = row_beg * row_bytes;
+
+  // the stream can be read only forward, reading backward starts it over
+  if (offset < _gz_position)
+  {
+    gzrewind(gz);
+    _gz_position = 0;
+  }
+  if (offset > _gz_position)
+    require(gzseek(gz, offset, SEEK_SET) == offset, "Can't seek in the file '"
+            + _filename + "'");
+
+  const long long n_bytes = (row_end - row_beg) * row_bytes;
+  require(gzread(gz, buffer, n_bytes) == n_bytes, "Rows [" + d2s(row_beg) +
+          ", " + d2s(row_end) + ") can't be read from the file '" + _filename +
+          "'");
+  _gz_position = offset + n_bytes;
+
+  // if the data go on after the last row, the length taken from the trailer
+  // was wrong (several members, or more than 4 GiB of data)
+  if (row_end == _n_rows)
+  {
+    std::vector<char> rest(row_bytes);
+    const int n_rest = gzread(gz, &rest[0], row_bytes);
+    require(n_rest < row_bytes, "The length of the data of the file '" +
+            _filename + "' in its gzip trailer is wrong (it's concatenated or "
+            "longer than 4 GiB), recompress it as one member");
+    _gz_position += std::max(n_rest, 0);
+  }
+#else
+  (void)row_beg;
+  (void)row_end;
+  (void)buffer;
+#endif
+}
+
+
+
+void BlockReader::read_block(int row_beg, int row_end, char *buffer)
+{
+  expect(row_beg >= 0 && row_beg <= row_end && row_end <= _n_rows,
+         "Rows [" + d2s(row_beg) + ", " + d2s(row_end) + ") are out of range");
+
+  if (_format == FORMAT_L2Z)
+  {
+    read_frames(row_beg, row_end, buffer);
+    return;
+  }
+  if (_format == FORMAT_GZIP)
+  {
+    read_gzip(row_beg, row_end, buffer);
+    if (_swap)
+      byte_swap(buffer, (long long)(row_end - row_beg) * _n_cols,
+                element_size(_type));
+    return;
+  }
+  if (_format != FORMAT_RAW)
+  {
+    read_traces(row_beg, row_end, (float*)buffer);
+    return;
+  }
+
+  if (_direct)
+  {
+    start_block(row_beg, row_end, buffer);
+    finish_block();
+    return;
+  }
+
+  const long long row_bytes = (long long)_n_cols * element_size(_type);
+  _in.seekg(row_beg * row_bytes, _in.beg);
+  _in.read(buffer, (row_end - row_beg) * row_bytes);
+  require(_in.gcount() == (row_end - row_beg) * row_bytes, "Rows [" +
+          d2s(row_beg) + ", " + d2s(row_end) + ") can't be read from the file '"
+          + _filename + "'");
+
+  // the bytes are swapped while the block is in the cache
+  if (_swap)
+    byte_swap(buffer, (long long)(row_end - row_beg) * _n_cols,
+              element_size(_type));
+}
+
+
+
+void BlockReader::start_block(int row_beg, int row_end, char *buffer)
+{
+  if (!_direct)
+  {
+    read_block(row_beg, row_end, buffer);
+    return;
+  }
+
+  expect(row_beg >= 0 && row_beg <= row_end && row_end <= _n_rows,
+         "Rows [" + d2s(row_beg) + ", " + d2s(row_end) + ") are out of range");
+  const long long row_bytes = (long long)_n_cols * element_size(_type);
+  _direct->start(row_beg * row_bytes, (row_end - row_beg) * row_bytes, buffer);
+  _pending = buffer;
+  _pending_values = (long long)(row_end - row_beg) * _n_cols;
+}
+
+
+
+void BlockReader::finish_block()
+{
+  if (_pending == nullptr)
+    return;
+
+  _direct->finish();
+  if (_swap)
+    byte_swap(_pending, _pending_values, element_size(_type));
+  _pending = nullptr;
+}
+
+
+
+template <typename T>
+void BlockReader::read_converted(int row_beg, int row_end, T *buffer)
+{
+  const long long n_values = (long long)(row_end - row_beg) * _n_cols;
+  _raw.resize(n_values * element_size(_type));
+  read_block(row_beg, row_end, &_raw[0]);
+
+  switch (_type)
+  {
+    case FLOAT32:
+      convert((const float*)&_raw[0], buffer, n_values);
+      break;
+    case FLOAT64:
+      convert((const double*)&_raw[0], buffer, n_values);
+      break;
+    case FLOAT16:
+      convert((const float16*)&_raw[0], buffer, n_values);
+      break;
+    case BFLOAT16:
+      convert((const bfloat16*)&_raw[0], buffer, n_values);
+      break;
+  }
+}
+
+
+
+void BlockReader::read_rows(int row_beg, int row_end, float *buffer)
+{
+  if (_type == FLOAT32)
+    read_block(row_beg, row_end, (char*)buffer);
+  else
+    read_converted(row_beg, row_end, buffer);
+}
+
+
+
+void BlockReader::read_rows(int row_beg, int row_end, double *buffer)
+{
+  if (_type == FLOAT64)
+    read_block(row_beg, row_end, (char*)buffer);
+  else
+    read_converted(row_beg, row_end, buffer);
+}
+
+
+
+void BlockReader::read_traces(int row_beg, int row_end, float *buffer)
+{
+  const int n = row_end - row_beg;
+  _traces.resize((size_t)TRACE_GROUP * n);
+  _samples.resize(n);
+
+  for (int j_beg = 0; j_beg < _n_cols; j_beg += TRACE_GROUP)
+  {
+    const int j_end = std::min(j_beg + TRACE_GROUP, _n_cols);
+
+    // the requested samples of every trace of the group are converted into a
+    // contiguous piece of the buffer
+    for (int j = j_beg; j < j_end; ++j)
+    {
+      const char *samples = _map + _first_trace + j * _trace_bytes +
+                            TRACE_HEADER_BYTES + row_beg * sizeof(float);
+      float *trace = &_traces[(size_t)(j - j_beg) * n];
+      memcpy(&_samples[0], samples, n * sizeof(float));
+      if (_swap)
+        byte_swap_32(&_samples[0], n);
+      if (_ibm)
+        ibm_to_ieee(&_samples[0], trace, n);
+      else
+        memcpy(trace, &_samples[0], n * sizeof(float));
+    }
+
+    // and transposed into the rows of the table
+    for (int i = 0; i < n; ++i)
+    {
+      float *row = buffer + (size_t)i * _n_cols;
+      for (int j = j_beg; j < j_end; ++j)
+        row[j] = _traces[(size_t)(j - j_beg) * n + i];
+    }
+  }
+}
+
+
+
+int BlockReader::rows_per_block(int n_cols)
+{
+  return std::max(1, DEFAULT_BLOCK_BYTES / (int)(n_cols * sizeof(float)));
+}
@@ -0,0 +1,155 @@
+#include "block_index.hpp"
+#include "checkpoint.hpp"
+#include "utilities.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+
+
+Checkpoint::Checkpoint(const std::string &filename, const std::string &run,
+                       double interval)
+  : _filename(filename),
+    _run(hash_bytes(run.c_str(), run.size())),
+    _interval(interval),
+    _last_save(get_wall_time()),
+    _items()
+{ }
+
+
+
+bool Checkpoint::load()
+{
+  std::ifstream in(_filename.c_str(), std::ios::binary);
+  CheckpointHeader header;
+  if (!in || !in.read((char*)&header, sizeof(header)))
+    return false;
+  in.seekg(0, in.end);
+  const uint64_t file_size = in.tellg();
+  in.seekg(sizeof(header), in.beg);
+  if (memcmp(header.magic, "L2C1", 4) != 0 || header.run != _run)
+  {
+    std::cerr << "Warning: the checkpoint '" << _filename << "' is of another "
+                 "run, it's ignored\n";
+    return false;
+  }
+
+  std::map<std::string, std::vector<double> > items;
+  for (uint32_t k = 0; k < header.n_items; ++k)
+  {
+    // the sizes are checked by the rest of the file before the memory is
+    // taken for them, since a damaged file may have any sizes
+    uint32_t name_size = 0;
+    uint64_t n_values = 0;
+    bool ok = (bool)in.read((char*)&name_size, sizeof(name_size)) &&
+              name_size <= file_size - in.tellg();
+    std::string name(ok ? name_size : 0, ' ');
+    if (ok && name_size > 0)
+      ok = (bool)in.read(&name[0], name_size);
+    ok = ok && in.read((char*)&n_values, sizeof(n_values)) &&
+         n_values <= (file_size - in.tellg()) / sizeof(double);
+    std::vector<double> values(ok ? n_values : 0);
+    if (ok && n_values > 0)
+      ok = (bool)in.read((char*)&values[0], n_values * sizeof(double));
+    if (!ok)
+    {
+      std::cerr << "Warning: the checkpoint '" << _filename << "' is "
+                   "damaged, it's ignored\n";
+      return false;
+    }
+    items[name].swap(values);
+  }
+  _items.swap(items);
+  return true;
+}
+
+
+
+bool Checkpoint::has(const std::string &name) const
+{
+  return _items.find(name) != _items.end();
+}
+
+
+
+const std::vector<double>& Checkpoint::values(const std::string &name) const
+{
+  std::map<std::string, std::vector<double> >::const_iterator it =
+    _items.find(name);
+  require(it != _items.end() && !it->second.empty(), "There is no '" + name +
+          "' in the checkpoint '" + _filename + "'");
+  return it->second;
+}
+
+
+
+void Checkpoint::set(const std::string &name, const std::vector<double> &values)
+{
+  _items[name] = values;
+}
+
+
+
+void Checkpoint::set(const std::string &name, const double *values, size_t n)
+{
+  _items[name].assign(values, values + n);
+}
+
+
+
+void Checkpoint::erase(const std::string &prefix)
+{
+  std::map<std::string, std::vector<double> >::iterator it =
+    _items.lower_bound(prefix);
+  while (it != _items.end() && it->first.compare(0, prefix.size(), prefix) == 0)
+    _items.erase(it++);
+}
+
+
+
+bool Checkpoint::due() const
+{
+  return get_wall_time() - _last_save >= _interval;
+}
+
+
+
+void Checkpoint::save()
+{
+  CheckpointHeader header;
+  memcpy(header.magic, "L2C1", 4);
+  header.n_items = _items.size();
+  header.run = _run;
+
+  // the new checkpoint replaces the previous one only when it's complete
+  const std::string temporary = _filename + ".tmp";
+  {
+    std::ofstream out(temporary.c_str(), std::ios::binary);
+    out.write((const char*)&header, sizeof(header));
+    std::map<std::string, std::vector<double> >::const_iterator it;
+    for (it = _items.begin(); it != _items.end(); ++it)
+    {
+      const uint32_t name_size = it->first.size();
+      const uint64_t n_values = it->second.size();
+      out.write((const char*)&name_size, sizeof(name_size));
+      out.write(it->first.c_str(), name_size);
+      out.write((const char*)&n_values, sizeof(n_values));
+      if (n_values > 0)
+        out.write((const char*)&it->second[0], n_values * sizeof(double));
+    }
+    out.close();
+    require(out, "The checkpoint can't be written in '" + temporary + "'");
+  }
+  require(rename(temporary.c_str(), _filename.c_str()) == 0, "The checkpoint "
+          "can't be written in '" + _filename + "'");
+  _last_save = get_wall_time();
+}
+
+
+
+void Checkpoint::remove()
+{
+  ::remove(_filename.c_str());
+}
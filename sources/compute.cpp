@@ -1,15 +1,32 @@
+#include "block_index.hpp"
+#include "block_reader.hpp"
+#include "checkpoint.hpp"
 #include "compute.hpp"
 #include "correlation.hpp"
+#include "dtw.hpp"
+#include "hilbert.hpp"
+#include "mask.hpp"
+#include "memory.hpp"
 #include "parameters.hpp"
+#include "pyramid.hpp"
 #include "rms.hpp"
+#include "row_writer.hpp"
+#include "sampling.hpp"
+#include "spectrum.hpp"
+#include "streaming.hpp"
+#include "symmetry.hpp"
 #include "utilities.hpp"
 
 #include <algorithm>
 #include <cfloat>
 #include <cmath>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -18,9 +35,24 @@
 
 Compute::Compute(Parameters &param)
   : _param(param),
+    _in0(),
+    _in1(),
+    _index0(),
+    _index1(),
     _data0(nullptr),
     _data1(nullptr),
-    _n_rows(0)
+    _input1(nullptr),
+    _mask(),
+    _checkpoint(),
+    _partial(),
+    _rms_diff(),
+    _buffer0(),
+    _buffer1(),
+    _buffer_input1(),
+    _n_rows(0),
+    _arena(),
+    _profile(param._profile),
+    _progress(progress_format(param._progress), param._progress_interval)
 { }
 
 
@@ -28,159 +60,759 @@ Compute::Compute(Parameters &param)
 
 Compute::~Compute()
 {
-  for (int i = 0; i < _n_rows; ++i)
-  {
-    delete[] _data1[i];
-    delete[] _data0[i];
-  }
+  if (_input1 != _data1)
+    delete[] _input1;
   delete[] _data1;
   delete[] _data0;
 }
 
 
 
-void Compute::run()
+int Compute::run()
 {
-  read();
+  if (_param._vec_files_0 != DEFAULT_FILE_NAME)
+    vector_norms();
 
-  if (_param._l2l1)
-    l2l1();
+  if (_param._file_0 == DEFAULT_FILE_NAME)
+    return 0; // only the vector solutions were requested
+
+  if (_param._pack_file != DEFAULT_FILE_NAME)
+  {
+    pack();
+    if (_param._file_1 == DEFAULT_FILE_NAME)
+      return 0; // only the compression was requested
+  }
+
+  open();
+  stage("open");
+
+  if (_param._merge)
+  {
+    merge_partials();
+    stage("merge");
+    return 0;
+  }
+
+  // the threads are bound before the pages of the data are placed by them
+  pin_threads(pin_policy(_param._pin), _param._verbose);
+
+  // the checkpoints are of the shard
+  if (_param._n_shards > 1)
+    take_shard();
+
+  if (_param._checkpoint_file != DEFAULT_FILE_NAME)
+  {
+    _checkpoint.reset(new Checkpoint(_param._checkpoint_file,
+                                     run_description(),
+                                     _param._checkpoint_interval));
+    if (_param._resume && _checkpoint->load() && _param._verbose > 0)
+      std::cout << "Resumed from the checkpoint " << _param._checkpoint_file
+                << std::endl;
+  }
+
+  if (_param._tol_l2 >= 0. || _param._tol_max >= 0.)
+  {
+    const bool pass = check_tolerance();
+    stage("tolerance check");
+    save_indexes();
+    return (pass ? 0 : EXIT_TOLERANCE_FAILED);
+  }
+
+  if (_param._sample_budget > 0.)
+  {
+    sample();
+    stage("sampling");
+    return 0;
+  }
+
+  if (_param._preview > 0)
+  {
+    preview();
+    stage("preview");
+    if (!_param._refine)
+      return 0;
+    if (_param._verbose > 0)
+      std::cout << "\nRefinement at full resolution:" << std::endl;
+  }
 
-  if (!_param._diff_file.empty() && _param._diff_file != DEFAULT_FILE_NAME)
-    diff_file();
+  if (need_data())
+  {
+    read();
+    stage("reading");
+  }
+
+  if (_param._stats)
+  {
+    statistics(); // the norms are computed in the same pass
+    stage("statistics");
+  }
+
+  // the norms, the difference file and the RMS of the difference
+  stream_metrics();
+  stage("streamed metrics");
 
   if (_param._scale_file_1)
+  {
     scale();
+    stage("scaling");
+  }
 
   if (_param._shift_file_1)
+  {
     shift();
+    stage("shift");
+  }
+
+  if (_param._dtw_band > 0)
+  {
+    dtw_align();
+    stage("dtw alignment");
+  }
 
   if (_param._cross_correlation != 0)
-    compute_xcorrelation();
+    compute_xcorrelation(); // the stages are inside
 
-  if (_param._rms != 0)
+  if (_rms_diff)
+    report(*_rms_diff, 0); // it's computed by the streamed pass
+
+  if (_param._rms == 1 || _param._rms == 2)
+  {
     compute_rms();
+    stage("rms");
+  }
+
+  if (_param._win_len > 0)
+  {
+    compute_rms_windows();
+    stage("rms windows");
+  }
+
+  if (_param._hilbert)
+  {
+    compute_hilbert_misfits();
+    stage("hilbert misfits");
+  }
+
+  if (_param._spectrum)
+  {
+    compute_spectral_misfits();
+    stage("spectral misfits");
+  }
 
   if (_param._check_symmetry)
   {
     check_symmetry(_data0, "dataset 0");
     check_symmetry(_data1, "dataset 1");
+    stage("symmetry check");
+  }
+
+  save_indexes();
+  if (_partial)
+  {
+    _partial->save();
+    if (_param._verbose > 0)
+      std::cout << "Partial results of the shard " << _param._shard << " of "
+                << _param._n_shards << ": " << _param._partial_files
+                << std::endl;
   }
+  if (_checkpoint)
+    _checkpoint->remove(); // the run is complete
+  if (_profile.enabled())
+    std::cout << "profile: scratch arena: " << _arena.n_blocks()
+              << " blocks from the heap, peak = " << _arena.peak_bytes()
+              << " bytes" << std::endl;
+  return 0;
 }
 
 
 
 
-void Compute::read()
+void Compute::stage(const char *name) const
 {
-  //----------------------------------------------------------------------------
-  // file0
-  //----------------------------------------------------------------------------
-  std::ifstream in0(_param._file_0.c_str(), std::ios::binary);
-  if (!in0)
+  // the run is cancelled between the stages, if they don't check it
+  // themselves
+  _profile.stage(name);
+  check_cancelled();
+}
+
+
+
+/**
+ * Version of an input file for the description of a run: its size and the
+ * time of its modification, so the rewritten file makes another run.
+ */
+static std::string file_version(const std::string &filename)
+{
+  long long size = 0, time_ns = 0;
+  if (!file_version(filename, size, time_ns))
+    return "none";
+  return d2s(size) + ":" + d2s(time_ns);
+}
+
+
+
+/**
+ * Hash of the contents of a file of the mask (they are small), or "none".
+ */
+static std::string contents_hash(const std::string &filename)
+{
+  if (filename == DEFAULT_FILE_NAME)
+    return "none";
+  std::ifstream in(filename.c_str(), std::ios::binary);
+  require(in, "File '" + filename + "' can't be opened");
+  const std::string contents((std::istreambuf_iterator<char>(in)),
+                             std::istreambuf_iterator<char>());
+  return d2s(hash_bytes(contents.data(), contents.size()));
+}
+
+
+
+std::string Compute::run_description() const
+{
+  // a checkpoint is taken only by the run of the same computations over the
+  // same data, read in the same way
+  std::ostringstream run;
+  run << _param._file_0 << " " << file_version(_param._file_0) << " "
+      << _param._file_1 << " " << file_version(_param._file_1)
+      << " fmt " << _param._format << " " << _param._type_0 << " "
+      << _param._type_1 << " " << _param._endian_0 << " " << _param._endian_1
+      << " index " << _param._block_index << " " << _n_rows << " "
+      << _param._n_cols << " rows " << _param._row_beg << " " << _param._row_end
+      << " cols " << _param._col_beg << " " << _param._col_end
+      << " l2l1 " << _param._l2l1 << " stats " << _param._stats
+      << " rms " << _param._rms << " diff " << _param._diff_file << " "
+      << _param._diff_tolerance << " xcor " << _param._cross_correlation
+      << " " << _param._lag_region << " mask " << _param._weights_file << " "
+      << contents_hash(_param._weights_file) << " " << _param._mute_file
+      << " " << contents_hash(_param._mute_file) << " " << _param._mask_file
+      << " " << contents_hash(_param._mask_file);
+  return run.str();
+}
+
+
+
+void Compute::take_shard()
+{
+  // the partial results are marked by the description of the whole run, so
+  // only the shards of the same run are merged
+  _partial.reset(new Checkpoint(_param._partial_files, run_description(), 0.));
+
+  const long long k = _param._shard, n = _param._n_shards;
+  int &beg = (_param._shard_by == "rows" ? _param._row_beg : _param._col_beg);
+  int &end = (_param._shard_by == "rows" ? _param._row_end : _param._col_end);
+
+  // the rows are split by whole blocks, so the blocks of the files (and their
+  // indexes) aren't shared between the shards
+  const int unit = (_param._shard_by == "rows" ?
+                    BlockReader::rows_per_block(_param._n_cols) : 1);
+  const long long n_units = (end - beg + unit - 1) / unit;
+  require(n_units >= n, "There are fewer " + _param._shard_by + " (" +
+          d2s(n_units) + (unit > 1 ? " blocks" : "") + ") than shards (" +
+          d2s(n) + ")");
+  const int shard_beg = beg + n_units * k / n * unit;
+  const int shard_end = std::min((long long)end,
+                                 beg + n_units * (k + 1) / n * unit);
+  beg = shard_beg;
+  end = shard_end;
+
+  const double shard[] = { (double)k, (double)n,
+                           (double)_param._row_beg, (double)_param._row_end,
+                           (double)_param._col_beg, (double)_param._col_end,
+                           (double)(_param._shard_by == "traces") };
+  _partial->set("shard", shard, 7);
+
+  if (_param._verbose > 1)
+    std::cout << "Shard " << k << " of " << n << ": rows [" << _param._row_beg
+              << ", " << _param._row_end << "), columns [" << _param._col_beg
+              << ", " << _param._col_end << ")" << std::endl;
+}
+
+
+
+void Compute::merge_partials() const
+{
+  // the partial results of the shards are checked to be of this run, and to
+  // cover it once
+  const std::vector<std::string> files = split(_param._partial_files, ',');
+  const std::string run = run_description();
+  const int n_cols = _param._n_cols;
+  const int col_beg = _param._col_beg, col_end = _param._col_end;
+
+  NormsMetric norms(n_cols, col_beg, col_end, nullptr);
+  RmsDiffMetric rms(n_cols, col_beg, col_end, nullptr);
+  StatsKernel stats(n_cols, col_beg, col_end, _param._stats_worst);
+  stats.merge();
+  int n_equal_rows = 0;
+  std::vector<bool> merged;
+  std::vector<int> shard_beg, shard_end; // of the split rows or traces
+  int by_traces = -1;
+
+  for (size_t f = 0; f < files.size(); ++f)
   {
-    std::cerr << "File '" << _param._file_0 << "' can't be opened. Check that "
-                 "it exists.\n";
-    exit(1);
+    Checkpoint part(files[f], run, 0.);
+    require(part.load(), "The partial results '" + files[f] + "' can't be "
+            "read, or they are of another run");
+    const std::vector<double> &shard = part.values("shard");
+    require(shard.size() == 7 && shard[1] >= 1 && shard[0] >= 0 &&
+            shard[0] < shard[1], "The shard of the partial results '" +
+            files[f] + "' is damaged");
+    const int k = shard[0], n = shard[1];
+    if (merged.empty())
+    {
+      merged.assign(n, false);
+      shard_beg.assign(n, 0);
+      shard_end.assign(n, 0);
+      by_traces = shard[6];
+    }
+    require(n == (int)merged.size() && !merged[k], "The partial results '" +
+            files[f] + "' are of another number of shards, or of a shard "
+            "which is merged already");
+    require((int)shard[6] == by_traces, "The partial results '" + files[f] +
+            "' are of the shards split by another dimension (-shardby)");
+    merged[k] = true;
+
+    // the shards split one dimension of the compared part, and the other one
+    // is whole
+    const int part_row_beg = shard[2], part_row_end = shard[3];
+    const int part_col_beg = shard[4], part_col_end = shard[5];
+    require(by_traces ? (part_row_beg == _param._row_beg &&
+                         part_row_end == _param._row_end) :
+                        (part_col_beg == col_beg && part_col_end == col_end),
+            "The partial results '" + files[f] + "' aren't of the compared "
+            "rows and columns");
+    shard_beg[k] = (by_traces ? part_col_beg : part_row_beg);
+    shard_end[k] = (by_traces ? part_col_end : part_row_end);
+
+    // the shards of the traces see the same equal rows
+    const char *name = (_param._stats ? "stats.equal_rows" :
+                                        "stream.equal_rows");
+    const int equal_rows = (part.has(name) ? part.value(name) : 0);
+    if (part_col_beg == col_beg && part_col_end == col_end)
+      n_equal_rows += equal_rows;
+    else
+      n_equal_rows = std::max(n_equal_rows, equal_rows);
+
+    if (_param._stats)
+    {
+      StatsKernel stats_part(n_cols, part_col_beg, part_col_end,
+                             _param._stats_worst);
+      stats_part.merge();
+      stats_part.load(part);
+      stats.merge(stats_part);
+    }
+    else if (_param._l2l1)
+    {
+      NormsMetric norms_part(n_cols, part_col_beg, part_col_end, nullptr);
+      norms_part.load(part);
+      norms.merge(norms_part);
+    }
+    if (_param._rms == 3)
+    {
+      RmsDiffMetric rms_part(n_cols, part_col_beg, part_col_end, nullptr);
+      rms_part.load(part);
+      rms.merge(rms_part);
+    }
   }
-  in0.seekg(0, in0.end);
-  int length0 = in0.tellg(); // total length of the file0 in bytes
-  in0.seekg(0, in0.beg);
+  const int n_merged = std::count(merged.begin(), merged.end(), true);
+  require(n_merged == (int)merged.size(), "Only " + d2s(n_merged) + " of " +
+          d2s(merged.size()) + " shards are given");
 
-  // since we know that there are only float numbers in single precision, we get
-  // the total number of numbers in the file
-  int n_numbers = length0 / sizeof(float);
+  // the shards in their order cover the compared part once
+  int covered = (by_traces ? col_beg : _param._row_beg);
+  for (int k = 0; k < n_merged; ++k)
+  {
+    require(shard_beg[k] == covered && shard_end[k] > shard_beg[k],
+            "The shards don't cover the compared rows and columns exactly: "
+            "the shard " + d2s(k) + " is [" + d2s(shard_beg[k]) + ", " +
+            d2s(shard_end[k]) + ")");
+    covered = shard_end[k];
+  }
+  require(covered == (by_traces ? col_end : _param._row_end), "The shards "
+          "don't cover the compared rows and columns exactly: they end at " +
+          d2s(covered));
 
-  // and we also know the number of rows in the matrix
-  _n_rows = n_numbers / _param._n_cols;
   if (_param._verbose > 1)
-    std::cout << "n_rows = " << _n_rows << std::endl;
+    std::cout << "Merged the partial results of " << n_merged << " shards"
+              << std::endl;
+  if (_param._stats)
+    report(stats, n_equal_rows);
+  else if (_param._l2l1)
+    report(norms, n_equal_rows);
+  if (_param._rms == 3)
+    report(rms, n_equal_rows);
+}
+
+
 
-  if (_n_rows < 1)
+void Compute::open()
+{
+  _in0.reset(new BlockReader(_param._file_0, _param._n_cols, _param._format,
+                             element_type(_param._type_0),
+                             byte_order(_param._endian_0),
+                             io_backend(_param._io), _param._queue_depth));
+
+  // the number of columns may be defined by the files with trace or frame
+  // headers
+  if (_param._n_cols == 0)
   {
-    std::cerr << "The number of rows should be positive: " << _n_rows << "\n";
-    exit(1);
+    _param._n_cols = _in0->n_cols();
+    if (_param._col_end < 0) _param._col_end = _param._n_cols;
+    _param.check_parameters();
   }
 
-  // allocate and read the data from the given files
-  _data0 = new float*[_n_rows];
-  for (int i = 0; i < _n_rows; ++i)
+  _in1.reset(new BlockReader(_param._file_1, _param._n_cols, _param._format,
+                             element_type(_param._type_1),
+                             byte_order(_param._endian_1),
+                             io_backend(_param._io), _param._queue_depth));
+
+  if (_in0->n_cols() != _in1->n_cols() || _in0->n_rows() != _in1->n_rows())
   {
-    _data0[i] = new float[_param._n_cols];
-    for (int j = 0; j < _param._n_cols; ++j)
-      in0.read((char*)&_data0[i][j], sizeof(float));
+    std::cerr << "The given files have different length!\n";
+    exit(1);
   }
 
-  in0.close();
+  // and we also know the number of rows in the matrix
+  _n_rows = _in0->n_rows();
+  if (_param._verbose > 1)
+    std::cout << "n_rows = " << _n_rows << std::endl;
 
   //----------------------------------------------------------------------------
-  // file1
+  // adjust _row_end in the parameters
   //----------------------------------------------------------------------------
-  std::ifstream in1(_param._file_1.c_str(), std::ios::binary);
-  if (!in1)
+  if (_param._row_end < 0) _param._row_end = _n_rows;
+  require(_param._row_end <= _n_rows, "Last row for comparison (" +
+          d2s(_param._row_end) + ") is out of range (0, " + d2s(_n_rows) + "]");
+
+  if (_param._block_index)
   {
-    std::cerr << "File '" << _param._file_1 << "' can't be opened. Check that "
-                 "it exists.\n";
-    exit(1);
+    _index0.reset(new BlockIndex(*_in0));
+    _index1.reset(new BlockIndex(*_in1));
+    if (_param._verbose > 1)
+      std::cout << "blocks in the indexes: " << _index0->n_known() << " and "
+                << _index1->n_known() << " of " << _index0->n_blocks()
+                << std::endl;
   }
 
-  in1.seekg(0, in1.end);
-  int length1 = in1.tellg(); // total length of the file1 in bytes
-  in1.seekg(0, in1.beg);
+  make_mask();
+}
+
+
+
+/**
+ * Make the mask of the given range of the table n_rows x n_cols by the files
+ * of the parameters, or return nullptr, if none of them is given.
+ */
+static Mask* new_mask(const Parameters &param, int n_rows, int n_cols,
+                      int row_beg, int row_end, int col_beg, int col_end)
+{
+  if (param._weights_file == DEFAULT_FILE_NAME &&
+      param._mute_file == DEFAULT_FILE_NAME &&
+      param._mask_file == DEFAULT_FILE_NAME)
+    return nullptr;
+
+  const std::string none = "";
+  return new Mask(param._weights_file != DEFAULT_FILE_NAME ?
+                    param._weights_file : none,
+                  param._mute_file != DEFAULT_FILE_NAME ?
+                    param._mute_file : none,
+                  param._mask_file != DEFAULT_FILE_NAME ?
+                    param._mask_file : none,
+                  n_rows, n_cols, row_beg, row_end, col_beg, col_end);
+}
+
+
 
-  if (length0 != length1)
+void Compute::make_mask()
+{
+  // the mask is of the whole compared range (the shards compare parts of it)
+  _mask.reset(new_mask(_param, _n_rows, _param._n_cols,
+                       _param._row_beg, _param._row_end,
+                       _param._col_beg, _param._col_end));
+  if (_mask && _param._verbose > 0)
   {
-    std::cerr << "The given files have different length!\n";
-    in1.close();
-    exit(1);
+    const long long n_values = (long long)(_param._row_end -
+                                           _param._row_beg) *
+                               (_param._col_end - _param._col_beg);
+    std::cout << "Mask: " << _mask->n_live() << " of " << n_values
+              << " samples are compared (" << 100. * _mask->n_live() /
+                 std::max(n_values, 1LL) << " %)" << std::endl;
   }
+}
+
+
 
-  // allocate and read the data from the given files
+void Compute::save_indexes() const
+{
+  if (_index0) _index0->save();
+  if (_index1) _index1->save();
+}
+
+
+
+
+bool Compute::need_data() const
+{
+  // the L2 and L1 norms, the difference file and the RMS of the difference
+  // are computed by streaming the files, other computations need the whole
+  // data
+  return (_param._scale_file_1 || _param._shift_file_1 ||
+          _param._cross_correlation != 0 ||
+          _param._rms == 1 || _param._rms == 2 ||
+          _param._win_len > 0 || _param._check_symmetry || _param._hilbert ||
+          _param._spectrum || _param._dtw_band > 0);
+}
+
+
+
+
+void Compute::read()
+{
+  const int n_cols = _param._n_cols;
+
+  // allocate the data in one piece, and read them by blocks of rows. The data
+  // of any type are converted into single precision here. The pages are
+  // placed (if it's requested) before they are filled by the main thread
+  const PagePolicy pages = page_policy(_param._pages);
+  const NumaPolicy numa = numa_policy(_param._numa);
+  const size_t row_bytes = (size_t)n_cols * sizeof(float);
+  _buffer0.reset(new LargeBuffer(_n_rows, row_bytes, pages, numa));
+  _buffer1.reset(new LargeBuffer(_n_rows, row_bytes, pages, numa));
+  if (_param._verbose > 1 && pages != PAGES_SMALL)
+    std::cout << "pages of the data: "
+              << (_buffer0->pages() == PAGES_HUGE ? "huge" : "transparent huge")
+              << "\n";
+
+  _data0 = new float*[_n_rows];
   _data1 = new float*[_n_rows];
-  for (int i = 0; i < _n_rows; ++i)
+  _data0[0] = (float*)_buffer0->data();
+  _data1[0] = (float*)_buffer1->data();
+  for (int i = 1; i < _n_rows; ++i)
   {
-    _data1[i] = new float[_param._n_cols];
-    for (int j = 0; j < _param._n_cols; ++j)
-      in1.read((char*)&_data1[i][j], sizeof(float));
+    _data0[i] = _data0[0] + (size_t)i * n_cols;
+    _data1[i] = _data1[0] + (size_t)i * n_cols;
   }
 
-  in1.close();
+  // the masked data are weighted and zeroed where they aren't compared, so
+  // the files made of the data 1 need their values as they are in the file
+  _input1 = _data1;
+  if (_mask && (_param._scale_file_1 || _param._shift_file_1 ||
+                _param._dtw_band > 0))
+  {
+    _buffer_input1.reset(new LargeBuffer(_n_rows, row_bytes, pages, numa));
+    _input1 = new float*[_n_rows];
+    for (int i = 0; i < _n_rows; ++i)
+      _input1[i] = (float*)_buffer_input1->data() + (size_t)i * n_cols;
+  }
 
-  //----------------------------------------------------------------------------
-  // adjust _row_end in the parameters
-  //----------------------------------------------------------------------------
-  if (_param._row_end < 0) _param._row_end = _n_rows;
+  const int block_rows = BlockReader::rows_per_block(n_cols);
+  _progress.start("reading", _n_rows, "rows",
+                  (double)n_cols * (element_size(_in0->type()) +
+                                    element_size(_in1->type())));
+  for (int i = 0; i < _n_rows; i += block_rows)
+  {
+    check_cancelled();
+    const int i_end = std::min(i + block_rows, _n_rows);
+    if (_mask && _mask->masked(i, i_end - i) && _input1 == _data1 &&
+        i >= _param._row_beg && i_end <= _param._row_end)
+    {
+      // the compared rows without any compared sample aren't read
+      const size_t n_bytes = (size_t)(i_end - i) * row_bytes;
+      memset(_data0[i], 0, n_bytes);
+      memset(_data1[i], 0, n_bytes);
+    }
+    else if (_in0->type() == FLOAT32 && _in1->type() == FLOAT32)
+    {
+      // the reads of both files overlap, if the readers are asynchronous
+      _in0->start_block(i, i_end, (char*)_data0[i]);
+      _in1->start_block(i, i_end, (char*)_data1[i]);
+      _in0->finish_block();
+      _in1->finish_block();
+    }
+    else
+    {
+      _in0->read_rows(i, i_end, _data0[i]);
+      _in1->read_rows(i, i_end, _data1[i]);
+    }
+    if (_mask)
+    {
+      // the computations over the whole data see the weighted values, and
+      // the samples which aren't compared are zeros
+      if (_input1 != _data1)
+        memcpy(_input1[i], _data1[i], (size_t)(i_end - i) * row_bytes);
+      _mask->apply(_data0[i], i, i_end - i);
+      _mask->apply(_data1[i], i, i_end - i);
+    }
+    _progress.add(i_end - i);
+    _progress.poll();
+  }
+  _progress.finish();
 }
 
 
 
 
-void Compute::l2l1() const
+void Compute::stream_metrics()
 {
-  float l2_0 = 0, l1_0 = 0;
-  float l2_1 = 0, l1_1 = 0;
-  float l2_diff = 0, l1_diff = 0;
-  for (int i = _param._row_beg; i < _param._row_end; ++i)
+  // the metrics which are computed by streaming the files are computed in one
+  // pass by the fused kernel made of the requested ones. The combination is
+  // chosen here once, so the kernel has no checks of what is requested.
+  const bool norms = (_param._l2l1 && !_param._stats);
+  const bool rms = (_param._rms == 3);
+  const bool diff = (!_param._diff_file.empty() &&
+                     _param._diff_file != DEFAULT_FILE_NAME);
+
+  // a resumed pass continues the difference file after the rows which are
+  // in it already, but the compressed files can't be continued
+  const bool framed = (_param._diff_tolerance > 0. ||
+                       file_extension(_param._diff_file) == ".l2z");
+  if (_checkpoint && diff && framed && _checkpoint->has("stream.row"))
   {
-    for (int j = _param._col_beg; j < _param._col_end; ++j)
-    {
-      const float d0  = _data0[i][j];
-      const float d1  = _data1[i][j];
-      const float d01 = d0 - d1;
+    std::cerr << "Warning: the compressed difference file can't be "
+                 "continued, the streamed metrics are computed from the "
+                 "beginning\n";
+    _checkpoint->erase("stream.");
+  }
+  long long first_row = 0;
+  if (_checkpoint && _checkpoint->has("stream.row"))
+    first_row = _checkpoint->value("stream.row") - _param._row_beg;
+
+  // the difference file is compressed if it has the .l2z extension, and
+  // compressed with loss if the tolerance is given
+  std::shared_ptr<RowWriter> out;
+  if (diff)
+  {
+    if (_param._verbose > 1)
+      std::cout << "Make a file of difference: " << _param._diff_file
+                << std::endl;
+    out = create_row_writer(_param._diff_file,
+                            _param._col_end - _param._col_beg,
+                            _param._diff_tolerance,
+                            byte_order(_param._out_endian),
+                            first_row);
+  }
+  switch ((norms ? 4 : 0) + (rms ? 2 : 0) + (diff ? 1 : 0))
+  {
+    case 1: stream_metrics<NoMetric,    NoMetric,      DiffMetric>(out.get()); break;
+    case 2: stream_metrics<NoMetric,    RmsDiffMetric, NoMetric  >(out.get()); break;
+    case 3: stream_metrics<NoMetric,    RmsDiffMetric, DiffMetric>(out.get()); break;
+    case 4: stream_metrics<NormsMetric, NoMetric,      NoMetric  >(out.get()); break;
+    case 5: stream_metrics<NormsMetric, NoMetric,      DiffMetric>(out.get()); break;
+    case 6: stream_metrics<NormsMetric, RmsDiffMetric, NoMetric  >(out.get()); break;
+    case 7: stream_metrics<NormsMetric, RmsDiffMetric, DiffMetric>(out.get()); break;
+    default: break; // nothing is requested
+  }
+}
 
-      l2_0 += d0 * d0;
-      l2_1 += d1 * d1;
-      l2_diff += d01 * d01;
 
-      l1_0 += fabs(d0);
-      l1_1 += fabs(d1);
-      l1_diff += fabs(d01);
-    }
+
+template <class Norms, class Rms, class Diff>
+void Compute::stream_metrics(RowWriter *out)
+{
+  // the metrics are computed in double precision directly from the data of
+  // their own types
+  typedef FusedKernel<Norms, Rms, Diff> Fused;
+  Fused kernel(_param._n_cols, _param._col_beg, _param._col_end, out,
+               _mask.get());
+
+  // the difference file is removed, if the pass doesn't end, unless it's
+  // continued from the checkpoint
+  std::unique_ptr<OutputGuard> guard;
+  if (out)
+    guard.reset(new OutputGuard(_param._diff_file));
+
+  int n_equal_rows = 0, stopped_row = _param._row_end;
+  const double row_bytes = (double)_param._n_cols *
+                           (element_size(_in0->type()) +
+                            element_size(_in1->type()));
+  if (_checkpoint)
+  {
+    // the pass is resumed from the checkpoint, and its state is saved there
+    // (when the pass is cancelled too)
+    CheckpointedKernel<Fused> resumable(kernel, *_checkpoint, _param._row_beg);
+    resumable.resume();
+    _progress.start("streamed metrics", _param._row_end - resumable.next_row(),
+                    "rows", row_bytes);
+    ProgressKernel<CheckpointedKernel<Fused> >
+      reported(resumable, _progress, resumable.next_row());
+    stream_blocks(*_in0, *_in1, resumable.next_row(), _param._row_end,
+                  reported, _index0.get(), _index1.get());
+    resumable.finish();
+    n_equal_rows = resumable.n_equal_rows();
+    stopped_row = reported.next_row();
+    if (guard)
+      guard->complete();
+  }
+  else
+  {
+    _progress.start("streamed metrics", _param._row_end - _param._row_beg,
+                    "rows", row_bytes);
+    ProgressKernel<Fused> reported(kernel, _progress, _param._row_beg);
+    n_equal_rows = stream_blocks(*_in0, *_in1, _param._row_beg,
+                                 _param._row_end, reported,
+                                 _index0.get(), _index1.get());
+    stopped_row = reported.next_row();
   }
+  _progress.finish();
+  if (out)
+    out->close();
+
+  if (cancelled())
+  {
+    // the metrics of the rows which are passed are reported as they are
+    std::cout << "Cancelled at the row " << stopped_row << " of "
+              << _param._row_beg << ".." << _param._row_end
+              << ", the metrics of the passed rows:" << std::endl;
+    report(kernel.norms, n_equal_rows);
+    report(kernel.rms, n_equal_rows);
+    throw Cancelled(cancel_signal());
+  }
+  if (guard)
+    guard->complete();
+
+  if (_partial)
+  {
+    // the sums of the shard are merged with the others by "l2l1 merge"
+    kernel.save(*_partial);
+    _partial->set("stream.equal_rows", n_equal_rows);
+    return;
+  }
+
+  report(kernel.norms, n_equal_rows);
+  report(kernel.diff, n_equal_rows);
+  keep(kernel.rms);
+}
+
+
+
+void Compute::keep(const NoMetric&)
+{ }
 
-  l2_0 = sqrt(l2_0);
-  l2_1 = sqrt(l2_1);
-  l2_diff = sqrt(l2_diff);
+
+
+void Compute::keep(const RmsDiffMetric &rms)
+{
+  _rms_diff.reset(new RmsDiffMetric(rms));
+}
+
+
+
+void Compute::report(const NoMetric&, int) const
+{ }
+
+
+
+void Compute::report(const NormsMetric &norms, int n_equal_rows) const
+{
+  print_l2l1(norms, n_equal_rows);
+}
+
+
+
+void Compute::print_l2l1(const NormsMetric &kernel, int n_equal_rows) const
+{
+  const double l2_0 = sqrt(kernel.l2_0), l1_0 = kernel.l1_0;
+  const double l2_1 = sqrt(kernel.l2_1), l1_1 = kernel.l1_1;
+  const double l2_diff = sqrt(kernel.l2_diff), l1_diff = kernel.l1_diff;
 
   const double l2_diff_rel = l2_diff / l2_0;
   const double l1_diff_rel = l1_diff / l1_0;
@@ -197,6 +829,9 @@ void Compute::l2l1() const
     std::cout << "\nL1_diff_abs = " << l1_diff;
     std::cout << "\nL1_diff_rel = " << l1_diff_rel
               << " = " << l1_diff_rel * 100 << " %\n";
+    if (_index0)
+      std::cout << "rows skipped as equal by the index = " << n_equal_rows
+                << "\n";
   }
   else if (_param._verbose > 0)
   {
@@ -211,60 +846,381 @@ void Compute::l2l1() const
 
 
 
-void Compute::diff_file() const
+/// Description of the tolerance for the output
+static std::string tolerance(double tol)
 {
-  if (_param._verbose > 1)
-    std::cout << "Make a file of difference: " << _param._diff_file
-              << std::endl;
+  return (tol >= 0. ? " (tolerance " + d2s(tol) + ")" : " (not checked)");
+}
 
-  std::ofstream out(_param._diff_file.c_str(), std::ios::binary);
-  if (!out)
+
+
+bool Compute::check_tolerance() const
+{
+  // the same file is identical to itself only if both sides read it the
+  // same way (the types of the values and the order of bytes may differ)
+  bool identical = same_file(_param._file_0, _param._file_1) &&
+                   _in0->format() == _in1->format() &&
+                   _in0->type() == _in1->type() &&
+                   _in0->swapped() == _in1->swapped() &&
+                   _in0->n_cols() == _in1->n_cols();
+  ToleranceKernel kernel(_param._n_cols, _param._col_beg, _param._col_end,
+                         _param._tol_l2, _param._tol_max, _mask.get());
+  double energy_0 = -1.; // sum of the squares of the dataset 0
+  if (!identical)
   {
-    std::cerr << "File '" << _param._diff_file << "' can't be opened for "
-                 "writing.\n";
-    exit(1);
+    stream_blocks(*_in0, *_in1, _param._row_beg, _param._row_end, kernel,
+                  _index0.get(), _index1.get());
+    if (!kernel.exceeded() && kernel.need_energy())
+    {
+      // the files differ, so the check continues with the norm of dataset 0
+      energy_0 = energy(*_in0, _index0.get());
+      kernel.set_energy(energy_0);
+      if (!kernel.exceeded())
+        stream_blocks(*_in0, *_in1, kernel.next_row(), _param._row_end,
+                      kernel, _index0.get(), _index1.get());
+    }
+    identical = (kernel.l2_diff == 0. && kernel.n_nan == 0 &&
+                 !kernel.exceeded());
   }
 
-  for (int i = _param._row_beg; i < _param._row_end; ++i)
+  const double l2_diff_rel = sqrt(kernel.l2_diff / energy_0);
+  const bool pass = !kernel.exceeded();
+
+  if (_param._verbose > 0)
   {
-    for (int j = _param._col_beg; j < _param._col_end; ++j)
+    std::cout << "Tolerance check: " << (pass ? "PASS" : "FAIL");
+    if (identical)
+      std::cout << " (the data are identical)";
+    else if (!pass)
+      std::cout << " (proven after rows [" << _param._row_beg << ", "
+                << kernel.next_row() << ") of " << _param._row_end << ")";
+    std::cout << "\n";
+    if (!identical)
     {
-      float val = _data0[i][j] - _data1[i][j];
-      out.write(reinterpret_cast<char*>(&val), sizeof(val));
+      if (energy_0 >= 0.)
+        std::cout << "  L2_diff_rel  "
+                  << (kernel.next_row() < _param._row_end ? ">= " : "= ")
+                  << l2_diff_rel << tolerance(_param._tol_l2) << "\n";
+      std::cout << "  max_abs_diff "
+                << (kernel.next_row() < _param._row_end ? ">= " : "= ")
+                << kernel.max_diff << tolerance(_param._tol_max) << "\n";
+      if (kernel.n_nan > 0)
+        std::cout << "  " << kernel.n_nan << " differences are NaN\n";
+      if (_param._verbose > 1)
+        std::cout << "  " << kernel.n_equal_rows << " rows are equal byte by "
+                     "byte\n";
     }
   }
+  else
+    std::cout << (pass ? "PASS" : "FAIL") << "\n";
 
-  out.close();
+  return pass;
 }
 
 
 
+/**
+ * Sum of the squares of the compared values of the rows [row, row + n_rows)
+ * of the table, which are given as full rows of n_cols values of the type T.
+ */
+template <typename T>
+static double sum_squares(const T *rows, int row, int n_rows, int n_cols,
+                          int col_beg, int col_end, const Mask *mask)
+{
+  double s = 0.;
+#pragma omp parallel for reduction(+:s)
+  for (int i = 0; i < n_rows; ++i)
+  {
+    const T *values = rows + (size_t)i * n_cols;
+    if (!mask)
+    {
+      for (int j = col_beg; j < col_end; ++j)
+      {
+        const double value = to_double(values[j]);
+        s += value * value;
+      }
+      continue;
+    }
+    const double *weights = mask->weights();
+    const Span *span_end = mask->spans_end(row + i);
+    for (const Span *span = mask->spans_begin(row + i); span != span_end;
+         ++span)
+      for (int j = span->beg; j < span->end; ++j)
+      {
+        const double value = (weights ? weights[j] * to_double(values[j]) :
+                                        to_double(values[j]));
+        s += value * value;
+      }
+  }
+  return s;
+}
+
+
 
-void Compute::scale() const
+double Compute::energy(BlockReader &in, BlockIndex *index) const
 {
-  if (_param._verbose > 1)
-    std::cout << "Make a scaled file 1\n";
+  const int n_cols = in.n_cols();
+  const int block_rows = BlockReader::rows_per_block(n_cols);
+  std::vector<char> block((size_t)block_rows * n_cols * element_size(in.type()));
 
-  float ratio = 0.0;
+  // the sums of the squares of the whole rows are kept in the index, so only
+  // the blocks which aren't in it are read (in their own type)
+  const bool whole_rows = (!_mask && _param._col_beg == 0 &&
+                           _param._col_end == n_cols);
 
-  if (_param._scale_file_1 == 1)
+  double sum = 0.;
+  for (int i_beg = _param._row_beg; i_beg < _param._row_end; )
   {
-    // scale the file 1 with respect to the file 0
+    const int b = i_beg / block_rows;
+    const int i_end = std::min((b + 1) * block_rows, _param._row_end);
+    const bool whole = (i_beg == b * block_rows &&
+                        i_end == std::min((b + 1) * block_rows, in.n_rows()));
+    const int n_rows = i_end - i_beg;
+    const BlockStats *stats = (index ? index->stats(b) : nullptr);
+    if (_mask && _mask->masked(i_beg, n_rows))
+    {
+      i_beg = i_end;
+      continue;
+    }
+    if (whole && whole_rows && stats)
+    {
+      sum += stats->sum2;
+      i_beg = i_end;
+      continue;
+    }
 
-    // find the absolute max values of the two datasets
-    float max_value0 = fabs(_data0[_param._row_beg][_param._col_beg]);
-    float max_value1 = fabs(_data1[_param._row_beg][_param._col_beg]);
-    for (int i = _param._row_beg + 1; i < _param._row_end; ++i)
+    check_cancelled();
+    in.read_block(i_beg, i_end, &block[0]);
+    if (whole && index && !stats)
     {
-      for (int j = _param._col_beg + 1; j < _param._col_end; ++j)
+      const BlockStats read = block_stats(&block[0],
+                                          (long long)n_rows * n_cols,
+                                          in.type());
+      index->set_stats(b, read);
+      if (whole_rows)
       {
-        if (fabs(_data0[i][j]) > max_value0) max_value0 = fabs(_data0[i][j]);
-        if (fabs(_data1[i][j]) > max_value1) max_value1 = fabs(_data1[i][j]);
+        sum += read.sum2;
+        i_beg = i_end;
+        continue;
       }
     }
 
-    ratio = max_value0 / max_value1;
-
+    const int beg = _param._col_beg, end = _param._col_end;
+    const Mask *mask = _mask.get();
+    switch (in.type())
+    {
+      case FLOAT32:
+        sum += sum_squares((const float*)&block[0], i_beg, n_rows, n_cols,
+                           beg, end, mask);
+        break;
+      case FLOAT64:
+        sum += sum_squares((const double*)&block[0], i_beg, n_rows, n_cols,
+                           beg, end, mask);
+        break;
+      case FLOAT16:
+        sum += sum_squares((const float16*)&block[0], i_beg, n_rows, n_cols,
+                           beg, end, mask);
+        break;
+      case BFLOAT16:
+        sum += sum_squares((const bfloat16*)&block[0], i_beg, n_rows, n_cols,
+                           beg, end, mask);
+        break;
+    }
+    i_beg = i_end;
+  }
+  return sum;
+}
+
+
+
+void Compute::statistics() const
+{
+  StatsKernel kernel(_param._n_cols, _param._col_beg, _param._col_end,
+                     _param._stats_worst, _mask.get());
+  ProgressKernel<StatsKernel> reported(kernel, _progress, _param._row_beg);
+  _progress.start("statistics", _param._row_end - _param._row_beg, "rows",
+                  (double)_param._n_cols * (element_size(_in0->type()) +
+                                            element_size(_in1->type())));
+  const int n_equal_rows = stream_blocks(*_in0, *_in1, _param._row_beg,
+                                        _param._row_end, reported,
+                                        _index0.get(), _index1.get());
+  _progress.finish();
+  if (cancelled())
+  {
+    std::cout << "Cancelled at the row " << reported.next_row() << " of "
+              << _param._row_beg << ".." << _param._row_end
+              << ", the statistics aren't reported" << std::endl;
+    throw Cancelled(cancel_signal());
+  }
+  kernel.merge();
+
+  if (_partial)
+  {
+    // the statistics of the shard are merged with the others by "l2l1 merge"
+    kernel.save(*_partial);
+    _partial->set("stats.equal_rows", n_equal_rows);
+    return;
+  }
+  report(kernel, n_equal_rows);
+}
+
+
+
+void Compute::report(const StatsKernel &kernel, int n_equal_rows) const
+{
+  const StatsKernel::Part &stats = kernel.parts[0];
+
+  if (_param._l2l1)
+    print_l2l1(kernel.norms.norms, n_equal_rows);
+
+  // the misfits of the traces: trace, L2, L1, Linf, relative L2
+  const std::string fname = file_path(_param._file_0) + "misfit_" +
+                            file_stem(_param._file_0) + "_" +
+                            file_stem(_param._file_1) + ".bin";
+  std::ofstream out(fname.c_str(), std::ios::binary);
+  require(out, "File '" + fname + "' can't be opened");
+  int worst_trace = 0;
+  for (size_t t = 0; t < kernel.l2.size(); ++t)
+  {
+    const float misfit[] = { (float)(_param._col_beg + t),
+                             (float)sqrt(kernel.l2[t]),
+                             (float)kernel.l1[t],
+                             (float)kernel.linf[t],
+                             (float)sqrt(kernel.l2[t] / kernel.l2_0[t]) };
+    out.write((const char*)misfit, sizeof(misfit));
+    if (kernel.l2[t] > kernel.l2[worst_trace])
+      worst_trace = t;
+  }
+  out.close();
+
+  const QuantileSketch &abs_q = stats.abs_sketch;
+  const QuantileSketch &rel_q = stats.rel_sketch;
+  const double levels[] = { 0.5, 0.9, 0.99, 0.999 };
+  const int n_levels = sizeof(levels) / sizeof(levels[0]);
+
+  if (_param._verbose == 0) // with no verbosity we just print the numbers
+  {
+    for (int k = 0; k < n_levels; ++k)
+      std::cout << abs_q.quantile(levels[k]) << " ";
+    std::cout << *std::max_element(kernel.linf.begin(), kernel.linf.end())
+              << std::endl;
+    return;
+  }
+
+  std::cout << "Difference statistics:\n"
+            << "  values: " << stats.abs_hist.n_values() << "\n";
+
+  std::cout << "  percentiles of |diff| (within "
+            << 100. * QuantileSketch::relative_error() << " %):";
+  for (int k = 0; k < n_levels; ++k)
+    std::cout << " p" << 100. * levels[k] << " = "
+              << abs_q.quantile(levels[k]);
+  std::cout << "\n  percentiles of |diff|/|data0|:";
+  for (int k = 0; k < n_levels; ++k)
+    std::cout << " p" << 100. * levels[k] << " = "
+              << rel_q.quantile(levels[k]);
+  std::cout << "\n";
+
+  std::cout << "  histogram of |diff|:\n";
+  stats.abs_hist.print(std::cout, "    ");
+  std::cout << "  histogram of |diff|/|data0|:\n";
+  stats.rel_hist.print(std::cout, "    ");
+  if (stats.n_undefined > 0)
+    std::cout << "    " << stats.n_undefined << " differences where data0 = 0"
+              << "\n";
+
+  std::cout << "  worst trace: " << _param._col_beg + worst_trace << " (L2 = "
+            << sqrt(kernel.l2[worst_trace]) << ", Linf = "
+            << kernel.linf[worst_trace] << ")\n"
+            << "  misfits of the traces (trace, L2, L1, Linf, L2_rel): "
+            << fname << "\n";
+
+  const std::vector<Location> worst = stats.worst.sorted();
+  if (!worst.empty())
+  {
+    std::cout << "  worst locations:\n";
+    for (size_t k = 0; k < worst.size(); ++k)
+      std::cout << "    row " << worst[k].row << " col " << worst[k].col
+                << ": |diff| = " << worst[k].value << " (data0 = "
+                << worst[k].value0 << ", data1 = " << worst[k].value1 << ")\n";
+  }
+  std::cout.flush();
+}
+
+
+
+void Compute::report(const DiffMetric&, int) const
+{
+  const int n_cols = _param._col_end - _param._col_beg;
+  if (_param._verbose > 1 && file_extension(_param._diff_file) == ".l2z")
+  {
+    std::ifstream in(_param._diff_file.c_str(), std::ios::binary);
+    in.seekg(0, in.end);
+    const double raw_bytes = (double)(_param._row_end - _param._row_beg) *
+                             n_cols * sizeof(float);
+    std::cout << "  compression ratio = " << raw_bytes / (double)in.tellg();
+    if (_param._diff_tolerance > 0.0)
+      std::cout << " with max error " << _param._diff_tolerance;
+    std::cout << std::endl;
+  }
+}
+
+
+
+
+void Compute::pack() const
+{
+  BlockReader in(_param._file_0, _param._n_cols, _param._format,
+                 element_type(_param._type_0),
+                 byte_order(_param._endian_0));
+
+  if (_param._verbose > 1)
+    std::cout << "Make a compressed file: " << _param._pack_file << std::endl;
+
+  // the values are compressed as they are, without conversion
+  const int n_cols = in.n_cols();
+  FrameWriter out(_param._pack_file, n_cols, CODEC_DEFLATE, in.type());
+
+  const int block_rows = BlockReader::rows_per_block(n_cols);
+  std::vector<char> block((size_t)block_rows * n_cols * element_size(in.type()));
+  for (int i = 0; i < in.n_rows(); i += block_rows)
+  {
+    const int i_end = std::min(i + block_rows, in.n_rows());
+    in.read_block(i, i_end, &block[0]);
+    out.write_block(&block[0], i_end - i);
+  }
+
+  out.close();
+}
+
+
+
+
+void Compute::scale() const
+{
+  if (_param._verbose > 1)
+    std::cout << "Make a scaled file 1\n";
+
+  float ratio = 0.0;
+
+  if (_param._scale_file_1 == 1)
+  {
+    // scale the file 1 with respect to the file 0
+
+    // find the absolute max values of the two datasets
+    float max_value0 = fabs(_data0[_param._row_beg][_param._col_beg]);
+    float max_value1 = fabs(_data1[_param._row_beg][_param._col_beg]);
+    for (int i = _param._row_beg + 1; i < _param._row_end; ++i)
+    {
+      for (int j = _param._col_beg + 1; j < _param._col_end; ++j)
+      {
+        if (fabs(_data0[i][j]) > max_value0) max_value0 = fabs(_data0[i][j]);
+        if (fabs(_data1[i][j]) > max_value1) max_value1 = fabs(_data1[i][j]);
+      }
+    }
+
+    ratio = max_value0 / max_value1;
+
     if (_param._verbose > 1)
       std::cout << "  max_value0 = " << max_value0 << "\n"
                 << "  max_value1 = " << max_value1 << "\n"
@@ -283,19 +1239,21 @@ void Compute::scale() const
                                     file_stem(_param._file_1) +
                                     "_scaled.bin";
 
-  std::ofstream out(scaled_file_1.c_str(), std::ios::binary);
-  require(out, "File '" + scaled_file_1 + "' can't be opened for writing");
+  const int width = _param._col_end - _param._col_beg;
+  OutputGuard guard(scaled_file_1);
+  RawWriter out(scaled_file_1, width, byte_order(_param._out_endian));
   require(ratio != 0.0, "Ratio wasn't initialized");
 
+  std::vector<float> row(width);
   for (int i = _param._row_beg; i < _param._row_end; ++i)
   {
+    check_cancelled();
     for (int j = _param._col_beg; j < _param._col_end; ++j)
-    {
-      float val = ratio * _data1[i][j];
-      out.write(reinterpret_cast<char*>(&val), sizeof(val));
-    }
+      row[j - _param._col_beg] = ratio * _input1[i][j];
+    out.write_rows(&row[0], 1);
   }
   out.close();
+  guard.complete();
 
   if (_param._verbose > 1)
     std::cout << "  scaled file: " << scaled_file_1 << std::endl;
@@ -343,26 +1301,151 @@ void Compute::shift() const
   const std::string shifted_file_1 = file_path(_param._file_1) +
                                      file_stem(_param._file_1) +
                                      "_shifted.bin";
-  std::ofstream out(shifted_file_1.c_str(), std::ios::binary);
-  if (!out)
-  {
-    std::cerr << "File '" << shifted_file_1 << "' can't be opened for "
-                 "writing.\n";
-    exit(1);
-  }
+  const int width = _param._col_end - _param._col_beg;
+  OutputGuard guard(shifted_file_1);
+  RawWriter out(shifted_file_1, width, byte_order(_param._out_endian));
   for (int i = _param._row_beg; i < _param._row_end; ++i)
   {
+    check_cancelled();
     const int tmp = std::max(i - shift_step, _param._row_beg);
     const int tstep = std::min(tmp, _param._row_end-1);
-    for (int j = _param._col_beg; j < _param._col_end; ++j)
+    out.write_rows(&_input1[tstep][_param._col_beg], 1);
+  }
+  out.close();
+  guard.complete();
+}
+
+
+
+
+/// Writer of the aligned data 1 by the stripes of the traces which are given
+/// by dtw_alignment() with their lags
+class AlignedWriter
+{
+public:
+
+  AlignedWriter(float **data1, int row_beg, int row_end, int col_beg,
+                RawWriter &out)
+    : _data1(data1), _row_beg(row_beg), _row_end(row_end),
+      _col_beg(col_beg), _out(out), _values()
+  { }
+
+  void stripe(int j_beg, int j_end, const short *lags)
+  {
+    const int width = j_end - j_beg;
+    const int n_rows = std::max(1, (int)(DTW_LAG_BYTES / 2 /
+                                         (width * sizeof(float))));
+    _values.resize((size_t)std::min(n_rows, _row_end - _row_beg) * width);
+    for (int r = _row_beg; r < _row_end; r += n_rows)
     {
-      float val = _data1[tstep][j];
-      out.write(reinterpret_cast<char*>(&val), sizeof(val));
+      const int r_end = std::min(r + n_rows, _row_end);
+      for (int i = r; i < r_end; ++i)
+      {
+        const short *lag = lags + (size_t)(i - _row_beg) * width;
+        float *values = &_values[(size_t)(i - r) * width];
+        for (int t = 0; t < width; ++t)
+          values[t] = _data1[i + lag[t]][j_beg + t];
+      }
+      _out.write_columns(&_values[0], r - _row_beg, r_end - r,
+                         j_beg - _col_beg, width);
     }
   }
+
+protected:
+
+  float **_data1;
+  int _row_beg, _row_end, _col_beg;
+  RawWriter &_out;
+  std::vector<float> _values;
+
+  AlignedWriter(const AlignedWriter&);
+  AlignedWriter& operator =(const AlignedWriter&);
+};
+
+
+
+void Compute::dtw_align() const
+{
+  if (_param._verbose > 0)
+    std::cout << "Dynamic time warping alignment of file 1" << std::endl;
+
+  // the aligned data 1 is written by the stripes of the traces, so the lags
+  // of the whole table aren't kept
+  const std::string aligned_file_1 = file_path(_param._file_1) +
+                                     file_stem(_param._file_1) + "_dtw.bin";
+  const int width = _param._col_end - _param._col_beg;
+  OutputGuard guard(aligned_file_1);
+  RawWriter out(aligned_file_1, width, byte_order(_param._out_endian));
+  AlignedWriter aligned(_input1, _param._row_beg, _param._row_end,
+                        _param._col_beg, out);
+
+  std::vector<double> diff_before, diff_after, energy_0, mean_lag;
+  std::vector<int> max_lag;
+  _progress.start("dtw alignment", width, "traces",
+                  2. * (_param._row_end - _param._row_beg) * sizeof(float));
+  dtw_alignment(_data0, _data1,
+                _param._row_beg, _param._row_end,
+                _param._col_beg, _param._col_end,
+                _param._dtw_band, aligned,
+                diff_before, diff_after, energy_0, max_lag, mean_lag,
+                &_progress);
+  check_cancelled();
+  _progress.finish();
   out.close();
-}
+  guard.complete();
+
+  // the summary of the warping paths: trace, misfit before and after the
+  // alignment, mean lag, max absolute lag
+  const std::string fname = file_path(_param._file_0) + "dtw_" +
+                            file_stem(_param._file_0) + "_" +
+                            file_stem(_param._file_1) + ".bin";
+  std::ofstream summary(fname.c_str(), std::ios::binary);
+  require(summary, "File '" + fname + "' can't be opened");
+
+  double total_before = 0., total_after = 0., total_energy = 0.;
+  double total_lag = 0.;
+  int worst_lag = 0, worst_trace = _param._col_beg;
+  for (int t = 0; t < width; ++t)
+  {
+    const double before = (energy_0[t] > 0. ?
+                           sqrt(diff_before[t] / energy_0[t]) : 0.);
+    const double after = (energy_0[t] > 0. ?
+                          sqrt(diff_after[t] / energy_0[t]) : 0.);
+    const float path[] = { (float)(_param._col_beg + t), (float)before,
+                           (float)after, (float)mean_lag[t],
+                           (float)max_lag[t] };
+    summary.write((const char*)path, sizeof(path));
+    if (_param._verbose > 1)
+      std::cout << _param._col_beg + t << "\t" << d2s(before, 1, 12) << "\t"
+                << d2s(after, 1, 12) << "\t" << mean_lag[t] << "\t"
+                << max_lag[t] << "\n";
+
+    if (max_lag[t] > worst_lag)
+    {
+      worst_lag = max_lag[t];
+      worst_trace = _param._col_beg + t;
+    }
+    total_before += diff_before[t];
+    total_after += diff_after[t];
+    total_energy += energy_0[t];
+    total_lag += mean_lag[t];
+  }
+  summary.close();
 
+  const double before = sqrt(total_before / total_energy);
+  const double after = sqrt(total_after / total_energy);
+  if (_param._verbose == 0)
+  {
+    std::cout << before << " " << after << std::endl;
+    return;
+  }
+
+  std::cout << "  resulting files: " << aligned_file_1 << ", " << fname << "\n"
+            << "  relative L2 misfit before alignment = " << before * 100
+            << " %, after = " << after * 100 << " %\n"
+            << "  mean lag = " << total_lag / width << " rows, max lag = "
+            << worst_lag << " rows at trace " << worst_trace << std::endl;
+}
 
 
 
@@ -370,50 +1453,135 @@ void Compute::compute_xcorrelation() const
 {
   if (_param._verbose > 0) std::cout << "Cross correlation:\n";
 
-  if (_param._cross_correlation == 1)
+  require(_param._cross_correlation == 1 || _param._cross_correlation == 2,
+          "Unknown xcorrelation option");
+  const bool by_traces = (_param._cross_correlation == 1);
+
+  // the moments of the traces don't depend on the lag, and the buffers are
+  // taken once for all the lags, so the loop over the lags doesn't touch
+  // the heap
+  const int n_traces = _param._col_end - _param._col_beg;
+  const int n_lags = 2 * _param._lag_region + 1;
+  const Arena::Mark mark = _arena.mark();
+  double *moments = _arena.allocate<double>(4 * (size_t)n_traces);
+  double *mu[2] = { moments, moments + n_traces };
+  double *sigma[2] = { moments + 2 * n_traces, moments + 3 * n_traces };
+  double *xcorrelation = _arena.allocate<double>(n_traces);
+
+  // the min and max of the lags which are done (of the resumed run too)
+  double *results = _arena.allocate<double>(2 * n_lags);
+  int n_done = 0;
+  if (_checkpoint && _checkpoint->has("xcor.done"))
   {
-    for (int lag = -_param._lag_region; lag <= _param._lag_region; ++lag)
-    {
-      std::vector<double> xcorrelation;
-      x_correlation_by_traces(_data0, _data1,
-                              _param._row_beg, _param._row_end,
-                              _param._col_beg, _param._col_end,
-                              lag, xcorrelation);
-
-      const double minXCor = *std::min_element(xcorrelation.begin(), xcorrelation.end());
-      const double maxXCor = *std::max_element(xcorrelation.begin(), xcorrelation.end());
+    n_done = _checkpoint->value("xcor.done");
+    const std::vector<double> &done = _checkpoint->values("xcor.results");
+    std::copy(done.begin(), done.end(), results);
+  }
 
-      if (_param._verbose > 0)
-        std::cout << "  lag = " << lag
-                  << " min = " << minXCor
-                  << " max = " << maxXCor << std::endl;
-      else // with no verbosity we just print the numbers
-        std::cout << minXCor << " " << maxXCor << std::endl;
+  if (by_traces && n_done < n_lags)
+  {
+    if (_checkpoint && _checkpoint->has("xcor.moments"))
+    {
+      const std::vector<double> &saved = _checkpoint->values("xcor.moments");
+      std::copy(saved.begin(), saved.end(), moments);
+    }
+    else
+    {
+      trace_moments(_data0, _data1, _param._row_beg, _param._row_end,
+                    _param._col_beg, _param._col_end, mu, sigma, &_arena);
+      if (_checkpoint)
+        _checkpoint->set("xcor.moments", moments, 4 * (size_t)n_traces);
     }
+    _profile.stage("xcorrelation moments");
   }
-  else if (_param._cross_correlation == 2)
+
+  _progress.start("xcorrelation lags", n_lags - std::min(n_done, n_lags),
+                  "lags");
+  for (int k = 0; k < n_lags; ++k)
   {
-    for (int lag = -_param._lag_region; lag <= _param._lag_region; ++lag)
+    const int lag = k - _param._lag_region;
+    if (k >= n_done)
     {
-      double xcorrelation;
-      x_correlation_whole(_data0, _data1,
-                          _param._row_beg, _param._row_end,
-                          _param._col_beg, _param._col_end,
-                          lag, xcorrelation);
+      if (cancelled())
+      {
+        // the lags which are done are kept to be resumed
+        if (_checkpoint)
+          _checkpoint->save();
+        std::cout << "Cancelled at the lag " << lag << ", " << k << " of "
+                  << n_lags << " lags are done" << std::endl;
+        throw Cancelled(cancel_signal());
+      }
+      if (by_traces)
+      {
+        x_correlation_by_traces(_data0, _data1,
+                                _param._row_beg, _param._row_end,
+                                _param._col_beg, _param._col_end,
+                                lag, mu, sigma, xcorrelation, &_arena);
+        results[2*k] = *std::min_element(xcorrelation,
+                                         xcorrelation + n_traces);
+        results[2*k + 1] = *std::max_element(xcorrelation,
+                                             xcorrelation + n_traces);
+      }
+      else
+      {
+        x_correlation_whole(_data0, _data1,
+                            _param._row_beg, _param._row_end,
+                            _param._col_beg, _param._col_end,
+                            lag, results[2*k]);
+        results[2*k + 1] = results[2*k];
+      }
+
+      if (_checkpoint)
+      {
+        _checkpoint->set("xcor.results", results, 2 * n_lags);
+        _checkpoint->set("xcor.done", k + 1);
+        if (_checkpoint->due())
+          _checkpoint->save();
+      }
+      _progress.add(1);
+      _progress.poll();
+    }
 
+    const double minXCor = results[2*k], maxXCor = results[2*k + 1];
+    if (!by_traces)
+    {
       if (_param._verbose > 0)
         std::cout << "  lag = " << lag
-                  << " value = " << xcorrelation << std::endl;
+                  << " value = " << minXCor << std::endl;
       else
-        std::cout << xcorrelation << std::endl;
+        std::cout << minXCor << std::endl;
     }
+    else if (_param._verbose > 0)
+      std::cout << "  lag = " << lag
+                << " min = " << minXCor
+                << " max = " << maxXCor << std::endl;
+    else // with no verbosity we just print the numbers
+      std::cout << minXCor << " " << maxXCor << std::endl;
   }
-  else require(false, "Unknown xcorrelation option");
+  _progress.finish();
+  _profile.stage("xcorrelation lags");
+  _arena.release(mark);
 }
 
 
 
 
+/// The RMS of the traces of the data in memory (of all the rows) are made
+/// the RMS of their compared samples, since the other samples are zeros
+static void rms_of_compared(const Mask *mask, int col_beg, int n_rows,
+                            std::vector<double> &RMS)
+{
+  if (!mask)
+    return;
+  for (size_t t = 0; t < RMS.size(); ++t)
+  {
+    const long long n = mask->n_live(col_beg + t);
+    RMS[t] = (n > 0 ? RMS[t] * sqrt((double)n_rows / n) : 0.);
+  }
+}
+
+
+
 void Compute::compute_rms() const
 {
   if (_param._verbose > 0)
@@ -426,6 +1594,9 @@ void Compute::compute_rms() const
                            _param._row_beg, _param._row_end,
                            _param._col_beg, _param._col_end,
                            RMS_0, RMS_1);
+    const int n_rows = _param._row_end - _param._row_beg;
+    rms_of_compared(_mask.get(), _param._col_beg, n_rows, RMS_0);
+    rms_of_compared(_mask.get(), _param._col_beg, n_rows, RMS_1);
 
     const std::string fname0 = file_path(_param._file_0) +
                                "rms_" + file_stem(_param._file_0) +
@@ -474,6 +1645,8 @@ void Compute::compute_rms() const
                           _param._row_beg, _param._row_end,
                           _param._col_beg, _param._col_end,
                           RMS);
+    rms_of_compared(_mask.get(), _param._col_beg,
+                    _param._row_end - _param._row_beg, RMS);
 
     const std::string fname = file_path(_param._file_0) +
                               "rms_" + file_stem(_param._file_0) +
@@ -507,54 +1680,1163 @@ void Compute::compute_rms() const
 
 
 
-static double columns_differ(float **data, int row_beg, int row_end,
-                             int colA, int colB)
+void Compute::report(const RmsDiffMetric &rms, int) const
 {
-  const double tol = 1e-5;
+  if (_param._verbose > 0)
+    std::cout << "RMS of difference computation" << std::endl;
+
+  // the RMS of a trace is of its compared samples
+  std::vector<double> RMS(rms.sum2.size());
+  for (size_t i = 0; i < RMS.size(); ++i)
+  {
+    const long long n = (_mask ? _mask->n_live(_param._col_beg + i) :
+                         _param._row_end - _param._row_beg);
+    RMS[i] = (n > 0 ? sqrt(rms.sum2[i] / n) : 0.);
+  }
+
+  const std::string fname = file_path(_param._file_0) +
+                            "rms_diff_" + file_stem(_param._file_0) + "_" +
+                            file_stem(_param._file_1) + ".bin";
+
+  std::ofstream out(fname.c_str(), std::ios::binary);
+  require(out, "File '" + fname + "' can't be opened");
+
+  for (size_t i = 0; i < RMS.size(); ++i)
+  {
+    float val_x = _param._col_beg + i;
+    float val_y = RMS[i];
+    out.write((char*)&val_x, sizeof(float));
+    out.write((char*)&val_y, sizeof(float));
+    if (_param._verbose > 1)
+      std::cout << _param._col_beg + i << "\t" << d2s(RMS[i], 1, 12) << "\n";
+  }
+
+  out.close();
+
+  std::cout << "  resulting file: " << fname << std::endl;
+
+  const double RMS_min = *std::min_element(RMS.begin(), RMS.end());
+  const double RMS_max = *std::max_element(RMS.begin(), RMS.end());
+
+  std::cout << "RMS_diff: min = " << RMS_min << " max " << RMS_max << "\n";
+}
+
+
+
+
+void Compute::compute_rms_windows() const
+{
+  if (_param._verbose > 0)
+    std::cout << "Time-gated RMS computation" << std::endl;
+
+  const int n_traces = _param._col_end - _param._col_beg;
+  require(_param._win_len <= _param._row_end - _param._row_beg, "The time "
+          "window (" + d2s(_param._win_len) + ") is longer than the range of "
+          "rows (" + d2s(_param._row_end - _param._row_beg) + ")");
+
+  std::vector<double> RMS_0, RMS_1, L2_diff;
+  _progress.start("rms windows", n_traces, "traces",
+                  2. * (_param._row_end - _param._row_beg) * sizeof(float));
+  ::compute_rms_windows(_data0, _data1,
+                        _param._row_beg, _param._row_end,
+                        _param._col_beg, _param._col_end,
+                        _param._win_len, _param._win_hop,
+                        RMS_0, RMS_1, L2_diff, &_progress);
+  check_cancelled();
+  _progress.finish();
+
+  const int n_windows = RMS_0.size() / n_traces;
+
+  const std::string fname0 = file_path(_param._file_0) +
+                             "rms_win_" + file_stem(_param._file_0) +
+                             ".bin";
+  const std::string fname1 = file_path(_param._file_1) +
+                             "rms_win_" + file_stem(_param._file_1) +
+                             ".bin";
+  const std::string fname_diff = file_path(_param._file_0) +
+                                 "l2_win_" + file_stem(_param._file_0) +
+                                 "_" + file_stem(_param._file_1) + ".bin";
+
+  std::ofstream out0(fname0.c_str(), std::ios::binary);
+  std::ofstream out1(fname1.c_str(), std::ios::binary);
+  std::ofstream outd(fname_diff.c_str(), std::ios::binary);
+  require(out0, "File '" + fname0 + "' can't be opened");
+  require(out1, "File '" + fname1 + "' can't be opened");
+  require(outd, "File '" + fname_diff + "' can't be opened");
+
+  // the results are saved in the same format as the input data: the rows are
+  // the time windows, the columns are the traces
+  std::vector<float> row0(n_traces), row1(n_traces), rowd(n_traces);
   double max_diff = 0.0;
-  for (int i = row_beg; i < row_end; ++i)
+  int max_diff_window = 0, max_diff_trace = _param._col_beg;
+  for (int w = 0; w < n_windows; ++w)
   {
-    const double d0 = data[i][colA];
-    const double d1 = data[i][colB];
-//    std::cout << "    " << i << " " << d0 << " " << d1 << std::endl;
-    double diff = fabs(d0 - d1);
-    if (fabs(d0) > tol)
-      diff /= fabs(d0);
-    max_diff = std::max(max_diff, diff);
+    for (int j = 0; j < n_traces; ++j)
+    {
+      const int k = w * n_traces + j;
+      row0[j] = RMS_0[k];
+      row1[j] = RMS_1[k];
+      rowd[j] = L2_diff[k];
+      if (L2_diff[k] > max_diff)
+      {
+        max_diff = L2_diff[k];
+        max_diff_window = w;
+        max_diff_trace = _param._col_beg + j;
+      }
+    }
+    out0.write((char*)&row0[0], n_traces * sizeof(float));
+    out1.write((char*)&row1[0], n_traces * sizeof(float));
+    outd.write((char*)&rowd[0], n_traces * sizeof(float));
   }
 
-  return max_diff;
+  outd.close();
+  out1.close();
+  out0.close();
+
+  std::cout << "  resulting files (" << n_windows << " windows x " << n_traces
+            << " traces):\n  " << fname0 << "\n  " << fname1 << "\n  "
+            << fname_diff << std::endl;
+
+  const int row_max = _param._row_beg + max_diff_window * _param._win_hop;
+  std::cout << "L2 diff: max = " << max_diff << " in window "
+            << max_diff_window << " (rows " << row_max << " - "
+            << row_max + _param._win_len << ") of trace " << max_diff_trace
+            << "\n";
 }
 
 
 
 
+void Compute::compute_hilbert_misfits() const
+{
+  if (_param._verbose > 0)
+    std::cout << "Envelope and phase misfits" << std::endl;
+
+  std::vector<double> env_diff, env_0, phase_diff, weight;
+  _progress.start("hilbert misfits", _param._col_end - _param._col_beg,
+                  "traces",
+                  2. * (_param._row_end - _param._row_beg) * sizeof(float));
+  hilbert_misfits(_data0, _data1,
+                  _param._row_beg, _param._row_end,
+                  _param._col_beg, _param._col_end,
+                  env_diff, env_0, phase_diff, weight, &_progress);
+  check_cancelled();
+  _progress.finish();
+
+  // the misfits of the traces: trace, envelope misfit, phase misfit
+  const std::string fname = file_path(_param._file_0) + "hilbert_" +
+                            file_stem(_param._file_0) + "_" +
+                            file_stem(_param._file_1) + ".bin";
+  std::ofstream out(fname.c_str(), std::ios::binary);
+  require(out, "File '" + fname + "' can't be opened");
+
+  double total_env_diff = 0., total_env_0 = 0.;
+  double total_phase = 0., total_weight = 0.;
+  double max_env = 0., max_phase = 0.;
+  int worst_env = 0, worst_phase = 0;
+  for (size_t t = 0; t < env_diff.size(); ++t)
+  {
+    const double env = sqrt(env_diff[t] / env_0[t]);
+    const double phase = sqrt(phase_diff[t] / weight[t]);
+    const float misfit[] = { (float)(_param._col_beg + t), (float)env,
+                             (float)phase };
+    out.write((const char*)misfit, sizeof(misfit));
+    if (_param._verbose > 1)
+      std::cout << _param._col_beg + t << "\t" << d2s(env, 1, 12) << "\t"
+                << d2s(phase, 1, 12) << "\n";
+
+    if (env > max_env) { max_env = env; worst_env = t; }
+    if (phase > max_phase) { max_phase = phase; worst_phase = t; }
+    total_env_diff += env_diff[t];
+    total_env_0 += env_0[t];
+    total_phase += phase_diff[t];
+    total_weight += weight[t];
+  }
+  out.close();
+
+  const double env = sqrt(total_env_diff / total_env_0);
+  const double phase = sqrt(total_phase / total_weight);
+  if (_param._verbose == 0)
+  {
+    std::cout << env << " " << phase << std::endl;
+    return;
+  }
+
+  std::cout << "  resulting file: " << fname << "\n"
+            << "  envelope misfit (relative L2) = " << env * 100 << " %, max "
+            << max_env * 100 << " % at trace " << _param._col_beg + worst_env
+            << "\n"
+            << "  phase misfit (weighted RMS)    = " << phase << " rad, max "
+            << max_phase << " rad at trace " << _param._col_beg + worst_phase
+            << std::endl;
+}
+
+
+
+void Compute::compute_spectral_misfits() const
+{
+  if (_param._verbose > 0)
+    std::cout << "Spectral misfits" << std::endl;
+
+  const int n = _param._row_end - _param._row_beg;
+  const FftPlan plan(FftPlan::next_power_of_two(n));
+  const int N = plan.size();
+  const int n_bins = N/2 + 1;
+  const double df = 1. / (N * _param._dt);
+
+  // the bins of the bands: the whole spectrum, and the requested bands. A bin
+  // belongs to a band lo-hi if lo <= f < hi
+  std::vector<std::pair<int, int> > bands(1, std::make_pair(0, n_bins));
+  std::vector<std::string> names(1, "all");
+  const std::vector<std::string> ranges = split(_param._bands, ',');
+  for (size_t b = 0; b < ranges.size(); ++b)
+  {
+    // the numbers may have exponents (1e-3-5), so the low one is parsed
+    // first, and then the '-' after it is expected
+    const char *range = ranges[b].c_str();
+    char *end_lo = nullptr, *end_hi = nullptr;
+    const double lo = strtod(range, &end_lo);
+    require(end_lo != range && *end_lo == '-', "The frequency band '" +
+            ranges[b] + "' must be given as lo-hi");
+    const double hi = strtod(end_lo + 1, &end_hi);
+    require(end_hi != end_lo + 1 && *end_hi == '\0', "The frequency band '" +
+            ranges[b] + "' must be given as lo-hi");
+    require(lo >= 0. && lo < hi, "Wrong frequency band '" + ranges[b] + "'");
+    const int beg = std::min((int)std::ceil(lo / df), n_bins);
+    const int end = std::min((int)std::ceil(hi / df), n_bins);
+    bands.push_back(std::make_pair(beg, end));
+    names.push_back(ranges[b]);
+  }
+  const int n_bands = bands.size();
+
+  const std::string stems = file_stem(_param._file_0) + "_" +
+                            file_stem(_param._file_1) + ".bin";
+  const std::string spec_name = file_path(_param._file_0) + "spectrum_" + stems;
+  const std::string band_name = file_path(_param._file_0) + "bands_" + stems;
+  OutputGuard spec_guard(spec_name), band_guard(band_name);
+  std::ofstream spec_out(spec_name.c_str(), std::ios::binary);
+  require(spec_out, "File '" + spec_name + "' can't be opened");
+  std::ofstream band_out(band_name.c_str(), std::ios::binary);
+  require(band_out, "File '" + band_name + "' can't be opened");
+
+  // the traces are processed by chunks, so the spectra of the chunk (about
+  // 64 MB) are kept in memory, and then written
+  const int chunk = std::max(16, (1 << 24) / (3 * n_bins)) / 16 * 16;
+
+  std::vector<double> total_diff(n_bands, 0.), total_0(n_bands, 0.);
+  std::vector<double> max_misfit(n_bands, 0.);
+  std::vector<int> worst(n_bands, _param._col_beg);
+  std::vector<float> spectra, misfits(n_bands);
+  std::vector<double> band_diff, band_0;
+  _progress.start("spectral misfits", _param._col_end - _param._col_beg,
+                  "traces", 2. * n * sizeof(float));
+  for (int c = _param._col_beg; c < _param._col_end; c += chunk)
+  {
+    const int c_end = std::min(c + chunk, _param._col_end);
+    spectral_misfits(_data0, _data1, plan, _param._row_beg, _param._row_end,
+                     c, c_end, bands, spectra, band_diff, band_0, &_progress);
+    check_cancelled();
+    spec_out.write((const char*)&spectra[0], spectra.size() * sizeof(float));
+
+    for (int t = 0; t < c_end - c; ++t)
+    {
+      for (int b = 0; b < n_bands; ++b)
+      {
+        const double diff = band_diff[(size_t)t * n_bands + b];
+        const double ref = band_0[(size_t)t * n_bands + b];
+        const double misfit = (ref > 0. ? sqrt(diff / ref) : 0.);
+        misfits[b] = misfit;
+        if (misfit > max_misfit[b])
+        {
+          max_misfit[b] = misfit;
+          worst[b] = c + t;
+        }
+        total_diff[b] += diff;
+        total_0[b] += ref;
+      }
+      band_out.write((const char*)&misfits[0], n_bands * sizeof(float));
+
+      if (_param._verbose > 1)
+      {
+        std::cout << c + t;
+        for (int b = 0; b < n_bands; ++b)
+          std::cout << "\t" << d2s(misfits[b], 1, 12);
+        std::cout << "\n";
+      }
+    }
+  }
+  _progress.finish();
+  spec_out.close();
+  band_out.close();
+  spec_guard.complete();
+  band_guard.complete();
+
+  if (_param._verbose == 0)
+  {
+    for (int b = 0; b < n_bands; ++b)
+      std::cout << (b > 0 ? " " : "")
+                << (total_0[b] > 0. ? sqrt(total_diff[b] / total_0[b]) : 0.);
+    std::cout << std::endl;
+    return;
+  }
+
+  std::cout << "  resulting files: " << spec_name << " (" << n_bins << " bins "
+            << "x 3 per trace), " << band_name << " (" << n_bands << " bands "
+            << "per trace)\n"
+            << "  frequency step = " << df << ", Nyquist frequency = "
+            << 0.5 / _param._dt << "\n"
+            << "  relative L2 misfits of the spectra:\n";
+  for (int b = 0; b < n_bands; ++b)
+  {
+    const double misfit = (total_0[b] > 0. ? sqrt(total_diff[b] / total_0[b])
+                                           : 0.);
+    std::cout << "    " << add_space(names[b], 16)
+              << add_space("(bins " + d2s(bands[b].first) + " - " +
+                           d2s(bands[b].second) + ")", 22)
+              << misfit * 100 << " %, max " << max_misfit[b] * 100
+              << " % at trace " << worst[b] << "\n";
+  }
+  std::cout << std::flush;
+}
+
+
+
 void Compute::check_symmetry(float **data, const std::string &name) const
 {
   if (_param._verbose > 0)
     std::cout << "Check symmetry" << std::endl;
 
-//  int c_diff_0 = 0, c_diff_1 = 0;
-//  double max_diff = 0.0;
-  for (int c = 0; c < (_param._col_end - _param._col_beg) / 2; ++c)
+  std::vector<double> max_diff;
+  symmetry_differences(data, _param._row_beg, _param._row_end,
+                       _param._col_beg, _param._col_end, max_diff);
+
+  const int n_pairs = max_diff.size();
+  if (n_pairs == 0)
+  {
+    std::cout << "  " << name << ": there are no pairs of columns to compare"
+              << std::endl;
+    return;
+  }
+
+  if (_param._check_symmetry > 1)
+  {
+    for (int c = 0; c < n_pairs; ++c)
+      std::cout << "  " << name << ": diff " << max_diff[c] << " between "
+                   "columns " << _param._col_beg + c << " and "
+                << _param._col_end - 1 - c << "\n";
+  }
+
+  // the pairs sorted by the difference (the worst ones first)
+  std::vector<int> order(n_pairs);
+  for (int c = 0; c < n_pairs; ++c)
+    order[c] = c;
+  const int n_worst = std::min(_param._sym_worst, n_pairs);
+  std::partial_sort(order.begin(), order.begin() + std::max(n_worst, 1),
+                    order.end(), [&max_diff](int a, int b)
+                    { return max_diff[a] > max_diff[b]; });
+
+  double mean_diff = 0.0;
+  for (int c = 0; c < n_pairs; ++c)
+    mean_diff += max_diff[c];
+  mean_diff /= n_pairs;
+
+  const int worst = order[0];
+  if (_param._verbose == 0) // with no verbosity we just print the numbers
+  {
+    std::cout << max_diff[worst] << " " << mean_diff << std::endl;
+    return;
+  }
+
+  std::cout << "  " << name << ": " << n_pairs << " pairs of columns\n"
+            << "    max diff  = " << max_diff[worst] << " between columns "
+            << _param._col_beg + worst << " and "
+            << _param._col_end - 1 - worst << "\n"
+            << "    mean diff = " << mean_diff << "\n";
+
+  // histogram of the differences by decades: [0, 1e-7), [1e-7, 1e-6), ...,
+  // [1e-1, 1), [1, inf)
+  const int min_decade = -7;
+  const int n_bins = 1 - min_decade + 1;
+  std::vector<int> histogram(n_bins, 0);
+  for (int c = 0; c < n_pairs; ++c)
+  {
+    int bin = 0;
+    if (max_diff[c] > 0.0)
+      bin = std::floor(std::log10(max_diff[c])) - min_decade + 1;
+    ++histogram[std::max(0, std::min(bin, n_bins - 1))];
+  }
+
+  std::cout << "    histogram of differences:\n";
+  for (int b = 0; b < n_bins; ++b)
+  {
+    const std::string lower = (b == 0 ? "0" : "1e" + d2s(min_decade + b - 1));
+    const std::string upper = (b == n_bins-1 ? "inf" : "1e" + d2s(min_decade+b));
+    std::cout << "      [" << add_space(lower + ", " + upper + ")", 12)
+              << histogram[b] << "\n";
+  }
+
+  if (n_worst > 0)
+  {
+    std::cout << "    worst pairs:\n";
+    for (int w = 0; w < n_worst; ++w)
+      std::cout << "      diff " << max_diff[order[w]] << " between columns "
+                << _param._col_beg + order[w] << " and "
+                << _param._col_end - 1 - order[w] << "\n";
+  }
+  std::cout.flush();
+}
+
+
+
+
+/// Sums of the sampled values x, y of a trace for the ratio estimates: of the
+/// values, of their squares and of their products
+struct RatioSums
+{
+  double x, y, xx, xy, yy;
+
+  void add(double x_value, double y_value)
+  {
+    x += x_value;
+    y += y_value;
+    xx += x_value * x_value;
+    xy += x_value * y_value;
+    yy += y_value * y_value;
+  }
+};
+
+
+
+/**
+ * Estimate the ratio sum(x) / sum(y) of the totals over the table of
+ * n_traces x n_rows values by the sample of n_sampled rows of every one of the
+ * traces given by their sums, and the half width of its 95% confidence
+ * interval. The variance is the one of the ratio estimator of the two-stage
+ * sampling (Cochran, 11.10): the traces are sampled from all of them, and the
+ * rows are sampled within every trace, so both the variability between the
+ * traces and the one along them count.
+ */
+static void estimate_ratio(const std::vector<RatioSums> &sums,
+                           int n_sampled,
+                           int n_traces,
+                           int n_rows,
+                           double &ratio,
+                           double &half_width)
+{
+  const int n = sums.size();
+  const int m = n_sampled;
+  double sum_x = 0., sum_y = 0.;
+  for (int j = 0; j < n; ++j)
+  {
+    sum_x += sums[j].x;
+    sum_y += sums[j].y;
+  }
+  ratio = sum_x / sum_y;
+
+  const double f1 = std::min(1., (double)n / n_traces);
+  const double f2 = std::min(1., (double)m / n_rows);
+  if (n < 2 || (m < 2 && f2 < 1.))
+  {
+    // one item tells nothing about the variance, all of them have no variance
+    half_width = (f1 == 1. && f2 == 1. ? 0. : HUGE_VAL);
+    return;
+  }
+
+  // the linearized values z = x - ratio * y: the variance of the means of the
+  // traces, and the mean of the variances within the traces
+  double s2_between = 0., s2_within = 0.;
+  for (int j = 0; j < n; ++j)
+  {
+    const RatioSums &t = sums[j];
+    const double mean = (t.x - ratio * t.y) / m;
+    const double squares = t.xx - 2. * ratio * t.xy + ratio * ratio * t.yy;
+    s2_between += mean * mean;
+    if (m > 1)
+      s2_within += std::max(0., squares - m * mean * mean) / (m - 1);
+  }
+  s2_between /= n - 1;
+  s2_within /= n;
+
+  const double mean_y = sum_y / ((double)n * m);
+  const double variance = ((1. - f1) * s2_between / n +
+                           f1 * (1. - f2) * s2_within / ((double)n * m)) /
+                          (mean_y * mean_y);
+  half_width = 1.96 * sqrt(variance);
+}
+
+
+
+/**
+ * Write RMS values of the traces into a binary file as pairs (trace, RMS).
+ */
+static void write_rms(const std::string &fname,
+                      int col_beg,
+                      const std::vector<double> &RMS)
+{
+  std::ofstream out(fname.c_str(), std::ios::binary);
+  require(out, "File '" + fname + "' can't be opened");
+
+  for (size_t i = 0; i < RMS.size(); ++i)
+  {
+    float val_x = col_beg + i;
+    float val_y = RMS[i];
+    out.write((char*)&val_x, sizeof(float));
+    out.write((char*)&val_y, sizeof(float));
+  }
+
+  out.close();
+}
+
+
+
+
+void Compute::vector_norms() const
+{
+  const std::vector<std::string> files0 = split(_param._vec_files_0, ',');
+  std::vector<std::string> files1;
+  if (_param._vec_files_1 != DEFAULT_FILE_NAME)
+    files1 = split(_param._vec_files_1, ',');
+
+  const int n_comp = files0.size();
+  const bool compare = !files1.empty();
+  require(n_comp > 0, "There are no components of the vector solution");
+
+  if (_param._verbose > 0)
+    std::cout << "Vector solution" << (compare ? "s" : "") << " with " << n_comp
+              << " components" << std::endl;
+
+  // readers of all components of the first and then the second solution
+  std::vector<std::shared_ptr<BlockReader> > readers;
+  for (int k = 0; k < n_comp; ++k)
+    readers.push_back(std::shared_ptr<BlockReader>(
+      new BlockReader(files0[k], _param._n_cols, _param._format,
+                      element_type(_param._type_0),
+                      byte_order(_param._endian_0),
+                      io_backend(_param._io), _param._queue_depth)));
+  for (size_t k = 0; k < files1.size(); ++k)
+    readers.push_back(std::shared_ptr<BlockReader>(
+      new BlockReader(files1[k], _param._n_cols, _param._format,
+                      element_type(_param._type_1),
+                      byte_order(_param._endian_1),
+                      io_backend(_param._io), _param._queue_depth)));
+
+  const int n_files = readers.size();
+  bool parallel_readers = false;
+  for (int f = 0; f < n_files; ++f)
+    parallel_readers = parallel_readers || readers[f]->is_parallel();
+
+  const int n_rows = readers[0]->n_rows();
+  const int n_cols = readers[0]->n_cols();
+  for (int f = 1; f < n_files; ++f)
+    require(readers[f]->n_rows() == n_rows && readers[f]->n_cols() == n_cols,
+            "The files '" + readers[0]->name() + "' and '" + readers[f]->name()
+            + "' have different length");
+
+  const int row_beg = _param._row_beg;
+  const int row_end = (_param._row_end < 0 ? n_rows : _param._row_end);
+  const int col_beg = _param._col_beg;
+  const int col_end = (_param._col_end < 0 ? n_cols : _param._col_end);
+  const int n_traces = col_end - col_beg;
+  require(row_end <= n_rows, "Last row for comparison (" + d2s(row_end) +
+          ") is out of range (0, " + d2s(n_rows) + "]");
+  require(col_end <= n_cols && col_beg < col_end, "The range of columns [" +
+          d2s(col_beg) + ", " + d2s(col_end) + ") is out of range [0, " +
+          d2s(n_cols) + ")");
+
+  // the masked samples are zeros (and the others are weighted) in all the
+  // components, and the blocks without any compared sample aren't read
+  std::unique_ptr<Mask> mask(new_mask(_param, n_rows, n_cols, row_beg, row_end,
+                                      col_beg, col_end));
+
+  // blocks of rows of all the files together take the default block size
+  const int block_rows = std::max(1, BlockReader::rows_per_block(n_cols) /
+                                     n_files);
+  std::vector<std::vector<float> > blocks(n_files,
+                                          std::vector<float>(block_rows*n_cols));
+
+  // sums of squared amplitudes for every trace of the two solutions
+  std::vector<double> ampl0(n_traces, 0.0), ampl1(n_traces, 0.0);
+
+  // sums of the components over the whole range (for cross correlation)
+  std::vector<double> sum0(n_comp, 0.0), sum1(n_comp, 0.0);
+
+  double l2_0 = 0., l2_1 = 0., l2_diff = 0.;
+  double l1_0 = 0., l1_1 = 0., l1_diff = 0.;
+  double cross = 0.;
+
+  const int chunk = 512; // traces processed by one thread at once
+  const int n_chunks = (n_traces + chunk - 1) / chunk;
+
+  for (int i_beg = row_beg; i_beg < row_end; i_beg += block_rows)
   {
-    const int c0 = _param._col_beg + c;
-    const int c1 = _param._col_end - 1 - c;
-    const double diff =
-        columns_differ(data, _param._row_beg, _param._row_end, c0, c1);
-//    if (diff > max_diff)
-//    {
-//      c_diff_0 = c0;
-//      c_diff_1 = c1;
-//      max_diff = diff;
-//    }
+    const int i_end = std::min(i_beg + block_rows, row_end);
+    if (mask && mask->masked(i_beg, i_end - i_beg))
+      continue;
+
+    // all the files are read in parallel (unless the readers use the threads
+    // themselves). The exceptions can't leave the parallel region, so we
+    // catch them here and rethrow afterwards
+    std::string error;
+#pragma omp parallel for schedule(static, 1) if(!parallel_readers)
+    for (int f = 0; f < n_files; ++f)
+    {
+      try
+      {
+        readers[f]->read_rows(i_beg, i_end, &blocks[f][0]);
+        if (mask)
+          mask->apply(&blocks[f][0], i_beg, i_end - i_beg);
+      }
+      catch (const std::exception &e)
+      {
+#pragma omp critical
+        error = e.what();
+      }
+    }
+    require(error.empty(), error);
+
+#pragma omp parallel for schedule(static) \
+    reduction(+:l2_0,l2_1,l2_diff,l1_0,l1_1,l1_diff,cross)
+    for (int ch = 0; ch < n_chunks; ++ch)
+    {
+      const int j_beg = col_beg + ch * chunk;
+      const int j_end = std::min(j_beg + chunk, col_end);
 
-    std::cout << "  " << name << ": diff " << diff << " between columns "
-              << c0 << " and " << c1 << std::endl;
+      std::vector<double> s0(n_comp, 0.0), s1(n_comp, 0.0);
+      std::vector<const float*> u0(n_comp), u1(n_comp);
+
+      for (int i = 0; i < i_end - i_beg; ++i)
+      {
+        for (int k = 0; k < n_comp; ++k)
+        {
+          u0[k] = &blocks[k][i * n_cols];
+          if (compare)
+            u1[k] = &blocks[n_comp + k][i * n_cols];
+        }
+
+        for (int j = j_beg; j < j_end; ++j)
+        {
+          double a2 = 0., b2 = 0., d2 = 0., ab = 0.;
+          for (int k = 0; k < n_comp; ++k)
+          {
+            const double a = u0[k][j];
+            a2 += a * a;
+            s0[k] += a;
+            if (compare)
+            {
+              const double b = u1[k][j];
+              b2 += b * b;
+              d2 += (a - b) * (a - b);
+              ab += a * b;
+              s1[k] += b;
+            }
+          }
+
+          ampl0[j - col_beg] += a2;
+          ampl1[j - col_beg] += b2;
+          l2_0 += a2;
+          l2_1 += b2;
+          l2_diff += d2;
+          l1_0 += sqrt(a2);
+          l1_1 += sqrt(b2);
+          l1_diff += sqrt(d2);
+          cross += ab;
+        }
+      }
+
+#pragma omp critical
+      for (int k = 0; k < n_comp; ++k)
+      {
+        sum0[k] += s0[k];
+        sum1[k] += s1[k];
+      }
+    }
+  }
+
+  //----------------------------------------------------------------------------
+  // RMS of the amplitude
+  //----------------------------------------------------------------------------
+  const int n_samples = row_end - row_beg;
+  for (int j = 0; j < n_traces; ++j)
+  {
+    ampl0[j] = sqrt(ampl0[j] / n_samples);
+    ampl1[j] = sqrt(ampl1[j] / n_samples);
+  }
+  rms_of_compared(mask.get(), col_beg, n_samples, ampl0);
+  rms_of_compared(mask.get(), col_beg, n_samples, ampl1);
+
+  const std::string fname0 = file_path(files0[0]) + "rms_" +
+                             file_stem(files0[0]) + "_ampl.bin";
+  write_rms(fname0, col_beg, ampl0);
+  std::cout << "  resulting file: " << fname0 << std::endl;
+  std::cout << "RMS_0: min = " << *std::min_element(ampl0.begin(), ampl0.end())
+            << " max " << *std::max_element(ampl0.begin(), ampl0.end()) << "\n";
+
+  if (!compare)
+    return;
+
+  const std::string fname1 = file_path(files1[0]) + "rms_" +
+                             file_stem(files1[0]) + "_ampl.bin";
+  write_rms(fname1, col_beg, ampl1);
+  std::cout << "  resulting file: " << fname1 << std::endl;
+  std::cout << "RMS_1: min = " << *std::min_element(ampl1.begin(), ampl1.end())
+            << " max " << *std::max_element(ampl1.begin(), ampl1.end()) << "\n";
 
+  //----------------------------------------------------------------------------
+  // norms of the difference and cross correlation
+  //----------------------------------------------------------------------------
+  const double n_values = (double)n_samples * n_traces;
+  double cov = cross, var0 = l2_0, var1 = l2_1;
+  for (int k = 0; k < n_comp; ++k)
+  {
+    cov  -= sum0[k] * sum1[k] / n_values;
+    var0 -= sum0[k] * sum0[k] / n_values;
+    var1 -= sum1[k] * sum1[k] / n_values;
   }
+  const double xcorrelation = cov / sqrt(var0 * var1);
+
+  l2_0 = sqrt(l2_0);
+  l2_1 = sqrt(l2_1);
+  l2_diff = sqrt(l2_diff);
 
-//  std::cout << "  " << name << ": max diff " << max_diff << " between columns "
-//            << c_diff_0 << " and " << c_diff_1 << std::endl;
+  const double l2_diff_rel = l2_diff / l2_0;
+  const double l1_diff_rel = l1_diff / l1_0;
+
+  if (_param._verbose > 1)
+  {
+    std::cout << "\nVector L2_0        = " << l2_0;
+    std::cout << "\nVector L2_1        = " << l2_1;
+    std::cout << "\nVector L2_diff_abs = " << l2_diff;
+    std::cout << "\nVector L2_diff_rel = " << l2_diff_rel
+              << " = " << l2_diff_rel * 100 << " %";
+    std::cout << "\nVector L1_0        = " << l1_0;
+    std::cout << "\nVector L1_1        = " << l1_1;
+    std::cout << "\nVector L1_diff_abs = " << l1_diff;
+    std::cout << "\nVector L1_diff_rel = " << l1_diff_rel
+              << " = " << l1_diff_rel * 100 << " %";
+    std::cout << "\nVector xcorrelation = " << xcorrelation << "\n";
+  }
+  else if (_param._verbose > 0)
+  {
+    std::cout << "\nVector L2_diff_rel = " << l2_diff_rel * 100 << " %";
+    std::cout << "\nVector L1_diff_rel = " << l1_diff_rel * 100 << " %";
+    std::cout << "\nVector xcorrelation = " << xcorrelation << "\n";
+  }
+  else
+  {
+    std::cout << l2_diff_rel * 100 << " " << l1_diff_rel * 100 << " "
+              << xcorrelation << "\n";
+  }
 }
 
+
+
+
+void Compute::preview() const
+{
+  const double t_begin = get_wall_time();
+
+  Pyramid pyr0(*_in0, _param._preview, _param._preview_cache);
+  Pyramid pyr1(*_in1, _param._preview, _param._preview_cache);
+  float **data0 = pyr0.rows();
+  float **data1 = pyr1.rows();
+
+  // the region of the comparison at the level of the pyramid
+  const int f = pyr0.factor();
+  const int row_beg = (_param._row_beg + f - 1) / f;
+  const int row_end = std::min((_param._row_end + f - 1) / f, pyr0.n_rows());
+  const int col_beg = (_param._col_beg + f - 1) / f;
+  const int col_end = std::min((_param._col_end + f - 1) / f, pyr0.n_cols());
+  require(row_beg < row_end && col_beg < col_end, "The region of the "
+          "comparison is too small for the preview at level " +
+          d2s(_param._preview));
+
+  if (_param._verbose > 0)
+    std::cout << "Preview at level " << _param._preview << " (every " << f
+              << "-th sample of every " << f << "-th trace, "
+              << (pyr0.cached() && pyr1.cached() ? "cached" : "built") << "):";
+
+  // the sums of every sampled trace, so that the variance of the estimates is
+  // found by the variability of the traces and along them
+  const int n_traces = col_end - col_beg;
+  const RatioSums zero = { 0., 0., 0., 0., 0. };
+  std::vector<RatioSums> l2_sums(n_traces, zero), l1_sums(n_traces, zero);
+  for (int i = row_beg; i < row_end; ++i)
+  {
+    for (int j = col_beg; j < col_end; ++j)
+    {
+      const double d0 = data0[i][j];
+      const double diff = d0 - data1[i][j];
+      l2_sums[j - col_beg].add(diff * diff, d0 * d0);
+      l1_sums[j - col_beg].add(fabs(diff), fabs(d0));
+    }
+  }
+
+  const int n_all_traces = _param._col_end - _param._col_beg;
+  const int n_all_rows = _param._row_end - _param._row_beg;
+  double l2, l2_half, l1, l1_half;
+  estimate_ratio(l2_sums, row_end - row_beg, n_all_traces, n_all_rows,
+                 l2, l2_half);
+  estimate_ratio(l1_sums, row_end - row_beg, n_all_traces, n_all_rows,
+                 l1, l1_half);
+
+  // the interval of the squared norm is converted into the one of the norm
+  const double l2_lo = sqrt(std::max(l2 - l2_half, 0.)) * 100;
+  const double l2_hi = sqrt(l2 + l2_half) * 100;
+  const double l1_lo = std::max(l1 - l1_half, 0.) * 100;
+  const double l1_hi = (l1 + l1_half) * 100;
+  l2 = sqrt(l2) * 100;
+  l1 *= 100;
+
+  if (_param._verbose > 0)
+  {
+    std::cout << "\nL2_diff_rel ~ " << l2 << " % (95% confidence interval ["
+              << l2_lo << ", " << l2_hi << "] %)";
+    std::cout << "\nL1_diff_rel ~ " << l1 << " % (95% confidence interval ["
+              << l1_lo << ", " << l1_hi << "] %)\n";
+  }
+  else
+    std::cout << l2 << " " << l2_lo << " " << l2_hi << " "
+              << l1 << " " << l1_lo << " " << l1_hi << "\n";
+
+  if (_param._cross_correlation != 0)
+  {
+    // the lags are taken at the level of the pyramid, so they are multiples
+    // of the decimation factor
+    const int lag_region = _param._lag_region / f;
+    const Arena::Mark mark = _arena.mark();
+    double *mu[2], *sigma[2];
+    for (int k = 0; k < 2; ++k)
+    {
+      mu[k] = _arena.allocate<double>(n_traces);
+      sigma[k] = _arena.allocate<double>(n_traces);
+    }
+    double *xcorrelation = _arena.allocate<double>(n_traces);
+    int n_values = 1;
+    if (_param._cross_correlation == 1)
+    {
+      trace_moments(data0, data1, row_beg, row_end, col_beg, col_end, mu,
+                    sigma, &_arena);
+      n_values = n_traces;
+    }
+
+    for (int lag = -lag_region; lag <= lag_region; ++lag)
+    {
+      if (_param._cross_correlation == 1)
+        x_correlation_by_traces(data0, data1, row_beg, row_end, col_beg,
+                                col_end, lag, mu, sigma, xcorrelation,
+                                &_arena);
+      else
+        x_correlation_whole(data0, data1, row_beg, row_end, col_beg, col_end,
+                            lag, xcorrelation[0]);
+
+      const double min_xcor = *std::min_element(xcorrelation,
+                                                xcorrelation + n_values);
+      const double max_xcor = *std::max_element(xcorrelation,
+                                                xcorrelation + n_values);
+      if (_param._verbose > 0)
+        std::cout << "  xcorrelation: lag = " << lag * f << " min = "
+                  << min_xcor << " max = " << max_xcor << "\n";
+      else
+        std::cout << min_xcor << " " << max_xcor << "\n";
+    }
+    _arena.release(mark);
+  }
+
+  if (_param._rms != 0)
+  {
+    std::vector<double> RMS_0, RMS_1;
+    if (_param._rms == 1)
+      compute_rms_diff_files(data0, data1, row_beg, row_end, col_beg, col_end,
+                             RMS_0, RMS_1);
+    else if (_param._rms == 2)
+      compute_rms_amplitude(data0, data1, row_beg, row_end, col_beg, col_end,
+                            RMS_0);
+    else // the sums of the squares of the difference are known already
+      for (int j = 0; j < n_traces; ++j)
+        RMS_0.push_back(sqrt(l2_sums[j].x / (row_end - row_beg)));
+
+    std::cout << (_param._rms == 1 ? "RMS_0" :
+                  _param._rms == 2 ? "RMS" : "RMS_diff") << ": min = "
+              << *std::min_element(RMS_0.begin(), RMS_0.end()) << " max "
+              << *std::max_element(RMS_0.begin(), RMS_0.end()) << "\n";
+    if (_param._rms == 1)
+      std::cout << "RMS_1: min = "
+                << *std::min_element(RMS_1.begin(), RMS_1.end()) << " max "
+                << *std::max_element(RMS_1.begin(), RMS_1.end()) << "\n";
+  }
+
+  if (_param._verbose > 0)
+    std::cout << "Preview time: " << get_wall_time() - t_begin << " sec"
+              << std::endl;
+  else
+    std::cout << std::flush;
+}
+
+
+
+/// Totals of a sampled block of rows (the values, the compared ones of them,
+/// and the sums), and after them the number of the pairs of the values and
+/// the sum of their products for every lag
+enum SampleTotal
+{
+  TOTAL_VALUES, TOTAL_LIVE, TOTAL_S2_0, TOTAL_S2_1, TOTAL_S2_DIFF, TOTAL_S1_0,
+  TOTAL_S1_DIFF, TOTAL_S_0, TOTAL_S_1, TOTAL_LAGS
+};
+
+/// Metric of the totals of a table (estimated by the sampled blocks)
+class SampledMetric
+{
+public:
+
+  enum Kind { L2_REL, L1_REL, RMS_DIFF, RMS_0, RMS_1, RMS_AMPLITUDE, XCOR };
+
+  SampledMetric(Kind kind, int lag_index = 0)
+    : _kind(kind), _lag_index(lag_index)
+  { }
+
+  double operator()(const std::vector<double> &t) const
+  {
+    // the RMS are of the compared values, and the correlation is of all of
+    // them (the other ones are zeros, as in the data in memory)
+    const double n = t[TOTAL_VALUES], n_live = t[TOTAL_LIVE];
+    switch (_kind)
+    {
+      case L2_REL:   return sqrt(t[TOTAL_S2_DIFF] / t[TOTAL_S2_0]);
+      case L1_REL:   return t[TOTAL_S1_DIFF] / t[TOTAL_S1_0];
+      case RMS_DIFF: return sqrt(t[TOTAL_S2_DIFF] / n_live);
+      case RMS_0:    return sqrt(t[TOTAL_S2_0] / n_live);
+      case RMS_1:    return sqrt(t[TOTAL_S2_1] / n_live);
+      case RMS_AMPLITUDE: return sqrt((t[TOTAL_S2_0] + t[TOTAL_S2_1]) / n_live);
+      case XCOR:
+      {
+        // normalized like x_correlation_whole()
+        const double mu0 = t[TOTAL_S_0] / n, mu1 = t[TOTAL_S_1] / n;
+        const double sigma0 = sqrt(t[TOTAL_S2_0] / n - mu0 * mu0);
+        const double sigma1 = sqrt(t[TOTAL_S2_1] / n - mu1 * mu1);
+        const double n_pairs = t[TOTAL_LAGS + 2 * _lag_index];
+        const double products = t[TOTAL_LAGS + 2 * _lag_index + 1];
+        return (products / n_pairs - mu0 * mu1) / (sigma0 * sigma1);
+      }
+    }
+    return 0.;
+  }
+
+protected:
+
+  Kind _kind;
+  int _lag_index;
+};
+
+
+
+void Compute::sample() const
+{
+  const double t_begin = get_wall_time();
+
+  // the sampled units are blocks of whole rows, so they are read by one
+  // positioned read each, and every trace is in every block. The blocks are
+  // drawn from the strata of the rows, so the divergences which are local in
+  // time aren't missed.
+  const int n_cols = _param._n_cols;
+  const int col_beg = _param._col_beg, col_end = _param._col_end;
+  const int n_traces = col_end - col_beg;
+  const int lag_region = (_param._cross_correlation != 0 ?
+                          _param._lag_region : 0);
+  const size_t row_bytes = (size_t)n_cols * (element_size(_in0->type()) +
+                                             element_size(_in1->type()));
+  const int unit_rows = std::max(std::max(1, (int)(2 * SAMPLE_UNIT_BYTES /
+                                                   row_bytes)),
+                                 4 * lag_region);
+  const int n_rows = _param._row_end - _param._row_beg;
+  const long long n_units = (n_rows + unit_rows - 1) / unit_rows;
+  const long long budget = _param._sample_budget * (1 << 20);
+  const long long unit_bytes = (long long)unit_rows * row_bytes;
+  const long long n_sample = std::max(2LL, budget / unit_bytes);
+  std::vector<long long> units, stratum_sizes;
+  std::vector<int> strata;
+  draw_stratified(n_units, n_sample, _param._seed, units, strata,
+                  stratum_sizes);
+
+  const int n_lags = 2 * lag_region + 1;
+  StratifiedSample sample(TOTAL_LAGS + 2 * n_lags, stratum_sizes);
+  std::vector<double> totals(sample.n_totals());
+  std::vector<float> rows0((size_t)unit_rows * n_cols);
+  std::vector<float> rows1((size_t)unit_rows * n_cols);
+  std::vector<double> trace_s2(n_traces, 0.); // of the sampled rows
+  std::vector<long long> trace_n(n_traces, 0);
+
+  for (size_t u = 0; u < units.size(); ++u)
+  {
+    const int beg = _param._row_beg + units[u] * unit_rows;
+    const int end = std::min(beg + unit_rows, _param._row_end);
+    const int n = end - beg;
+    std::fill(totals.begin(), totals.end(), 0.);
+    totals[TOTAL_VALUES] = (double)n * n_traces;
+    if (_mask && _mask->masked(beg, n))
+    {
+      // the block without compared values isn't read
+      std::fill(rows0.begin(), rows0.end(), 0.f);
+      std::fill(rows1.begin(), rows1.end(), 0.f);
+    }
+    else
+    {
+      _in0->read_rows(beg, end, &rows0[0]);
+      _in1->read_rows(beg, end, &rows1[0]);
+    }
+
+    // the values which aren't compared are zeros, and only the compared ones
+    // are counted
+    if (_mask)
+    {
+      _mask->apply(&rows0[0], beg, n);
+      _mask->apply(&rows1[0], beg, n);
+      for (int i = 0; i < n; ++i)
+      {
+        const Span *span_end = _mask->spans_end(beg + i);
+        for (const Span *span = _mask->spans_begin(beg + i); span != span_end;
+             ++span)
+        {
+          totals[TOTAL_LIVE] += span->end - span->beg;
+          for (int j = span->beg; j < span->end; ++j)
+            ++trace_n[j - col_beg];
+        }
+      }
+    }
+    else
+    {
+      totals[TOTAL_LIVE] = totals[TOTAL_VALUES];
+      for (int t = 0; t < n_traces; ++t)
+        trace_n[t] += n;
+    }
+    for (int i = 0; i < n; ++i)
+    {
+      const float *row0 = &rows0[(size_t)i * n_cols];
+      const float *row1 = &rows1[(size_t)i * n_cols];
+      for (int j = col_beg; j < col_end; ++j)
+      {
+        const double d0 = row0[j], d1 = row1[j], diff = d0 - d1;
+        totals[TOTAL_S2_0] += d0 * d0;
+        totals[TOTAL_S2_1] += d1 * d1;
+        totals[TOTAL_S2_DIFF] += diff * diff;
+        totals[TOTAL_S1_0] += fabs(d0);
+        totals[TOTAL_S1_DIFF] += fabs(diff);
+        totals[TOTAL_S_0] += d0;
+        totals[TOTAL_S_1] += d1;
+        trace_s2[j - col_beg] += diff * diff;
+      }
+    }
+
+    // the pairs of the lags are taken inside the block
+    for (int lag = -lag_region; lag <= lag_region && _param._cross_correlation;
+         ++lag)
+    {
+      const int i_beg = std::max(0, -lag), i_end = std::min(n, n - lag);
+      double products = 0.;
+      for (int i = i_beg; i < i_end; ++i)
+      {
+        const float *row0 = &rows0[(size_t)i * n_cols];
+        const float *row1 = &rows1[(size_t)(i + lag) * n_cols];
+        for (int j = col_beg; j < col_end; ++j)
+          products += (double)row0[j] * row1[j];
+      }
+      const int k = TOTAL_LAGS + 2 * (lag + lag_region);
+      totals[k] = (double)std::max(0, i_end - i_beg) * n_traces;
+      totals[k + 1] = products;
+    }
+    sample.add(strata[u], &totals[0]);
+  }
+
+  if (_param._verbose > 0)
+    std::cout << "Sample of " << units.size() << " of " << n_units
+              << " blocks of " << unit_rows << " rows (stratified over the "
+              << "rows, " << units.size() * unit_bytes / (1 << 20)
+              << " MB of the files):";
+
+  // the estimates are printed as the ones of the preview
+  double value, half;
+  sample.estimate(SampledMetric(SampledMetric::L2_REL), value, half);
+  const double l2 = value * 100, l2_lo = std::max(value - half, 0.) * 100,
+               l2_hi = (value + half) * 100;
+  sample.estimate(SampledMetric(SampledMetric::L1_REL), value, half);
+  const double l1 = value * 100, l1_lo = std::max(value - half, 0.) * 100,
+               l1_hi = (value + half) * 100;
+  if (_param._verbose > 0)
+  {
+    std::cout << "\nL2_diff_rel ~ " << l2 << " % (approx. 95% confidence "
+              << "interval [" << l2_lo << ", " << l2_hi << "] %)";
+    std::cout << "\nL1_diff_rel ~ " << l1 << " % (approx. 95% confidence "
+              << "interval [" << l1_lo << ", " << l1_hi << "] %)\n";
+  }
+  else
+    std::cout << l2 << " " << l2_lo << " " << l2_hi << " "
+              << l1 << " " << l1_lo << " " << l1_hi << "\n";
+
+  for (int lag = -lag_region; lag <= lag_region && _param._cross_correlation;
+       ++lag)
+  {
+    sample.estimate(SampledMetric(SampledMetric::XCOR, lag + lag_region),
+                    value, half);
+    if (_param._verbose > 0)
+      std::cout << "  xcorrelation (global): lag = " << lag << " value ~ "
+                << value << " (approx. 95% confidence interval ["
+                << value - half << ", " << value + half << "])\n";
+    else
+      std::cout << value << " " << value - half << " " << value + half << "\n";
+  }
+
+  if (_param._rms != 0)
+  {
+    const char *names[] = { "RMS_0", "RMS_1" };
+    const SampledMetric::Kind kinds[] = { SampledMetric::RMS_0,
+                                          SampledMetric::RMS_1 };
+    const int n_metrics = (_param._rms == 1 ? 2 : 1);
+    for (int m = 0; m < n_metrics; ++m)
+    {
+      const char *name = (_param._rms == 2 ? "RMS" :
+                          _param._rms == 3 ? "RMS_diff" : names[m]);
+      const SampledMetric::Kind kind =
+        (_param._rms == 2 ? SampledMetric::RMS_AMPLITUDE :
+         _param._rms == 3 ? SampledMetric::RMS_DIFF : kinds[m]);
+      sample.estimate(SampledMetric(kind), value, half);
+      if (_param._verbose > 0)
+        std::cout << name << " (all traces) ~ " << value << " (approx. "
+                  << "95% confidence interval [" << std::max(value - half, 0.)
+                  << ", " << value + half << "])\n";
+      else
+        std::cout << value << " " << std::max(value - half, 0.) << " "
+                  << value + half << "\n";
+    }
+
+    if (_param._rms == 3)
+    {
+      // every trace is in the sample, so a trace which diverges is seen (the
+      // dead traces aren't)
+      int worst = -1;
+      double rms_min = DBL_MAX, rms_max = 0.;
+      for (int t = 0; t < n_traces; ++t)
+      {
+        if (trace_n[t] == 0)
+          continue;
+        const double rms = sqrt(trace_s2[t] / trace_n[t]);
+        rms_min = std::min(rms_min, rms);
+        if (worst < 0 || rms > rms_max)
+        {
+          rms_max = rms;
+          worst = t;
+        }
+      }
+      if (_param._verbose > 0)
+        std::cout << "RMS_diff of the traces (sampled rows): min = " << rms_min
+                  << " max " << rms_max << " (trace " << col_beg + worst
+                  << ")\n";
+      else
+        std::cout << rms_min << " " << rms_max << "\n";
+    }
+  }
+
+  if (_param._verbose > 0)
+    std::cout << "Sampling time: " << get_wall_time() - t_begin << " sec"
+              << std::endl;
+  else
+    std::cout << std::flush;
+}
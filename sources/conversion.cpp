@@ -0,0 +1,123 @@
+#include "conversion.hpp"
+#include "utilities.hpp"
+
+#include <cstring>
+
+
+
+ElementType element_type(const std::string &name)
+{
+  if (name == "f32")  return FLOAT32;
+  if (name == "f64")  return FLOAT64;
+  if (name == "f16")  return FLOAT16;
+  if (name == "bf16") return BFLOAT16;
+  require(false, "Unknown type of the elements: '" + name + "'. The known "
+          "types are: f32, f64, f16, bf16");
+  return FLOAT32;
+}
+
+
+
+std::string element_type_name(ElementType type)
+{
+  switch (type)
+  {
+    case FLOAT32:  return "f32";
+    case FLOAT64:  return "f64";
+    case FLOAT16:  return "f16";
+    case BFLOAT16: return "bf16";
+  }
+  return "unknown";
+}
+
+
+
+
+ByteOrder byte_order(const std::string &name)
+{
+  if (name == "auto")   return ORDER_AUTO;
+  if (name == "guess")  return ORDER_GUESS;
+  if (name == "native") return ORDER_NATIVE;
+  if (name == "little") return ORDER_LITTLE;
+  if (name == "big")    return ORDER_BIG;
+  require(false, "Unknown order of bytes: '" + name + "'. The known orders "
+          "are: auto, guess, native, little, big");
+  return ORDER_AUTO;
+}
+
+
+
+bool need_swap(ByteOrder order)
+{
+  require(order != ORDER_AUTO && order != ORDER_GUESS, "The order of bytes "
+          "is not defined");
+  return ((order == ORDER_LITTLE &&  is_big_endian()) ||
+          (order == ORDER_BIG    && !is_big_endian()));
+}
+
+
+
+/**
+ * Whether the number has a reasonable exponent (or it's zero). The exponent
+ * of the given width starts at the given bit, and must be within the range
+ * around its bias. This range corresponds to 1e-12 - 1e12 for single and
+ * double precision.
+ */
+static bool is_plausible(uint64_t bits, int exponent_bit, int exponent_width,
+                         int range)
+{
+  const uint64_t magnitude = bits & ((1ULL << (exponent_bit + exponent_width))
+                                     - 1);
+  if (magnitude == 0)
+    return true;
+  const int bias = (1 << (exponent_width - 1)) - 1;
+  const int exponent = (bits >> exponent_bit) & ((1 << exponent_width) - 1);
+  return (exponent > bias - range && exponent < bias + range);
+}
+
+
+
+bool looks_swapped(const char *values, long long n_values, ElementType type)
+{
+  long long n_native = 0, n_swapped = 0;
+  for (long long i = 0; i < n_values; ++i)
+  {
+    uint64_t native = 0, swapped = 0;
+    switch (type)
+    {
+      case FLOAT32:
+      {
+        uint32_t v;
+        memcpy(&v, values + 4*i, 4);
+        native = v;
+        swapped = __builtin_bswap32(v);
+        n_native  += is_plausible(native,  23, 8, 40);
+        n_swapped += is_plausible(swapped, 23, 8, 40);
+        break;
+      }
+      case FLOAT64:
+      {
+        memcpy(&native, values + 8*i, 8);
+        swapped = __builtin_bswap64(native);
+        n_native  += is_plausible(native,  52, 11, 40);
+        n_swapped += is_plausible(swapped, 52, 11, 40);
+        break;
+      }
+      case FLOAT16:
+      case BFLOAT16:
+      {
+        uint16_t v;
+        memcpy(&v, values + 2*i, 2);
+        native = v;
+        swapped = __builtin_bswap16(v);
+        const int bit   = (type == FLOAT16 ? 10 : 7);
+        const int width = (type == FLOAT16 ? 5 : 8);
+        const int range = (type == FLOAT16 ? 10 : 40);
+        n_native  += is_plausible(native,  bit, width, range);
+        n_swapped += is_plausible(swapped, bit, width, range);
+        break;
+      }
+    }
+  }
+  return (n_swapped - n_native > n_values / 4);
+}
@@ -0,0 +1,401 @@
+#include "direct_reader.hpp"
+#include "utilities.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#if defined(__linux__)
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/syscall.h>
+  #include <unistd.h>
+#endif
+
+#if defined(HAVE_IO_URING)
+  #include <linux/io_uring.h>
+#endif
+
+
+
+IoBackend io_backend(const std::string &name)
+{
+  if (name == "stream") return IO_STREAM;
+  if (name == "direct") return IO_DIRECT;
+  if (name == "uring")  return IO_URING;
+  require(false, "Unknown backend of reading: '" + name + "'. The known "
+          "backends are: stream, direct, uring");
+  return IO_STREAM;
+}
+
+
+
+DirectReader::DirectReader(const std::string &filename, IoBackend backend,
+                           int queue_depth)
+  : _filename(filename),
+    _fd(-1),
+    _buffered_fd(-1),
+    _backend(backend),
+    _queue_depth(std::max(queue_depth, 1)),
+    _storage(),
+    _aligned(nullptr),
+    _aligned_beg(0),
+    _aligned_end(0),
+    _offset(0),
+    _n_bytes(0),
+    _buffer(nullptr),
+    _n_chunks(0),
+    _n_submitted(0),
+    _n_completed(0),
+    _n_in_flight(0),
+    _ring(-1),
+    _sq_map(nullptr),
+    _cq_map(nullptr),
+    _sqes(nullptr),
+    _sq_map_size(0),
+    _cq_map_size(0),
+    _sqes_size(0),
+    _sq_tail(nullptr),
+    _sq_mask(nullptr),
+    _sq_array(nullptr),
+    _cq_head(nullptr),
+    _cq_tail(nullptr),
+    _cq_mask(nullptr),
+    _cqes(nullptr),
+    _file_size(0)
+{
+#if defined(__linux__) && defined(O_DIRECT)
+  _fd = open(_filename.c_str(), O_RDONLY | O_DIRECT);
+  if (_fd < 0)
+  {
+    std::cerr << "Warning: the file '" << _filename << "' can't be read "
+                 "directly (" << strerror(errno) << "), it's read through "
+                 "the page cache\n";
+    return;
+  }
+  _file_size = lseek(_fd, 0, SEEK_END);
+
+  if (_backend == IO_URING && !setup_ring())
+  {
+    std::cerr << "Warning: io_uring isn't available, the file '" << _filename
+              << "' is read directly by pread()\n";
+    _backend = IO_DIRECT;
+  }
+#else
+  std::cerr << "Warning: the files can be read directly on Linux only, the "
+               "file '" << _filename << "' is read through the page cache\n";
+#endif
+}
+
+
+
+DirectReader::~DirectReader()
+{
+  drain();
+  release_ring();
+#if defined(__linux__)
+  if (_buffered_fd >= 0)
+    close(_buffered_fd);
+  if (_fd >= 0)
+    close(_fd);
+#endif
+}
+
+
+
+bool DirectReader::setup_ring()
+{
+#if defined(HAVE_IO_URING) && defined(__NR_io_uring_setup)
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  _ring = syscall(__NR_io_uring_setup, _queue_depth, &params);
+  if (_ring < 0)
+    return false;
+
+  _sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  _cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  const bool single = (params.features & IORING_FEAT_SINGLE_MMAP);
+  if (single)
+    _sq_map_size = _cq_map_size = std::max(_sq_map_size, _cq_map_size);
+
+  void *map = mmap(nullptr, _sq_map_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_SQ_RING);
+  _sq_map = (map == MAP_FAILED ? nullptr : map);
+  if (single)
+    _cq_map = _sq_map;
+  else
+  {
+    map = mmap(nullptr, _cq_map_size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_CQ_RING);
+    _cq_map = (map == MAP_FAILED ? nullptr : map);
+  }
+  _sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+  map = mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_SQES);
+  _sqes = (map == MAP_FAILED ? nullptr : map);
+  if (_sq_map == nullptr || _cq_map == nullptr || _sqes == nullptr)
+  {
+    release_ring();
+    return false;
+  }
+
+  char *sq = (char*)_sq_map;
+  char *cq = (char*)_cq_map;
+  _sq_tail = (unsigned*)(sq + params.sq_off.tail);
+  _sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+  _sq_array = (unsigned*)(sq + params.sq_off.array);
+  _cq_head = (unsigned*)(cq + params.cq_off.head);
+  _cq_tail = (unsigned*)(cq + params.cq_off.tail);
+  _cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+  _cqes = cq + params.cq_off.cqes;
+  _queue_depth = std::min(_queue_depth, (int)params.sq_entries);
+  return true;
+#else
+  return false;
+#endif
+}
+
+
+
+void DirectReader::release_ring()
+{
+#if defined(__linux__)
+  if (_sqes != nullptr)
+    munmap(_sqes, _sqes_size);
+  if (_cq_map != nullptr && _cq_map != _sq_map)
+    munmap(_cq_map, _cq_map_size);
+  if (_sq_map != nullptr)
+    munmap(_sq_map, _sq_map_size);
+  if (_ring >= 0)
+    close(_ring);
+#endif
+  _sqes = _cq_map = _sq_map = nullptr;
+  _ring = -1;
+}
+
+
+
+void DirectReader::chunk_range(int chunk, long long &offset,
+                               long long &size) const
+{
+  offset = _aligned_beg + (long long)chunk * DIRECT_CHUNK_BYTES;
+  size = std::min((long long)DIRECT_CHUNK_BYTES, _aligned_end - offset);
+}
+
+
+
+void DirectReader::start(long long offset, long long n_bytes, char *buffer)
+{
+  expect(_n_completed == _n_chunks, "The previous range of the file '" +
+         _filename + "' isn't finished");
+
+  _offset = offset;
+  _n_bytes = n_bytes;
+  _buffer = buffer;
+  _aligned_beg = offset / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT;
+  _aligned_end = (offset + n_bytes + DIRECT_ALIGNMENT - 1) / DIRECT_ALIGNMENT *
+                 DIRECT_ALIGNMENT;
+
+  // the buffer only grows, so the blocks of the same size reuse it
+  const size_t needed = _aligned_end - _aligned_beg + DIRECT_ALIGNMENT;
+  if (_storage.size() < needed)
+    _storage.resize(needed);
+  _aligned = &_storage[0];
+  _aligned += (DIRECT_ALIGNMENT - (size_t)_aligned % DIRECT_ALIGNMENT) %
+              DIRECT_ALIGNMENT;
+
+  _n_chunks = (_aligned_end - _aligned_beg + DIRECT_CHUNK_BYTES - 1) /
+              DIRECT_CHUNK_BYTES;
+  _n_submitted = _n_completed = _n_in_flight = 0;
+
+  if (_backend == IO_URING)
+    submit_chunks();
+  else
+  {
+    read_sync(_aligned_beg, _aligned_end - _aligned_beg);
+    _n_submitted = _n_completed = _n_chunks;
+  }
+}
+
+
+
+void DirectReader::finish()
+{
+  while (_n_completed < _n_chunks)
+  {
+    submit_chunks();
+    reap_chunks(true);
+  }
+  memcpy(_buffer, _aligned + (_offset - _aligned_beg), _n_bytes);
+}
+
+
+
+void DirectReader::read_sync(long long offset, long long size)
+{
+#if defined(__linux__)
+  // the end of the file may be before the aligned end of the range
+  char *dest = _aligned + (offset - _aligned_beg);
+  for (long long done = 0; done < size && offset + done < _file_size; )
+  {
+    const long long chunk = std::min(size - done,
+                                     (long long)DIRECT_CHUNK_BYTES);
+    const ssize_t n = pread(_fd, dest + done, chunk, offset + done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    require(n > 0, "The file '" + _filename + "' can't be read at " +
+            d2s(offset + done) + ": " + (n < 0 ? strerror(errno) :
+                                                 "unexpected end"));
+    done += n;
+    if ((offset + done) % DIRECT_ALIGNMENT != 0 && offset + done < _file_size)
+    {
+      // a short read of an unaligned length can't be continued directly
+      read_buffered(offset + done, size - done);
+      return;
+    }
+  }
+#else
+  (void)offset;
+  (void)size;
+#endif
+}
+
+
+
+void DirectReader::read_buffered(long long offset, long long size)
+{
+#if defined(__linux__)
+  if (_buffered_fd < 0)
+    _buffered_fd = open(_filename.c_str(), O_RDONLY);
+  require(_buffered_fd >= 0, "The file '" + _filename + "' can't be opened: "
+          + strerror(errno));
+
+  char *dest = _aligned + (offset - _aligned_beg);
+  size = std::min(size, _file_size - offset);
+  for (long long done = 0; done < size; )
+  {
+    const ssize_t n = pread(_buffered_fd, dest + done, size - done,
+                            offset + done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    require(n > 0, "The file '" + _filename + "' can't be read at " +
+            d2s(offset + done) + ": " + (n < 0 ? strerror(errno) :
+                                                 "unexpected end"));
+    done += n;
+  }
+#else
+  (void)offset;
+  (void)size;
+#endif
+}
+
+
+
+void DirectReader::submit_chunks()
+{
+#if defined(HAVE_IO_URING) && defined(__NR_io_uring_enter)
+  unsigned tail = *_sq_tail; // the program is the only producer
+  int n_new = 0;
+  while (_n_submitted < _n_chunks && _n_in_flight < _queue_depth)
+  {
+    long long offset, size;
+    chunk_range(_n_submitted, offset, size);
+    const unsigned index = tail & *_sq_mask;
+    io_uring_sqe *sqe = (io_uring_sqe*)_sqes + index;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = _fd;
+    sqe->off = offset;
+    sqe->addr = (unsigned long)(_aligned + (offset - _aligned_beg));
+    sqe->len = size;
+    sqe->user_data = _n_submitted;
+    _sq_array[index] = index;
+    ++tail;
+    ++_n_submitted;
+    ++_n_in_flight;
+    ++n_new;
+  }
+  if (n_new == 0)
+    return;
+
+  __atomic_store_n(_sq_tail, tail, __ATOMIC_RELEASE);
+  long res;
+  do
+    res = syscall(__NR_io_uring_enter, _ring, n_new, 0, 0, nullptr, 0);
+  while (res < 0 && errno == EINTR);
+  require(res == n_new, "The reads of the file '" + _filename + "' can't be "
+          "submitted: " + (res < 0 ? strerror(errno) : "the queue is full"));
+#endif
+}
+
+
+
+void DirectReader::reap_chunks(bool wait)
+{
+#if defined(HAVE_IO_URING) && defined(__NR_io_uring_enter)
+  if (wait)
+  {
+    long res;
+    do
+      res = syscall(__NR_io_uring_enter, _ring, 0, 1, IORING_ENTER_GETEVENTS,
+                    nullptr, 0);
+    while (res < 0 && errno == EINTR);
+    require(res >= 0, "The reads of the file '" + _filename + "' can't be "
+            "waited for: " + strerror(errno));
+  }
+
+  unsigned head = *_cq_head;
+  const unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; ++head)
+  {
+    const io_uring_cqe *cqe = (const io_uring_cqe*)_cqes + (head & *_cq_mask);
+    long long offset, size;
+    chunk_range(cqe->user_data, offset, size);
+    if (cqe->res == -EINVAL) // the kernel doesn't know IORING_OP_READ (< 5.6)
+      read_sync(offset, size);
+    else
+    {
+      require(cqe->res >= 0, "The file '" + _filename + "' can't be read at "
+              + d2s(offset) + ": " + strerror(-cqe->res));
+      // a short read, or the end of the file: the rest is read directly
+      // from an aligned offset, or through the page cache otherwise
+      if (cqe->res < size && cqe->res % DIRECT_ALIGNMENT == 0)
+        read_sync(offset + cqe->res, size - cqe->res);
+      else if (cqe->res < size && offset + cqe->res < _file_size)
+        read_buffered(offset + cqe->res, size - cqe->res);
+    }
+    ++_n_completed;
+    --_n_in_flight;
+  }
+  __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+#else
+  (void)wait;
+#endif
+}
+
+
+
+void DirectReader::drain()
+{
+#if defined(HAVE_IO_URING) && defined(__NR_io_uring_enter)
+  // the reads in flight fill _storage, so they are waited for before it's
+  // freed (if an exception is thrown between start() and finish()). The
+  // errors don't matter here.
+  while (_ring >= 0 && _n_in_flight > 0)
+  {
+    const long res = syscall(__NR_io_uring_enter, _ring, 0, 1,
+                             IORING_ENTER_GETEVENTS, nullptr, 0);
+    if (res < 0 && errno != EINTR)
+      break;
+    unsigned head = *_cq_head;
+    const unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head)
+    {
+      ++_n_completed;
+      --_n_in_flight;
+    }
+    __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+  }
+#endif
+}
@@ -0,0 +1,84 @@
+#include "fft.hpp"
+#include "utilities.hpp"
+
+#include <cmath>
+
+
+
+FftPlan::FftPlan(int length)
+  : _n(length),
+    _twiddles(),
+    _swaps()
+{
+  require(length > 0 && (length & (length - 1)) == 0, "The length of the FFT ("
+          + d2s(length) + ") must be a power of two");
+
+  // the twiddles of every stage are stored one after another, so they are
+  // read contiguously: the stage of the length len takes len/2 of them
+  for (int len = 2; len <= _n; len <<= 1)
+    for (int k = 0; k < len / 2; ++k)
+      _twiddles.push_back(std::polar(1.0, -2.0 * M_PI * k / len));
+
+  for (int i = 1, j = 0; i < _n; ++i)
+  {
+    int bit = _n >> 1;
+    for (; j & bit; bit >>= 1)
+      j ^= bit;
+    j ^= bit;
+    if (i < j)
+      _swaps.push_back(std::make_pair(i, j));
+  }
+}
+
+
+
+int FftPlan::next_power_of_two(int n)
+{
+  int p = 1;
+  while (p < n)
+    p <<= 1;
+  return p;
+}
+
+
+
+void FftPlan::forward(Complex *data) const
+{
+  for (size_t s = 0; s < _swaps.size(); ++s)
+    std::swap(data[_swaps[s].first], data[_swaps[s].second]);
+
+  // the products are written out by the components, since the operator of
+  // std::complex checks for infinities and NaNs, and it's much slower
+  const Complex *twiddles = &_twiddles[0];
+  for (int len = 2; len <= _n; twiddles += len / 2, len <<= 1)
+  {
+    const int half = len / 2;
+    for (int i = 0; i < _n; i += len)
+    {
+      Complex *a = data + i;
+      Complex *b = data + i + half;
+      for (int k = 0; k < half; ++k)
+      {
+        const Complex w = twiddles[k];
+        const double vr = b[k].real() * w.real() - b[k].imag() * w.imag();
+        const double vi = b[k].real() * w.imag() + b[k].imag() * w.real();
+        const double ur = a[k].real(), ui = a[k].imag();
+        a[k] = Complex(ur + vr, ui + vi);
+        b[k] = Complex(ur - vr, ui - vi);
+      }
+    }
+  }
+}
+
+
+
+void FftPlan::inverse(Complex *data) const
+{
+  // the inverse transform is the forward one of the conjugated sequence
+  for (int k = 0; k < _n; ++k)
+    data[k] = std::conj(data[k]);
+  forward(data);
+  const double scale = 1.0 / _n;
+  for (int k = 0; k < _n; ++k)
+    data[k] = Complex(data[k].real() * scale, -data[k].imag() * scale);
+}
@@ -0,0 +1,232 @@
+#include "frames.hpp"
+#include "utilities.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+#if defined(HAVE_ZLIB)
+  #include <zlib.h>
+#endif
+
+
+
+/**
+ * Check if the file begins with the given signature.
+ */
+static bool has_signature(const std::string &filename,
+                          const char *signature,
+                          int length)
+{
+  std::ifstream in(filename.c_str(), std::ios::binary);
+  if (!in)
+    return false;
+  std::vector<char> begin(length, 0);
+  in.read(&begin[0], length);
+  return (in.gcount() == length && memcmp(&begin[0], signature, length) == 0);
+}
+
+
+
+bool is_framed_file(const std::string &filename)
+{
+  return has_signature(filename, "L2Z1", 4);
+}
+
+
+
+bool is_gzip_file(const std::string &filename)
+{
+  return has_signature(filename, "\x1f\x8b", 2);
+}
+
+
+
+#if defined(HAVE_ZLIB)
+/**
+ * Compress the bytes by zlib with the given level.
+ */
+static void deflate_bytes(const char *bytes,
+                          long long n_bytes,
+                          int level,
+                          std::vector<char> &compressed,
+                          long long offset = 0)
+{
+  uLongf length = compressBound(n_bytes);
+  compressed.resize(offset + length);
+  const int ierr = compress2((Bytef*)&compressed[offset], &length,
+                             (const Bytef*)bytes, n_bytes, level);
+  require(ierr == Z_OK, "Compression of a frame failed with the code " +
+          d2s(ierr));
+  compressed.resize(offset + length);
+}
+
+
+
+/**
+ * Decompress the bytes compressed by zlib, the size of the result is known.
+ */
+static void inflate_bytes(const char *compressed,
+                          long long compressed_bytes,
+                          char *bytes,
+                          long long n_bytes)
+{
+  uLongf length = n_bytes;
+  const int ierr = uncompress((Bytef*)bytes, &length,
+                              (const Bytef*)compressed, compressed_bytes);
+  require(ierr == Z_OK && (long long)length == n_bytes, "Decompression of "
+          "a frame failed with the code " + d2s(ierr));
+}
+#endif
+
+
+
+/**
+ * Quantize the values with the step equal to the tolerance: the value v is
+ * represented by the integer q = round(v / tolerance), and q * tolerance
+ * differs from v by at most tolerance/2 (and the nearest single precision
+ * number to it is within the tolerance from v). The integers are stored as
+ * variable length codes of zigzag(q) + 1, i.e. a difference close to zero
+ * takes one byte, and these bytes are compressed very well afterwards. The
+ * code 0 marks a value which can't be quantized (too big or not finite), and
+ * it's followed by its 4 bytes as they are.
+ */
+static void quantize(const float *values,
+                     long long n_values,
+                     double tolerance,
+                     std::vector<unsigned char> &codes)
+{
+  const double max_quantum = 4.5e15; // integers up to 2^52 are exact in double
+  codes.clear();
+  codes.reserve(n_values);
+  for (long long i = 0; i < n_values; ++i)
+  {
+    const double q = std::floor(values[i] / tolerance + 0.5);
+    if (!(std::fabs(q) < max_quantum)) // including NaN
+    {
+      codes.push_back(0);
+      const unsigned char *bytes = (const unsigned char*)&values[i];
+      codes.insert(codes.end(), bytes, bytes + sizeof(float));
+      continue;
+    }
+    const int64_t n = (int64_t)q;
+    uint64_t code = ((uint64_t)n << 1) ^ (uint64_t)(n >> 63); // zigzag
+    ++code;
+    while (code >= 0x80)
+    {
+      codes.push_back((unsigned char)(code | 0x80));
+      code >>= 7;
+    }
+    codes.push_back((unsigned char)code);
+  }
+}
+
+
+
+/**
+ * Restore the values quantized by quantize().
+ */
+static void dequantize(const unsigned char *codes,
+                       long long n_codes,
+                       double tolerance,
+                       float *values,
+                       long long n_values)
+{
+  long long c = 0;
+  for (long long i = 0; i < n_values; ++i)
+  {
+    require(c < n_codes, "The quantized frame is corrupted");
+    if (codes[c] == 0)
+    {
+      require(c + 1 + (long long)sizeof(float) <= n_codes, "The quantized "
+              "frame is corrupted");
+      memcpy(&values[i], &codes[c+1], sizeof(float));
+      c += 1 + sizeof(float);
+      continue;
+    }
+    uint64_t code = 0;
+    int shift = 0;
+    while (codes[c] & 0x80)
+    {
+      code |= (uint64_t)(codes[c++] & 0x7f) << shift;
+      shift += 7;
+      require(c < n_codes && shift < 64, "The quantized frame is corrupted");
+    }
+    code |= (uint64_t)codes[c++] << shift;
+    --code;
+    const int64_t n = (int64_t)(code >> 1) ^ -(int64_t)(code & 1);
+    values[i] = n * tolerance;
+  }
+}
+
+
+
+void compress_frame(FrameCodec codec,
+                    double tolerance,
+                    const char *frame,
+                    long long frame_bytes,
+                    std::vector<char> &compressed)
+{
+  require(codec == CODEC_DEFLATE || codec == CODEC_QUANTIZED, "Unknown codec "
+          + d2s(codec));
+#if defined(HAVE_ZLIB)
+  if (codec == CODEC_DEFLATE)
+  {
+    deflate_bytes(frame, frame_bytes, Z_BEST_SPEED, compressed);
+    return;
+  }
+
+  // the number of the codes precedes the compressed codes
+  std::vector<unsigned char> codes;
+  quantize((const float*)frame, frame_bytes / sizeof(float), tolerance, codes);
+  const uint64_t n_codes = codes.size();
+  deflate_bytes((const char*)&codes[0], n_codes, Z_DEFAULT_COMPRESSION,
+                compressed, sizeof(n_codes));
+  memcpy(&compressed[0], &n_codes, sizeof(n_codes));
+#else
+  (void)tolerance;
+  (void)frame;
+  (void)frame_bytes;
+  (void)compressed;
+  require(false, "The program was built without zlib, compression is not "
+          "available");
+#endif
+}
+
+
+
+void decompress_frame(FrameCodec codec,
+                      double tolerance,
+                      const char *compressed,
+                      long long compressed_bytes,
+                      char *frame,
+                      long long frame_bytes)
+{
+  require(codec == CODEC_DEFLATE || codec == CODEC_QUANTIZED, "Unknown codec "
+          + d2s(codec));
+#if defined(HAVE_ZLIB)
+  if (codec == CODEC_DEFLATE)
+  {
+    inflate_bytes(compressed, compressed_bytes, frame, frame_bytes);
+    return;
+  }
+
+  uint64_t n_codes = 0;
+  require(compressed_bytes >= (long long)sizeof(n_codes), "The quantized "
+          "frame is corrupted");
+  memcpy(&n_codes, compressed, sizeof(n_codes));
+  std::vector<unsigned char> codes(n_codes);
+  inflate_bytes(compressed + sizeof(n_codes),
+                compressed_bytes - sizeof(n_codes), (char*)&codes[0], n_codes);
+  dequantize(&codes[0], n_codes, tolerance, (float*)frame,
+             frame_bytes / sizeof(float));
+#else
+  (void)tolerance;
+  (void)compressed;
+  (void)compressed_bytes;
+  (void)frame;
+  (void)frame_bytes;
+  require(false, "The program was built without zlib, decompression is not "
+          "available");
+#endif
+}
@@ -1,5 +1,8 @@
 #include "compute.hpp"
 #include "parameters.hpp"
+#include "progress.hpp"
+
+#include <iostream>
 
 int main(int argc, char **argv)
 {
@@ -12,8 +15,16 @@ int main(int argc, char **argv)
 
     param.check_parameters();
 
+    // the run stops cleanly by SIGINT and SIGTERM
+    cancel_on_signals();
+
     Compute c(param);
-    c.run();
+    return c.run();
+  }
+  catch (const Cancelled &e)
+  {
+    std::cerr << "\n" << e.what() << std::endl;
+    return EXIT_CANCELLED_BASE + e.signal_number();
   }
   catch (const std::exception &e)
   {
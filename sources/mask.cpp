@@ -0,0 +1,270 @@
+#include "mask.hpp"
+#include "utilities.hpp"
+
+#include <cfloat>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+
+
+static bool same_span(const Span &a, const Span &b)
+{
+  return a.beg == b.beg && a.end == b.end;
+}
+
+
+
+Mask::Mask(const std::string &weights_file,
+           const std::string &mute_file,
+           const std::string &bitmask_file,
+           int n_rows, int n_cols,
+           int row_beg, int row_end,
+           int col_beg, int col_end)
+  : _n_cols(n_cols),
+    _row_beg(row_beg),
+    _row_end(row_end),
+    _weights(n_cols, 1.),
+    _weighted(false),
+    _offsets(1, 0),
+    _spans(),
+    _patterns(),
+    _live_rows(1, 0),
+    _n_live(n_cols, 0)
+{
+  if (!weights_file.empty())
+    read_weights(weights_file);
+
+  std::vector<int> first(n_cols, 0), end(n_cols, n_rows);
+  if (!mute_file.empty())
+    read_mute(mute_file, n_rows, first, end);
+
+  const long long row_bytes = (n_cols + 7) / 8;
+  std::ifstream bitmask;
+  if (!bitmask_file.empty())
+  {
+    bitmask.open(bitmask_file.c_str(), std::ios::binary);
+    require(bitmask, "File '" + bitmask_file + "' can't be opened");
+    bitmask.seekg(0, std::ios::end);
+    require((long long)bitmask.tellg() == n_rows * row_bytes,
+            "The bitmask '" + bitmask_file + "' must have " + d2s(row_bytes) +
+            " bytes for every one of " + d2s(n_rows) + " rows");
+    bitmask.seekg(row_beg * row_bytes);
+  }
+
+  // without the bitmask the spans change only at the rows where the mute
+  // curve begins or ends, and the other rows repeat the previous ones
+  std::vector<int> changes(first.begin() + col_beg, first.begin() + col_end);
+  changes.insert(changes.end(), end.begin() + col_beg, end.begin() + col_end);
+  std::sort(changes.begin(), changes.end());
+  size_t next_change = 0;
+
+  // the patterns of the spans by their hashes
+  std::unordered_multimap<size_t, int> known;
+
+  std::vector<unsigned char> bits(row_bytes, 0xFF);
+  std::vector<Span> spans; // of the current row
+  int pattern = 0;
+  for (int i = row_beg; i < row_end; ++i)
+  {
+    bool changed = (i == row_beg);
+    if (bitmask.is_open())
+    {
+      bitmask.read((char*)&bits[0], row_bytes);
+      require(bitmask, "The bitmask '" + bitmask_file + "' can't be read");
+      changed = true;
+    }
+    while (next_change < changes.size() && changes[next_change] <= i)
+    {
+      changed = (changed || changes[next_change] == i);
+      ++next_change;
+    }
+
+    if (changed)
+    {
+      spans.clear();
+      for (int j = col_beg; j < col_end; )
+      {
+        // a run of the compared columns
+        const bool live = (_weights[j] != 0. && first[j] <= i && i < end[j] &&
+                           (bits[j / 8] >> (j % 8) & 1));
+        int k = j + 1;
+        while (k < col_end &&
+               (_weights[k] != 0. && first[k] <= i && i < end[k] &&
+                (bits[k / 8] >> (k % 8) & 1)) == live)
+          ++k;
+        if (live)
+        {
+          const Span span = { j, k };
+          spans.push_back(span);
+        }
+        j = k;
+      }
+      pattern = add_pattern(spans, known);
+    }
+
+    if (bitmask.is_open())
+      for (size_t s = 0; s < spans.size(); ++s)
+        for (int j = spans[s].beg; j < spans[s].end; ++j)
+          ++_n_live[j];
+    _patterns.push_back(pattern);
+    _live_rows.push_back(_live_rows.back() + !spans.empty());
+  }
+
+  if (!bitmask.is_open())
+  {
+    // the compared rows of the traces are known from the mute curve
+    for (int j = col_beg; j < col_end; ++j)
+      if (_weights[j] != 0.)
+        _n_live[j] = std::max(0, std::min(end[j], row_end) -
+                                 std::max(first[j], row_beg));
+  }
+}
+
+
+
+int Mask::add_pattern(const std::vector<Span> &spans,
+                      std::unordered_multimap<size_t, int> &known)
+{
+  size_t hash = spans.size();
+  for (size_t s = 0; s < spans.size(); ++s)
+    hash = (hash * 31 + spans[s].beg) * 31 + spans[s].end;
+
+  typedef std::unordered_multimap<size_t, int>::const_iterator Iterator;
+  const std::pair<Iterator, Iterator> same_hash = known.equal_range(hash);
+  for (Iterator it = same_hash.first; it != same_hash.second; ++it)
+  {
+    const int p = it->second;
+    const Span *beg = _spans.data() + _offsets[p];
+    if (_offsets[p + 1] - _offsets[p] == (long long)spans.size() &&
+        std::equal(spans.begin(), spans.end(), beg, same_span))
+      return p;
+  }
+
+  const int p = _offsets.size() - 1;
+  _spans.insert(_spans.end(), spans.begin(), spans.end());
+  _offsets.push_back(_spans.size());
+  known.insert(std::make_pair(hash, p));
+  return p;
+}
+
+
+
+long long Mask::n_live() const
+{
+  long long n = 0;
+  for (size_t j = 0; j < _n_live.size(); ++j)
+    n += _n_live[j];
+  return n;
+}
+
+
+
+void Mask::apply(float *rows, int row, int n_rows) const
+{
+  for (int i = std::max(row, _row_beg); i < std::min(row + n_rows, _row_end);
+       ++i)
+  {
+    float *values = rows + (size_t)(i - row) * _n_cols;
+    int j = 0;
+    for (const Span *span = spans_begin(i); span != spans_end(i); ++span)
+    {
+      for (; j < span->beg; ++j)
+        values[j] = 0.f;
+      if (_weighted)
+        for (; j < span->end; ++j)
+          values[j] *= _weights[j];
+      j = span->end;
+    }
+    for (; j < _n_cols; ++j)
+      values[j] = 0.f;
+  }
+}
+
+
+
+void Mask::read_weights(const std::string &filename)
+{
+  std::ifstream in(filename.c_str());
+  require(in, "File '" + filename + "' can't be opened");
+
+  std::string line;
+  for (int n_line = 1; std::getline(in, line); ++n_line)
+  {
+    if (line.empty() || line[0] == '#')
+      continue;
+    std::istringstream values(line);
+    std::vector<double> numbers;
+    double x;
+    while (values >> x)
+      numbers.push_back(x);
+    require((numbers.size() == 2 || numbers.size() == 3) && values.eof(),
+            "Wrong line " + d2s(n_line) + " of the weights '" + filename +
+            "': the lines are 'trace weight' or 'first_trace last_trace "
+            "weight'");
+
+    const int first = numbers[0];
+    const int last = numbers[numbers.size() - 2];
+    const double weight = numbers.back();
+    require(first >= 0 && first <= last && last < _n_cols, "Wrong traces on "
+            "the line " + d2s(n_line) + " of the weights '" + filename + "'");
+    require(weight >= 0. && weight <= DBL_MAX, "Wrong weight on the line " +
+            d2s(n_line) + " of the weights '" + filename + "'");
+    for (int j = first; j <= last; ++j)
+      _weights[j] = weight;
+  }
+
+  for (int j = 0; j < _n_cols; ++j)
+    _weighted = (_weighted || (_weights[j] != 0. && _weights[j] != 1.));
+}
+
+
+
+void Mask::read_mute(const std::string &filename, int n_rows,
+                     std::vector<int> &first, std::vector<int> &end) const
+{
+  std::ifstream in(filename.c_str());
+  require(in, "File '" + filename + "' can't be opened");
+
+  // the points of the curve: trace, first row, end row
+  std::vector<std::vector<double> > points;
+  std::string line;
+  for (int n_line = 1; std::getline(in, line); ++n_line)
+  {
+    if (line.empty() || line[0] == '#')
+      continue;
+    std::istringstream values(line);
+    std::vector<double> point;
+    double x;
+    while (values >> x)
+      point.push_back(x);
+    require((point.size() == 2 || point.size() == 3) && values.eof(),
+            "Wrong line " + d2s(n_line) + " of the mute curve '" + filename +
+            "': the lines are 'trace first_row [end_row]'");
+    if (point.size() == 2)
+      point.push_back(n_rows);
+    require(point[0] >= 0 && point[0] < _n_cols && point[1] <= point[2],
+            "Wrong point on the line " + d2s(n_line) + " of the mute curve '" +
+            filename + "'");
+    require(points.empty() || point[0] > points.back()[0], "The traces of the "
+            "mute curve '" + filename + "' must increase");
+    points.push_back(point);
+  }
+  require(!points.empty(), "The mute curve '" + filename + "' is empty");
+
+  size_t k = 0; // the segment [points[k], points[k + 1]] of the trace
+  for (int j = 0; j < _n_cols; ++j)
+  {
+    while (k + 1 < points.size() && points[k + 1][0] <= j)
+      ++k;
+    double f = points[k][1], e = points[k][2];
+    if (k + 1 < points.size() && j > points[k][0])
+    {
+      const double a = (j - points[k][0]) / (points[k + 1][0] - points[k][0]);
+      f += a * (points[k + 1][1] - f);
+      e += a * (points[k + 1][2] - e);
+    }
+    first[j] = std::max(0, std::min(n_rows, (int)floor(f + 0.5)));
+    end[j] = std::max(0, std::min(n_rows, (int)floor(e + 0.5)));
+  }
+}
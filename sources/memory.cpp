@@ -0,0 +1,312 @@
+#include "memory.hpp"
+#include "utilities.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#if defined(__linux__)
+  #include <sched.h>
+  #include <sys/mman.h>
+  #include <sys/syscall.h>
+  #include <unistd.h>
+#endif
+
+#if defined(_OPENMP)
+  #include <omp.h>
+#endif
+
+
+
+/// The size of the huge pages (the default one of x86-64 and ARM64)
+static const size_t HUGE_PAGE_BYTES = 2 << 20;
+
+/// The size of the usual pages
+static const size_t SMALL_PAGE_BYTES = 4096;
+
+/// The policy of mbind() which interleaves the pages between the nodes
+static const int MPOL_INTERLEAVE_MODE = 3;
+
+
+
+PagePolicy page_policy(const std::string &name)
+{
+  if (name == "small") return PAGES_SMALL;
+  if (name == "thp")   return PAGES_TRANSPARENT;
+  if (name == "huge")  return PAGES_HUGE;
+  require(false, "Unknown pages: '" + name + "'. The known pages are: small, "
+          "thp, huge");
+  return PAGES_SMALL;
+}
+
+
+
+NumaPolicy numa_policy(const std::string &name)
+{
+  if (name == "default")    return NUMA_DEFAULT;
+  if (name == "interleave") return NUMA_INTERLEAVE;
+  if (name == "firsttouch") return NUMA_FIRST_TOUCH;
+  require(false, "Unknown NUMA placement: '" + name + "'. The known "
+          "placements are: default, interleave, firsttouch");
+  return NUMA_DEFAULT;
+}
+
+
+
+PinPolicy pin_policy(const std::string &name)
+{
+  if (name == "none")    return PIN_NONE;
+  if (name == "compact") return PIN_COMPACT;
+  if (name == "scatter") return PIN_SCATTER;
+  require(false, "Unknown binding of threads: '" + name + "'. The known "
+          "bindings are: none, compact, scatter");
+  return PIN_NONE;
+}
+
+
+
+//==============================================================================
+//
+// LargeBuffer
+//
+//==============================================================================
+LargeBuffer::LargeBuffer(size_t n_rows, size_t row_bytes, PagePolicy pages,
+                         NumaPolicy numa)
+  : _data(nullptr),
+    _mapped(0),
+    _pages(pages)
+{
+  const size_t bytes = std::max(n_rows * row_bytes, (size_t)1);
+
+#if defined(__linux__)
+  const size_t page = (pages == PAGES_SMALL ? SMALL_PAGE_BYTES :
+                                              HUGE_PAGE_BYTES);
+  _mapped = (bytes + page - 1) / page * page;
+
+  void *ptr = MAP_FAILED;
+#if defined(MAP_HUGETLB)
+  if (pages == PAGES_HUGE)
+  {
+    ptr = mmap(nullptr, _mapped, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr == MAP_FAILED)
+      std::cerr << "Warning: there are not enough huge pages in the pool of "
+                   "the system (see /proc/sys/vm/nr_hugepages), transparent "
+                   "huge pages are used\n";
+  }
+#endif
+  if (ptr == MAP_FAILED)
+  {
+    if (pages == PAGES_HUGE)
+      _pages = PAGES_TRANSPARENT;
+
+    // the mapping for the transparent huge pages is aligned to their size, so
+    // all its pages can be huge
+    const size_t align = (_pages == PAGES_TRANSPARENT ? HUGE_PAGE_BYTES : 0);
+    char *raw = (char*)mmap(nullptr, _mapped + align, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    require(raw != (char*)MAP_FAILED, "The buffer of " + d2s(bytes) +
+            " bytes can't be allocated");
+    char *aligned = raw;
+    if (align > 0)
+    {
+      aligned = (char*)(((size_t)raw + align - 1) / align * align);
+      if (aligned > raw)
+        munmap(raw, aligned - raw);
+      if (aligned + _mapped < raw + _mapped + align)
+        munmap(aligned + _mapped, raw + align - aligned);
+    }
+    ptr = aligned;
+
+#if defined(MADV_HUGEPAGE)
+    if (_pages == PAGES_TRANSPARENT && madvise(ptr, _mapped, MADV_HUGEPAGE))
+      std::cerr << "Warning: transparent huge pages aren't supported\n";
+#endif
+  }
+  _data = (char*)ptr;
+
+#if defined(SYS_mbind)
+  if (numa == NUMA_INTERLEAVE)
+  {
+    const std::vector<int> nodes = numa_nodes();
+    const size_t bits = 8 * sizeof(unsigned long);
+    std::vector<unsigned long> mask(nodes.back() / bits + 1, 0);
+    for (size_t k = 0; k < nodes.size(); ++k)
+      mask[nodes[k] / bits] |= 1UL << (nodes[k] % bits);
+    if (syscall(SYS_mbind, _data, _mapped, MPOL_INTERLEAVE_MODE, &mask[0],
+                mask.size() * bits + 1, 0) != 0)
+      std::cerr << "Warning: the pages can't be interleaved between the NUMA "
+                   "nodes\n";
+  }
+#endif
+
+  if (numa == NUMA_FIRST_TOUCH)
+  {
+    // the computations over the whole data give every thread a contiguous
+    // part of the traces (the static schedules of the stripes and the
+    // batches of traces), i.e. the same part of every row. So every page is
+    // touched by the thread which owns the part of the row where the middle
+    // of the page is (the pages cross the boundaries of the rows).
+    const size_t n_bytes = n_rows * row_bytes;
+#pragma omp parallel
+    {
+      size_t thread = 0, n_threads = 1;
+#if defined(_OPENMP)
+      thread = omp_get_thread_num();
+      n_threads = omp_get_num_threads();
+#endif
+      for (size_t b = 0; b < n_bytes; b += page)
+        if ((b + page / 2) % row_bytes * n_threads / row_bytes == thread)
+          _data[b] = 0;
+    }
+  }
+#else
+  // the buffer is allocated as usual, and the requests can't be fulfilled
+  if (pages != PAGES_SMALL || numa != NUMA_DEFAULT)
+    std::cerr << "Warning: huge pages and NUMA placement are supported on "
+                 "Linux only\n";
+  _pages = PAGES_SMALL;
+  _mapped = bytes;
+  _data = new char[bytes];
+#endif
+}
+
+
+
+LargeBuffer::~LargeBuffer()
+{
+#if defined(__linux__)
+  if (_data != nullptr)
+    munmap(_data, _mapped);
+#else
+  delete[] _data;
+#endif
+}
+
+
+
+//==============================================================================
+//
+// NUMA nodes and binding of the threads
+//
+//==============================================================================
+std::vector<int> parse_cpu_list(const std::string &list)
+{
+  std::vector<int> cpus;
+  const std::vector<std::string> ranges = split(list, ',');
+  for (size_t r = 0; r < ranges.size(); ++r)
+  {
+    int first = 0, last = 0;
+    char dash = 0;
+    std::istringstream in(ranges[r]);
+    in >> first;
+    require(!in.fail(), "Wrong list of CPUs: '" + list + "'");
+    last = first;
+    if (in >> dash)
+    {
+      require(dash == '-' && (in >> last), "Wrong list of CPUs: '" + list +
+              "'");
+    }
+    for (int c = first; c <= last; ++c)
+      cpus.push_back(c);
+  }
+  return cpus;
+}
+
+
+
+std::vector<int> numa_nodes()
+{
+  std::ifstream in("/sys/devices/system/node/online");
+  std::string list;
+  std::vector<int> nodes;
+  if (in >> list)
+    nodes = parse_cpu_list(list);
+  if (nodes.empty())
+    nodes.push_back(0);
+  return nodes;
+}
+
+
+
+void pin_threads(PinPolicy policy, int verbose)
+{
+  if (policy == PIN_NONE)
+    return;
+
+#if defined(__linux__)
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  require(sched_getaffinity(0, sizeof(allowed), &allowed) == 0, "The CPUs of "
+          "the process are unknown");
+
+  // the order of the CPUs for the consecutive threads: as they are numbered,
+  // or one from every node in turn
+  std::vector<int> order;
+  if (policy == PIN_SCATTER)
+  {
+    const std::vector<int> nodes = numa_nodes();
+    std::vector<std::vector<int> > node_cpus;
+    for (size_t n = 0; n < nodes.size(); ++n)
+    {
+      std::ifstream in(("/sys/devices/system/node/node" + d2s(nodes[n]) +
+                        "/cpulist").c_str());
+      std::string list;
+      std::vector<int> cpus;
+      if (in >> list)
+        cpus = parse_cpu_list(list);
+      std::vector<int> usable;
+      for (size_t c = 0; c < cpus.size(); ++c)
+        if (CPU_ISSET(cpus[c], &allowed))
+          usable.push_back(cpus[c]);
+      node_cpus.push_back(usable);
+    }
+    for (size_t k = 0; ; ++k)
+    {
+      bool any = false;
+      for (size_t n = 0; n < node_cpus.size(); ++n)
+      {
+        if (k < node_cpus[n].size())
+        {
+          order.push_back(node_cpus[n][k]);
+          any = true;
+        }
+      }
+      if (!any)
+        break;
+    }
+  }
+  if (order.empty()) // compact, or the nodes are unknown
+  {
+    for (int c = 0; c < CPU_SETSIZE; ++c)
+      if (CPU_ISSET(c, &allowed))
+        order.push_back(c);
+  }
+  require(!order.empty(), "There are no CPUs to bind the threads to");
+
+#pragma omp parallel
+  {
+    int thread = 0;
+#if defined(_OPENMP)
+    thread = omp_get_thread_num();
+#endif
+    cpu_set_t cpu;
+    CPU_ZERO(&cpu);
+    CPU_SET(order[thread % order.size()], &cpu);
+    const bool ok = (sched_setaffinity(0, sizeof(cpu), &cpu) == 0);
+#pragma omp critical
+    {
+      if (!ok)
+        std::cerr << "Warning: thread " << thread << " can't be bound to CPU "
+                  << order[thread % order.size()] << "\n";
+      else if (verbose > 1)
+        std::cout << "thread " << thread << " is bound to CPU "
+                  << order[thread % order.size()] << "\n";
+    }
+  }
+#else
+  (void)verbose;
+  std::cerr << "Warning: the threads can be bound on Linux only\n";
+#endif
+}
@@ -1,7 +1,12 @@
+#include "conversion.hpp"
+#include "direct_reader.hpp"
+#include "memory.hpp"
 #include "parameters.hpp"
+#include "progress.hpp"
 #include "utilities.hpp"
 
 #include <algorithm>
+#include <climits>
 #include <cstring>
 
 
@@ -18,6 +23,13 @@
 Parameters::Parameters(int argc, char **argv)
   : _file_0(DEFAULT_FILE_NAME),
     _file_1(DEFAULT_FILE_NAME),
+    _format("auto"),
+    _type_0("f32"),
+    _type_1("f32"),
+    _endian("auto"),
+    _endian_0(""),
+    _endian_1(""),
+    _out_endian("native"),
     _n_cols(0),
     _col_beg(0),
     _col_end(-1),
@@ -26,13 +38,54 @@ Parameters::Parameters(int argc, char **argv)
     _verbose(2),
     _l2l1(0),
     _diff_file(DEFAULT_FILE_NAME),
+    _pack_file(DEFAULT_FILE_NAME),
+    _diff_tolerance(0.0),
     _scale_file_1(0),
     _scale_factor(0.0),
     _shift_file_1(false),
     _cross_correlation(0),
     _lag_region(0),
     _rms(0),
-    _check_symmetry(false),
+    _win_len(0),
+    _win_hop(0),
+    _vec_files_0(DEFAULT_FILE_NAME),
+    _vec_files_1(DEFAULT_FILE_NAME),
+    _check_symmetry(0),
+    _sym_worst(10),
+    _preview(0),
+    _sample_budget(0.),
+    _seed(1),
+    _preview_cache(false),
+    _refine(true),
+    _tol_l2(-1.),
+    _tol_max(-1.),
+    _dtw_band(0),
+    _hilbert(false),
+    _spectrum(false),
+    _dt(1.),
+    _bands(""),
+    _stats(false),
+    _stats_worst(10),
+    _block_index(false),
+    _pages("small"),
+    _numa("default"),
+    _pin("none"),
+    _profile(false),
+    _io("stream"),
+    _queue_depth(8),
+    _checkpoint_file(DEFAULT_FILE_NAME),
+    _checkpoint_interval(60.),
+    _resume(false),
+    _weights_file(DEFAULT_FILE_NAME),
+    _mute_file(DEFAULT_FILE_NAME),
+    _mask_file(DEFAULT_FILE_NAME),
+    _progress("none"),
+    _progress_interval(1.),
+    _shard(0),
+    _n_shards(1),
+    _shard_by("rows"),
+    _partial_files(DEFAULT_FILE_NAME),
+    _merge(argc > 1 && strcmp(argv[1], "merge") == 0),
     _parameters(),
     _longest_string_key_len(DEFAULT_PRINT_LEN),
     _longest_string_value_len(DEFAULT_PRINT_LEN)
@@ -41,24 +94,78 @@ Parameters::Parameters(int argc, char **argv)
 
   _parameters["-f0"]    = ParamBasePtr(new OneParam<std::string>("file name for data 0 (reference solution or Ux (for -rms 2, for example))", &_file_0, ++p));
   _parameters["-f1"]    = ParamBasePtr(new OneParam<std::string>("file name for data 1 (solution to compare or Uz (for -rms 2, for example))", &_file_1, ++p));
-  _parameters["-ncols"] = ParamBasePtr(new OneParam<int>("number of columns in the files (number of traces - a column is a trace)", &_n_cols, ++p));
+  _parameters["-fmt"]   = ParamBasePtr(new OneParam<std::string>("format of the files: raw, su, segy, or auto (by the extension of each file)", &_format, ++p));
+  _parameters["-t0"]    = ParamBasePtr(new OneParam<std::string>("type of numbers in raw file 0: f32, f64, f16, bf16", &_type_0, ++p));
+  _parameters["-t1"]    = ParamBasePtr(new OneParam<std::string>("type of numbers in raw file 1: f32, f64, f16, bf16", &_type_1, ++p));
+  _parameters["-endian"]  = ParamBasePtr(new OneParam<std::string>("order of bytes in the input files: native, little, big, auto (by the headers, native for raw files), or guess (by the headers or the values)", &_endian, ++p));
+  _parameters["-endian0"] = ParamBasePtr(new OneParam<std::string>("order of bytes in input file 0 (the same values as -endian, which it overrides)", &_endian_0, ++p));
+  _parameters["-endian1"] = ParamBasePtr(new OneParam<std::string>("order of bytes in input file 1 (the same values as -endian, which it overrides)", &_endian_1, ++p));
+  _parameters["-oendian"] = ParamBasePtr(new OneParam<std::string>("order of bytes in the output raw files: native, little, big", &_out_endian, ++p));
+  _parameters["-ncols"] = ParamBasePtr(new OneParam<int>("number of columns in the files (number of traces - a column is a trace; taken from SU and SEG-Y files)", &_n_cols, ++p));
   _parameters["-c0"]    = ParamBasePtr(new OneParam<int>("first column for comparison", &_col_beg, ++p));
   _parameters["-c1"]    = ParamBasePtr(new OneParam<int>("last column for comparison (not including)", &_col_end, ++p));
   _parameters["-r0"]    = ParamBasePtr(new OneParam<int>("first row for comparison", &_row_beg, ++p));
   _parameters["-r1"]    = ParamBasePtr(new OneParam<int>("last row for comparison (not including)", &_row_end, ++p));
   _parameters["-v"]     = ParamBasePtr(new OneParam<int>("verbosity level (0 means very little output)", &_verbose, ++p));
   _parameters["-l2l1"]  = ParamBasePtr(new OneParam<int>("compute L2 and L1 norms of difference", &_l2l1, ++p));
-  _parameters["-df"]    = ParamBasePtr(new OneParam<std::string>("name of file with difference", &_diff_file, ++p));
+  _parameters["-df"]    = ParamBasePtr(new OneParam<std::string>("name of file with difference (compressed if the extension is .l2z)", &_diff_file, ++p));
+  _parameters["-dftol"] = ParamBasePtr(new OneParam<double>("if positive, the difference file (.l2z) is compressed with loss keeping the error of every value within this tolerance", &_diff_tolerance, ++p));
+  _parameters["-pack"]  = ParamBasePtr(new OneParam<std::string>("name of framed compressed file (.l2z) to create from data 0", &_pack_file, ++p));
   _parameters["-sc1"]   = ParamBasePtr(new OneParam<int>("scale data 1 with respect to data 0 (-sc1 1) or to scale factor (-sc1 2)", &_scale_file_1, ++p));
   _parameters["-sf"]    = ParamBasePtr(new OneParam<double>("scale factor for data 1 (used if -sc1 2)", &_scale_factor, ++p));
   _parameters["-sh1"]   = ParamBasePtr(new OneParam<bool>("shift data 1 with respect to data 0", &_shift_file_1, ++p));
   _parameters["-xcor"]  = ParamBasePtr(new OneParam<int>("compute cross correlation (-xcor 1 compute trace-by-trace and show min-max, -xcor 2 compute global)", &_cross_correlation, ++p));
   _parameters["-lag"]   = ParamBasePtr(new OneParam<int>("lag region for cross correlation computation", &_lag_region, ++p));
-  _parameters["-rms"]   = ParamBasePtr(new OneParam<int>("compute RMS of traces (-rms 1 compute RMS of data 0 and data 1 separately, -rms 2 treat data 0 and data 1 as components of vector field)", &_rms, ++p));
-  _parameters["-sym"]   = ParamBasePtr(new OneParam<bool>("check symmetry of the traces", &_check_symmetry, ++p));
+  _parameters["-rms"]   = ParamBasePtr(new OneParam<int>("compute RMS of traces (-rms 1 compute RMS of data 0 and data 1 separately, -rms 2 treat data 0 and data 1 as components of vector field, -rms 3 compute RMS of difference)", &_rms, ++p));
+  _parameters["-win"]   = ParamBasePtr(new OneParam<int>("length of time window (in rows) for time-gated RMS and L2 misfit of traces (0 means no computation)", &_win_len, ++p));
+  _parameters["-hop"]   = ParamBasePtr(new OneParam<int>("step (in rows) between the time windows (0 means that it's equal to the window length)", &_win_hop, ++p));
+  _parameters["-vf0"]   = ParamBasePtr(new OneParam<std::string>("comma separated files with components of vector solution 0 (e.g. ux0.bin,uy0.bin,uz0.bin)", &_vec_files_0, ++p));
+  _parameters["-vf1"]   = ParamBasePtr(new OneParam<std::string>("comma separated files with components of vector solution 1 to compare with solution 0", &_vec_files_1, ++p));
+  _parameters["-sym"]   = ParamBasePtr(new OneParam<int>("check symmetry of the traces (-sym 1 show summary, -sym 2 show also every pair of traces)", &_check_symmetry, ++p));
+  _parameters["-symtop"]= ParamBasePtr(new OneParam<int>("number of the worst pairs of traces shown in the summary of the symmetry check", &_sym_worst, ++p));
+  _parameters["-preview"] = ParamBasePtr(new OneParam<int>("level of decimated pyramid for quick estimates (every 2^level-th sample of every 2^level-th trace; 0 means no preview)", &_preview, ++p));
+  _parameters["-sample"]  = ParamBasePtr(new OneParam<double>("budget (in MB of the files) of the estimates of the metrics by random blocks of rows with confidence intervals (0 means no sampling)", &_sample_budget, ++p));
+  _parameters["-seed"]    = ParamBasePtr(new OneParam<int>("seed of the random blocks of rows of the sampling", &_seed, ++p));
+  _parameters["-pcache"]  = ParamBasePtr(new OneParam<bool>("cache the levels of pyramids on disk next to the files (<name>_pyr<level>.l2z)", &_preview_cache, ++p));
+  _parameters["-refine"]  = ParamBasePtr(new OneParam<bool>("compute at full resolution after the preview", &_refine, ++p));
+  _parameters["-tol-l2"]  = ParamBasePtr(new OneParam<double>("tolerance of relative L2 norm of difference: check only it (and -tol-max) and exit with code 0 (pass) or 3 (fail); negative means no check", &_tol_l2, ++p));
+  _parameters["-tol-max"] = ParamBasePtr(new OneParam<double>("tolerance of max absolute difference (see -tol-l2)", &_tol_max, ++p));
+  _parameters["-dtw"]     = ParamBasePtr(new OneParam<int>("half-width (in rows) of the band of dynamic time warping alignment of data 1 to data 0 (<f1>_dtw.bin, dtw_<f0>_<f1>.bin); 0 means no alignment", &_dtw_band, ++p));
+  _parameters["-hilbert"] = ParamBasePtr(new OneParam<bool>("compute envelope and instantaneous phase misfits of traces (hilbert_<f0>_<f1>.bin)", &_hilbert, ++p));
+  _parameters["-spec"]    = ParamBasePtr(new OneParam<bool>("compute amplitude spectra and phase differences of traces (spectrum_<f0>_<f1>.bin) and misfits in frequency bands (bands_<f0>_<f1>.bin)", &_spectrum, ++p));
+  _parameters["-dt"]      = ParamBasePtr(new OneParam<double>("time step between the rows (for the frequencies of the spectra)", &_dt, ++p));
+  _parameters["-bands"]   = ParamBasePtr(new OneParam<std::string>("comma separated frequency bands lo-hi for the spectral misfits (e.g. 0-10,10-20,20-40)", &_bands, ++p));
+  _parameters["-stats"]   = ParamBasePtr(new OneParam<bool>("compute statistics of difference: histograms, percentiles, misfits of traces (misfit_<f0>_<f1>.bin), worst locations", &_stats, ++p));
+  _parameters["-stattop"] = ParamBasePtr(new OneParam<int>("number of worst locations shown in the statistics of difference", &_stats_worst, ++p));
+  _parameters["-index"]   = ParamBasePtr(new OneParam<bool>("use (and build) the index of hashes of blocks of rows (<file>.l2i) to skip the blocks which are equal in both files", &_block_index, ++p));
+  _parameters["-pages"]   = ParamBasePtr(new OneParam<std::string>("pages of the whole data: small, thp (transparent huge pages), huge (explicit huge pages, see /proc/sys/vm/nr_hugepages)", &_pages, ++p));
+  _parameters["-numa"]    = ParamBasePtr(new OneParam<std::string>("placement of the whole data on the NUMA nodes: default, interleave, firsttouch (by the threads which process the rows)", &_numa, ++p));
+  _parameters["-pin"]     = ParamBasePtr(new OneParam<std::string>("binding of the threads to the CPUs: none, compact, scatter (the consecutive threads on the different NUMA nodes)", &_pin, ++p));
+  _parameters["-prof"]    = ParamBasePtr(new OneParam<bool>("print the profile of the run: time and heap allocations of every stage", &_profile, ++p));
+  _parameters["-io"]      = ParamBasePtr(new OneParam<std::string>("backend of reading the raw files: stream, direct (O_DIRECT, bypassing the page cache), uring (io_uring with O_DIRECT)", &_io, ++p));
+  _parameters["-qdepth"]  = ParamBasePtr(new OneParam<int>("number of the reads in flight of the io_uring backend", &_queue_depth, ++p));
+  _parameters["-ckpt"]    = ParamBasePtr(new OneParam<std::string>("file of the checkpoints of the streamed metrics and the lags of the cross correlation (removed when the run is complete)", &_checkpoint_file, ++p));
+  _parameters["-ckptint"] = ParamBasePtr(new OneParam<double>("interval between the checkpoints (in seconds)", &_checkpoint_interval, ++p));
+  _parameters["-resume"]  = ParamBasePtr(new OneParam<bool>("resume the run from the checkpoint (-ckpt)", &_resume, ++p));
+  _parameters["-weights"] = ParamBasePtr(new OneParam<std::string>("text file of the weights of the traces: lines 'trace weight' or 'first_trace last_trace weight' (0 excludes the traces)", &_weights_file, ++p));
+  _parameters["-mute"]    = ParamBasePtr(new OneParam<std::string>("text file of the mute curve: lines 'trace first_row [end_row]', interpolated between the traces (the rows [first_row, end_row) are compared)", &_mute_file, ++p));
+  _parameters["-mask"]    = ParamBasePtr(new OneParam<std::string>("bitmask of the compared samples: (n_cols + 7) / 8 bytes for every row, the lowest bit first", &_mask_file, ++p));
+  _parameters["-progress"] = ParamBasePtr(new OneParam<std::string>("progress of the long stages on stderr: none, text, json (a JSON object per line)", &_progress, ++p));
+  _parameters["-progint"]  = ParamBasePtr(new OneParam<double>("interval between the reports of the progress (in seconds)", &_progress_interval, ++p));
+  _parameters["-shard"]   = ParamBasePtr(new OneParam<int>("shard computed by this run (from 0)", &_shard, ++p));
+  _parameters["-nshards"] = ParamBasePtr(new OneParam<int>("number of shards of the run (the streamed metrics and the statistics are sharded)", &_n_shards, ++p));
+  _parameters["-shardby"] = ParamBasePtr(new OneParam<std::string>("split of the shards: rows, traces", &_shard_by, ++p));
+  _parameters["-partial"] = ParamBasePtr(new OneParam<std::string>("file of the partial results of the shard; for 'l2l1 merge <options of the shards>' the comma separated files of all the shards", &_partial_files, ++p));
 
   update_longest_string_key_len();
 
+  // "l2l1 merge <options>": the options follow the subcommand
+  if (_merge)
+  {
+    --argc;
+    ++argv;
+  }
+
   if (argc == 1 || argcheck(argc, argv, "-help") || argcheck(argc, argv, "-h"))
   {
     print_options();
@@ -67,7 +174,10 @@ Parameters::Parameters(int argc, char **argv)
 
   read_command_line(argc, argv);
 
-  if (_col_end < 0) _col_end = _n_cols;
+  if (_col_end < 0 && _n_cols > 0) _col_end = _n_cols;
+  if (_endian_0.empty()) _endian_0 = _endian;
+  if (_endian_1.empty()) _endian_1 = _endian;
+  if (_win_hop == 0) _win_hop = _win_len;
 
   update_longest_string_value_len();
 }
@@ -166,22 +276,43 @@ std::ostream& Parameters::print_parameters(std::ostream &out) const
 
 void Parameters::check_parameters() const
 {
-  if (_file_0.empty() || _file_0 == DEFAULT_FILE_NAME)
+  const bool vector_only = (_vec_files_0 != DEFAULT_FILE_NAME &&
+                            _file_0 == DEFAULT_FILE_NAME);
+  if (!vector_only && (_file_0.empty() || _file_0 == DEFAULT_FILE_NAME))
   {
     std::cerr << "\nFile0 with reference solution is empty or not defined\n\n";
     exit(1);
   }
-  if (_file_1.empty() || _file_1 == DEFAULT_FILE_NAME)
+  const bool pack_only = (_pack_file != DEFAULT_FILE_NAME);
+  if (!vector_only && !pack_only &&
+      (_file_1.empty() || _file_1 == DEFAULT_FILE_NAME))
   {
     std::cerr << "\nFile1 with solution for comparison is empty or not defined\n\n";
     exit(1);
   }
-  if (_n_cols <= 0)
+  if (_vec_files_1 != DEFAULT_FILE_NAME)
+  {
+    if (_vec_files_0 == DEFAULT_FILE_NAME)
+    {
+      std::cerr << "\nComponents of vector solution 1 are given, but the "
+                   "components of vector solution 0 are not\n\n";
+      exit(1);
+    }
+    if (split(_vec_files_0, ',').size() != split(_vec_files_1, ',').size())
+    {
+      std::cerr << "\nThe vector solutions have different number of "
+                   "components\n\n";
+      exit(1);
+    }
+  }
+  if (_n_cols < 0)
   {
     std::cerr << "\nNumber of columns of the data is wrong: " << _n_cols << "\n\n";
     exit(1);
   }
-  if (_col_end > _n_cols)
+  // if the number of columns is 0, it will be known from the files, and then
+  // the range of columns is checked
+  if (_n_cols > 0 && _col_end > _n_cols)
   {
     std::cerr << "\nLast column for comparison (" << _col_end << ") is out of "
                  "range (0, " << _n_cols << "]\n\n";
@@ -192,7 +323,7 @@ void Parameters::check_parameters() const
     std::cerr << "\nFirst column for comparison (" << _col_beg << ") must be >= 0\n\n";
     exit(1);
   }
-  if (_col_beg >= _col_end)
+  if (_n_cols > 0 && _col_beg >= _col_end)
   {
     std::cerr << "\nFirst column for comparison (" << _col_beg << ") must be less"
                  " than the last column for comparison (" << _col_end << ")\n\n";
@@ -210,6 +341,63 @@ void Parameters::check_parameters() const
     exit(1);
   }
 
+  if (_diff_tolerance < 0.0 || (_diff_tolerance > 0.0 &&
+                                file_extension(_diff_file) != ".l2z"))
+  {
+    std::cerr << "The tolerance of the difference file (" << _diff_tolerance
+              << ") must be >= 0, and if it's positive, the difference file ("
+              << _diff_file << ") must have the .l2z extension\n\n";
+    exit(1);
+  }
+
+  element_type(_type_0); // throws if the types are unknown
+  element_type(_type_1);
+  byte_order(_endian_0); // throws if the orders are unknown
+  byte_order(_endian_1);
+  require(byte_order(_out_endian) != ORDER_AUTO &&
+          byte_order(_out_endian) != ORDER_GUESS, "The order of bytes in the "
+          "output files can't be 'auto' or 'guess'");
+
+  page_policy(_pages);   // throws if the policies are unknown
+  numa_policy(_numa);
+  pin_policy(_pin);
+  io_backend(_io);
+  require(_queue_depth >= 1, "Unexpected value of -qdepth");
+  require(_checkpoint_interval >= 0., "Unexpected value of -ckptint");
+  require(!_resume || _checkpoint_file != DEFAULT_FILE_NAME, "The run can be "
+          "resumed only from the checkpoint file given by -ckpt");
+
+  require(_preview == 0 || (_weights_file == DEFAULT_FILE_NAME &&
+                            _mute_file == DEFAULT_FILE_NAME &&
+                            _mask_file == DEFAULT_FILE_NAME), "The preview "
+          "by the decimated pyramids can't be masked");
+
+  progress_format(_progress); // throws if the format is unknown
+  require(_progress_interval >= 0., "Unexpected value of -progint");
+
+  require(_n_shards >= 1 && _shard >= 0 && _shard < _n_shards, "Unexpected "
+          "values of -shard and -nshards");
+  require(_shard_by == "rows" || _shard_by == "traces", "Unknown split of the "
+          "shards: '" + _shard_by + "'. The known splits are: rows, traces");
+  if (_n_shards > 1 || _merge)
+  {
+    require(_partial_files != DEFAULT_FILE_NAME, "The partial results of the "
+            "shards need the files given by -partial");
+    require(_file_1 != DEFAULT_FILE_NAME && _pack_file == DEFAULT_FILE_NAME &&
+            _vec_files_0 == DEFAULT_FILE_NAME, "Only the comparison of two "
+            "files can be sharded");
+    require(!_scale_file_1 && !_shift_file_1 && _cross_correlation == 0 &&
+            (_rms == 0 || _rms == 3) && _win_len == 0 && !_check_symmetry &&
+            !_hilbert && !_spectrum && _dtw_band == 0 && _preview == 0 &&
+            _sample_budget == 0. && _tol_l2 < 0. && _tol_max < 0., "Only the "
+            "streamed metrics (-l2l1, -rms 3) and the statistics (-stats) can "
+            "be sharded");
+    require(_diff_file == DEFAULT_FILE_NAME || _diff_file.empty(), "The "
+            "difference file can't be written by the shards");
+    require(!_block_index, "The indexes of the blocks (-index) can't be "
+            "built by the shards, since they would write the same files");
+  }
+
   require(_l2l1 == 0 || _l2l1 == 1, "Unexpected value of -l2l1");
 
   if (_cross_correlation != 0 && _cross_correlation != 1 && _cross_correlation != 2)
@@ -226,7 +414,23 @@ void Parameters::check_parameters() const
     exit(1);
   }
 
-  require(_rms == 0 || _rms == 1 || _rms == 2, "Unexpected value of -rms");
+  require(_rms >= 0 && _rms <= 3, "Unexpected value of -rms");
+  require(_check_symmetry >= 0 && _check_symmetry <= 2, "Unexpected value of "
+          "-sym");
+  require(_sym_worst >= 0, "Unexpected value of -symtop");
+  require(_stats_worst >= 0, "Unexpected value of -stattop");
+  require(_dtw_band >= 0 && _dtw_band <= SHRT_MAX, "Unexpected value of -dtw");
+  require(_dt > 0., "The time step (-dt) must be positive");
+  require(_preview >= 0 && _preview <= 15, "Unexpected value of -preview");
+  require(_sample_budget >= 0., "Unexpected value of -sample");
+
+  if (_win_len < 0 || _win_hop < 0)
+  {
+    std::cerr << "The length of the time window (" << _win_len << ") and the "
+                 "step between the windows (" << _win_hop << ") should be "
+                 ">= 0\n\n";
+    exit(1);
+  }
 }
 
 
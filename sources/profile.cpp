@@ -0,0 +1,83 @@
+#include "profile.hpp"
+#include "utilities.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+
+
+/// The counters of the replaced operators new. They are updated by all the
+/// threads, but only if the profile is enabled (it's set before any thread
+/// starts), so the allocations without the profile don't touch the shared
+/// atomics.
+static bool count_heap = false;
+static std::atomic<size_t> n_heap_allocations(0);
+static std::atomic<size_t> n_heap_bytes(0);
+
+
+
+static void* counted_malloc(size_t bytes)
+{
+  if (count_heap)
+  {
+    n_heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    n_heap_bytes.fetch_add(bytes, std::memory_order_relaxed);
+  }
+  void *ptr = malloc(bytes == 0 ? 1 : bytes);
+  if (ptr == nullptr)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+void* operator new(size_t bytes)   { return counted_malloc(bytes); }
+void* operator new[](size_t bytes) { return counted_malloc(bytes); }
+void operator delete(void *ptr) noexcept   { free(ptr); }
+void operator delete[](void *ptr) noexcept { free(ptr); }
+
+
+
+HeapCounts heap_counts()
+{
+  HeapCounts counts;
+  counts.allocations = n_heap_allocations.load(std::memory_order_relaxed);
+  counts.bytes = n_heap_bytes.load(std::memory_order_relaxed);
+  return counts;
+}
+
+
+
+//==============================================================================
+//
+// Profile
+//
+//==============================================================================
+Profile::Profile(bool enabled)
+  : _enabled(enabled),
+    _start(get_wall_time()),
+    _heap()
+{
+  count_heap = (count_heap || enabled);
+  _heap = heap_counts();
+}
+
+
+
+void Profile::stage(const char *name)
+{
+  if (!_enabled)
+    return;
+
+  const double seconds = get_wall_time() - _start;
+  const HeapCounts heap = heap_counts();
+
+  std::cout << "profile: " << add_space(name, 24) << " time = "
+            << seconds << " sec, heap allocations = "
+            << heap.allocations - _heap.allocations << " ("
+            << heap.bytes - _heap.bytes << " bytes)" << std::endl;
+
+  // the printing isn't counted in the next stage
+  _heap = heap_counts();
+  _start = get_wall_time();
+}
@@ -0,0 +1,194 @@
+#include "progress.hpp"
+#include "utilities.hpp"
+
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+
+
+
+ProgressFormat progress_format(const std::string &name)
+{
+  if (name == "none") return PROGRESS_NONE;
+  if (name == "text") return PROGRESS_TEXT;
+  if (name == "json") return PROGRESS_JSON;
+  require(false, "Unknown format of the progress: '" + name + "'. The known "
+          "formats are: none, text, json");
+  return PROGRESS_NONE;
+}
+
+
+
+Progress::Progress(ProgressFormat format, double interval)
+  : _format(format),
+    _interval(interval),
+    _storage(),
+    _counters(nullptr),
+    _n_counters(1),
+    _stage(""),
+    _unit(""),
+    _n_total(0),
+    _item_bytes(0.),
+    _start(0.),
+    _last_report(0.),
+    _reported(false)
+{
+#if defined(_OPENMP)
+  _n_counters = omp_get_max_threads();
+#endif
+  _storage.resize((_n_counters + 1) * sizeof(Counter));
+  char *aligned = &_storage[0];
+  aligned += (CACHE_LINE_BYTES - (size_t)aligned % CACHE_LINE_BYTES) %
+             CACHE_LINE_BYTES;
+  _counters = (Counter*)aligned;
+  for (int t = 0; t < _n_counters; ++t)
+    new (&_counters[t]) Counter();
+}
+
+
+
+void Progress::start(const char *stage, long long n_total, const char *unit,
+                     double item_bytes)
+{
+  for (int t = 0; t < _n_counters; ++t)
+    _counters[t].n_items.store(0, std::memory_order_relaxed);
+  _stage = stage;
+  _unit = unit;
+  _n_total = n_total;
+  _item_bytes = item_bytes;
+  _start = _last_report = get_wall_time();
+  _reported = false;
+}
+
+
+
+void Progress::poll()
+{
+  if (_format == PROGRESS_NONE)
+    return;
+#if defined(_OPENMP)
+  if (omp_get_thread_num() != 0)
+    return;
+#endif
+  if (get_wall_time() - _last_report >= _interval)
+    report(false);
+}
+
+
+
+void Progress::finish()
+{
+  if (_format != PROGRESS_NONE && _reported)
+    report(true);
+}
+
+
+
+void Progress::report(bool finished)
+{
+  long long n_done = 0;
+  for (int t = 0; t < _n_counters; ++t)
+    n_done += _counters[t].n_items.load(std::memory_order_relaxed);
+
+  const double now = get_wall_time();
+  const double elapsed = now - _start;
+  const double rate = (elapsed > 0. ? n_done / elapsed : 0.);
+  const double eta = (rate > 0. ? (_n_total - n_done) / rate : -1.);
+  const double mb_per_s = rate * _item_bytes / (1 << 20);
+  _last_report = now;
+  _reported = true;
+
+  // the line is made first, so the lines of the stages aren't mixed
+  std::ostringstream line;
+  if (_format == PROGRESS_JSON)
+  {
+    line << "{\"stage\": \"" << _stage << "\", \"done\": " << n_done
+         << ", \"total\": " << _n_total << ", \"unit\": \"" << _unit
+         << "\", \"elapsed\": " << elapsed << ", \"rate\": " << rate;
+    if (_item_bytes > 0.)
+      line << ", \"mb_per_s\": " << mb_per_s;
+    line << ", \"eta\": " << std::max(eta, 0.) << ", \"finished\": "
+         << (finished ? "true" : "false") << "}\n";
+  }
+  else
+  {
+    line << std::fixed << std::setprecision(1) << "progress: " << _stage
+         << " " << n_done << "/" << _n_total << " " << _unit << " ("
+         << 100. * n_done / std::max(_n_total, 1LL) << " %), " << rate << " "
+         << _unit << "/s";
+    if (_item_bytes > 0.)
+      line << ", " << mb_per_s << " MB/s";
+    if (finished)
+      line << ", done in " << elapsed << " s\n";
+    else if (eta >= 0.)
+      line << ", ETA " << eta << " s\n";
+    else
+      line << ", ETA unknown\n";
+  }
+  std::cerr << line.str() << std::flush;
+}
+
+
+
+//==============================================================================
+//
+// Cancellation
+//
+//==============================================================================
+static volatile sig_atomic_t cancelling_signal = 0;
+
+extern "C" void cancel_handler(int signal_number)
+{
+  if (cancelling_signal != 0)
+  {
+    // the second signal isn't waited for
+    signal(signal_number, SIG_DFL);
+    raise(signal_number);
+    return;
+  }
+  cancelling_signal = signal_number;
+}
+
+
+
+Cancelled::Cancelled(int signal_number)
+  : std::runtime_error("The run is cancelled by the signal " +
+                       d2s(signal_number)),
+    _signal_number(signal_number)
+{ }
+
+
+
+void cancel_on_signals()
+{
+  signal(SIGINT, cancel_handler);
+  signal(SIGTERM, cancel_handler);
+}
+
+
+
+int cancel_signal()
+{
+  return cancelling_signal;
+}
+
+
+
+void check_cancelled()
+{
+  if (cancelling_signal != 0)
+    throw Cancelled(cancelling_signal);
+}
+
+
+
+OutputGuard::~OutputGuard()
+{
+  if (!_complete && remove(_filename.c_str()) == 0)
+    std::cerr << "Warning: the incomplete file '" << _filename << "' is "
+                 "removed\n";
+}
@@ -0,0 +1,131 @@
+#include "pyramid.hpp"
+#include "block_reader.hpp"
+#include "row_writer.hpp"
+#include "utilities.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <sys/stat.h>
+
+
+
+/// Time of the last modification of the file, or 0 if there is no such file
+static long long modification_time(const std::string &filename)
+{
+  struct stat st;
+  if (stat(filename.c_str(), &st) != 0)
+    return 0;
+  return st.st_mtime;
+}
+
+
+
+Pyramid::Pyramid(BlockReader &in, int level, bool use_cache)
+  : _level(level),
+    _n_rows((in.n_rows() + factor() - 1) / factor()),
+    _n_cols((in.n_cols() + factor() - 1) / factor()),
+    _cached(false),
+    _values((long long)_n_rows * _n_cols),
+    _rows(_n_rows)
+{
+  require(level > 0, "The level of the pyramid must be positive");
+  require(_n_rows > 0 && _n_cols > 0, "The file '" + in.name() + "' is empty");
+
+  for (int i = 0; i < _n_rows; ++i)
+    _rows[i] = &_values[(long long)i * _n_cols];
+
+  const std::string cache = cache_name(in.name(), level);
+  if (use_cache && read_cache(in.name(), cache))
+  {
+    _cached = true;
+    return;
+  }
+
+  build(in);
+
+  if (use_cache)
+    write_cache(cache);
+}
+
+
+
+std::string Pyramid::cache_name(const std::string &filename, int level)
+{
+  return file_path(filename) + file_stem(filename) + "_pyr" + d2s(level) +
+         ".l2z";
+}
+
+
+
+void Pyramid::build(BlockReader &in)
+{
+  const int f = factor();
+
+  // the files which can be read at any place are read by the needed rows
+  // only, the compressed ones are read by blocks
+  const bool random_access = (in.format() == FORMAT_RAW ||
+                              in.format() == FORMAT_SU ||
+                              in.format() == FORMAT_SEGY);
+  const int block_rows = (random_access ? 1 :
+                          std::max(f, BlockReader::rows_per_block(in.n_cols())
+                                      / f * f));
+
+  std::vector<float> block((long long)block_rows * in.n_cols());
+  for (int row_beg = 0; row_beg < in.n_rows(); row_beg += block_rows)
+  {
+    const int row_end = std::min(row_beg + block_rows, in.n_rows());
+    in.read_rows(row_beg, row_end, &block[0]);
+
+    // the blocks begin with the needed rows, since they are multiples of f
+    for (int i = row_beg; i < row_end; i += f)
+    {
+      const float *row = &block[(long long)(i - row_beg) * in.n_cols()];
+      float *out = _rows[i / f];
+      for (int j = 0; j < _n_cols; ++j)
+        out[j] = row[j * f];
+    }
+
+    if (random_access)
+      row_beg += f - 1;
+  }
+}
+
+
+
+bool Pyramid::read_cache(const std::string &filename, const std::string &cache)
+{
+  if (modification_time(cache) < modification_time(filename) ||
+      !file_exists(cache))
+    return false;
+
+  try
+  {
+    BlockReader in(cache, 0, "l2z");
+    if (in.n_rows() != _n_rows || in.n_cols() != _n_cols)
+      return false;
+    in.read_rows(0, _n_rows, &_values[0]);
+  }
+  catch (const std::exception&)
+  {
+    return false; // the cache is broken, so it's rebuilt
+  }
+  return true;
+}
+
+
+
+void Pyramid::write_cache(const std::string &cache) const
+{
+  // the preview doesn't fail, if the cache can't be written
+  try
+  {
+    FrameWriter out(cache, _n_cols);
+    out.write_rows(&_values[0], _n_rows);
+    out.close();
+  }
+  catch (const std::exception&)
+  {
+    std::cerr << "Warning: the pyramid can't be cached in '" << cache << "'\n";
+  }
+}
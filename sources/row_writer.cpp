@@ -0,0 +1,260 @@
+#include "row_writer.hpp"
+#include "utilities.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(_OPENMP)
+  #include <omp.h>
+#endif
+
+
+
+//==============================================================================
+//
+// RawWriter
+//
+//==============================================================================
+RawWriter::RawWriter(const std::string &filename,
+                     int n_cols,
+                     ByteOrder order,
+                     long long first_row)
+  : RowWriter(filename, n_cols),
+    _out(filename.c_str(), first_row > 0 ? std::ios::binary | std::ios::in |
+                                           std::ios::out : std::ios::binary),
+    _swap(need_swap(order)),
+    _swapped()
+{
+  require(_out, "File '" + _filename + "' can't be opened for writing");
+  if (first_row > 0)
+    _out.seekp(first_row * n_cols * sizeof(float));
+}
+
+
+
+RawWriter::~RawWriter()
+{
+  _out.close();
+}
+
+
+
+void RawWriter::write_rows(const float *rows, int n_rows)
+{
+  const long long n_values = (long long)n_rows * _n_cols;
+  if (_swap)
+  {
+    _swapped.assign(rows, rows + n_values);
+    byte_swap((char*)&_swapped[0], n_values, sizeof(float));
+    rows = &_swapped[0];
+  }
+  _out.write((const char*)rows, n_values * sizeof(float));
+  require(_out, "Writing to the file '" + _filename + "' failed");
+}
+
+
+
+void RawWriter::write_columns(const float *block, long long row, int n_rows,
+                              int col, int width)
+{
+  if (col == 0 && width == _n_cols)
+  {
+    _out.seekp(row * _n_cols * sizeof(float));
+    write_rows(block, n_rows);
+    return;
+  }
+  for (int i = 0; i < n_rows; ++i)
+  {
+    _out.seekp(((row + i) * _n_cols + col) * sizeof(float));
+    const float *values = block + (size_t)i * width;
+    if (_swap)
+    {
+      _swapped.assign(values, values + width);
+      byte_swap((char*)&_swapped[0], width, sizeof(float));
+      values = &_swapped[0];
+    }
+    _out.write((const char*)values, width * sizeof(float));
+    require(_out, "Writing to the file '" + _filename + "' failed");
+  }
+}
+
+
+
+void RawWriter::close()
+{
+  _out.close();
+}
+
+
+
+void RawWriter::flush()
+{
+  _out.flush();
+  require(_out, "Writing to the file '" + _filename + "' failed");
+}
+
+
+
+//==============================================================================
+//
+// FrameWriter
+//
+//==============================================================================
+FrameWriter::FrameWriter(const std::string &filename,
+                         int n_cols,
+                         FrameCodec codec,
+                         ElementType type,
+                         double tolerance)
+  : RowWriter(filename, n_cols),
+    _out(filename.c_str(), std::ios::binary),
+    _header(),
+    _offsets(),
+    _row_bytes((long long)n_cols * element_size(type)),
+    _pending(),
+    _n_pending(0),
+    _max_pending(0),
+    _closed(false)
+{
+  require(_out, "File '" + _filename + "' can't be opened for writing");
+
+  memcpy(_header.magic, "L2Z1", 4);
+  _header.version = 1;
+  _header.type = type;
+  _header.codec = codec;
+  _header.n_rows = 0;
+  _header.n_cols = n_cols;
+  _header.rows_per_frame = std::max(1LL, DEFAULT_FRAME_BYTES / _row_bytes);
+  _header.n_frames = 0;
+  _header.index_offset = 0;
+  _header.tolerance = tolerance;
+
+  require(codec != CODEC_QUANTIZED || (type == FLOAT32 && tolerance > 0.0),
+          "The quantized values must be in single precision, and the tolerance "
+          "must be positive");
+
+  int n_threads = 1;
+#if defined(_OPENMP)
+  n_threads = omp_get_max_threads();
+#endif
+  _max_pending = _header.rows_per_frame * n_threads;
+  _pending.resize(_max_pending * _row_bytes);
+
+  // the header is rewritten when all the frames are known
+  _out.write((const char*)&_header, sizeof(_header));
+  _offsets.push_back(sizeof(_header));
+}
+
+
+
+FrameWriter::~FrameWriter()
+{
+  if (!_closed)
+    _out.close(); // the file is incomplete
+}
+
+
+
+void FrameWriter::write_rows(const float *rows, int n_rows)
+{
+  require(_header.type == FLOAT32, "The file '" + _filename + "' is not in "
+          "single precision");
+  write_block((const char*)rows, n_rows);
+}
+
+
+
+void FrameWriter::write_block(const char *rows, int n_rows)
+{
+  while (n_rows > 0)
+  {
+    const long long n = std::min((long long)n_rows, _max_pending - _n_pending);
+    memcpy(&_pending[_n_pending * _row_bytes], rows, n * _row_bytes);
+    _n_pending += n;
+    rows += n * _row_bytes;
+    n_rows -= n;
+    if (_n_pending == _max_pending)
+      flush(false);
+  }
+}
+
+
+
+void FrameWriter::flush(bool last)
+{
+  const long long rpf = _header.rows_per_frame;
+  const int n_frames = (last ? (_n_pending + rpf - 1) / rpf
+                             : _n_pending / rpf);
+  std::vector<std::vector<char> > compressed(n_frames);
+
+  std::string error;
+#pragma omp parallel for schedule(dynamic)
+  for (int f = 0; f < n_frames; ++f)
+  {
+    const long long rows = std::min(rpf, _n_pending - f * rpf);
+    try
+    {
+      compress_frame((FrameCodec)_header.codec, _header.tolerance,
+                     &_pending[f * rpf * _row_bytes], rows * _row_bytes,
+                     compressed[f]);
+    }
+    catch (const std::exception &e)
+    {
+#pragma omp critical
+      error = e.what();
+    }
+  }
+  require(error.empty(), error);
+
+  for (int f = 0; f < n_frames; ++f)
+  {
+    _out.write(&compressed[f][0], compressed[f].size());
+    _offsets.push_back(_offsets.back() + compressed[f].size());
+  }
+  require(_out, "Writing to the file '" + _filename + "' failed");
+
+  // the rows of the incomplete frame go to the beginning
+  const long long n_written = std::min(_n_pending, n_frames * rpf);
+  _header.n_rows += n_written;
+  _header.n_frames += n_frames;
+  std::copy(_pending.begin() + n_written * _row_bytes,
+            _pending.begin() + _n_pending * _row_bytes, _pending.begin());
+  _n_pending -= n_written;
+}
+
+
+
+void FrameWriter::close()
+{
+  if (_closed)
+    return;
+
+  flush(true);
+
+  _header.index_offset = _offsets.back();
+  _out.write((const char*)&_offsets[0], _offsets.size() * sizeof(uint64_t));
+  _out.seekp(0, _out.beg);
+  _out.write((const char*)&_header, sizeof(_header));
+  require(_out, "Writing to the file '" + _filename + "' failed");
+  _out.close();
+  _closed = true;
+}
+
+
+
+std::shared_ptr<RowWriter> create_row_writer(const std::string &filename,
+                                             int n_cols,
+                                             double tolerance,
+                                             ByteOrder order,
+                                             long long first_row)
+{
+  expect(first_row == 0 || (tolerance <= 0.0 &&
+                            file_extension(filename) != ".l2z"),
+         "The framed file '" + filename + "' can't be continued");
+  if (tolerance > 0.0)
+    return std::shared_ptr<RowWriter>(
+      new FrameWriter(filename, n_cols, CODEC_QUANTIZED, FLOAT32, tolerance));
+  if (file_extension(filename) == ".l2z")
+    return std::shared_ptr<RowWriter>(new FrameWriter(filename, n_cols));
+  return std::shared_ptr<RowWriter>(new RawWriter(filename, n_cols, order,
+                                                  first_row));
+}
@@ -0,0 +1,115 @@
+#include "sampling.hpp"
+#include "utilities.hpp"
+
+#include <algorithm>
+#include <random>
+
+
+
+void draw_stratified(long long n_units,
+                     long long n,
+                     unsigned seed,
+                     std::vector<long long> &units,
+                     std::vector<int> &strata,
+                     std::vector<long long> &stratum_sizes)
+{
+  units.clear();
+  strata.clear();
+  stratum_sizes.clear();
+
+  if (n >= n_units)
+  {
+    for (long long u = 0; u < n_units; ++u)
+    {
+      units.push_back(u);
+      strata.push_back(0);
+    }
+    stratum_sizes.push_back(n_units);
+    return;
+  }
+
+  // the strata have n_units / n_strata units or one more, and the sample is
+  // split between them in the same way, so the sample of a stratum fits it
+  const long long n_strata = std::max(1LL, n / UNITS_PER_STRATUM);
+  std::mt19937 generator(seed);
+  std::vector<long long> drawn;
+  for (long long h = 0; h < n_strata; ++h)
+  {
+    const long long beg = n_units * h / n_strata;
+    const long long size = n_units * (h + 1) / n_strata - beg;
+    const long long n_h = std::min(size, n * (h + 1) / n_strata -
+                                         n * h / n_strata);
+    stratum_sizes.push_back(size);
+
+    // distinct units by Floyd's algorithm
+    drawn.clear();
+    for (long long j = size - n_h; j < size; ++j)
+    {
+      std::uniform_int_distribution<long long> any(0, j);
+      const long long u = any(generator);
+      drawn.push_back(std::find(drawn.begin(), drawn.end(), u) == drawn.end() ?
+                      u : j);
+    }
+    std::sort(drawn.begin(), drawn.end());
+    for (size_t k = 0; k < drawn.size(); ++k)
+    {
+      units.push_back(beg + drawn[k]);
+      strata.push_back(h);
+    }
+  }
+}
+
+
+
+double student_quantile_975(int degrees_of_freedom)
+{
+  static const double quantiles[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+  const int n = sizeof(quantiles) / sizeof(quantiles[0]);
+  require(degrees_of_freedom >= 1, "Unexpected degrees of freedom");
+  if (degrees_of_freedom <= n)
+    return quantiles[degrees_of_freedom - 1];
+  // the expansion in 1/df is accurate to 1e-3 after the table
+  const double x = 1.96, df = degrees_of_freedom;
+  return x + (x * x * x + x) / (4. * df) +
+         (5. * pow(x, 5) + 16. * x * x * x + 3. * x) / (96. * df * df);
+}
+
+
+
+StratifiedSample::StratifiedSample(int n_totals,
+                                   const std::vector<long long> &stratum_sizes)
+  : _n_totals(n_totals),
+    _stratum_sizes(stratum_sizes),
+    _units(stratum_sizes.size()),
+    _sums(stratum_sizes.size(), std::vector<double>(n_totals, 0.))
+{ }
+
+
+
+void StratifiedSample::add(int stratum, const double *totals)
+{
+  expect(stratum >= 0 && stratum < (int)_units.size(), "Unknown stratum " +
+         d2s(stratum));
+  _units[stratum].insert(_units[stratum].end(), totals, totals + _n_totals);
+  for (int k = 0; k < _n_totals; ++k)
+    _sums[stratum][k] += totals[k];
+}
+
+
+
+std::vector<double> StratifiedSample::totals() const
+{
+  std::vector<double> result(_n_totals, 0.);
+  for (size_t h = 0; h < _units.size(); ++h)
+  {
+    const int n_h = _units[h].size() / _n_totals;
+    if (n_h == 0)
+      continue;
+    for (int k = 0; k < _n_totals; ++k)
+      result[k] += (double)_stratum_sizes[h] * _sums[h][k] / n_h;
+  }
+  return result;
+}
@@ -0,0 +1,306 @@
+#include "statistics.hpp"
+#include "checkpoint.hpp"
+#include "conversion.hpp"
+#include "utilities.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+
+
+//==============================================================================
+//
+// DecadeHistogram
+//
+//==============================================================================
+DecadeHistogram::DecadeHistogram(int min_exp, int max_exp)
+  : _min_exp(min_exp),
+    _max_exp(max_exp),
+    _counts(max_exp - min_exp + 3, 0),
+    _n_nan(0),
+    _bounds()
+{
+  require(min_exp < max_exp, "Wrong range of the histogram");
+  for (int e = min_exp; e <= max_exp; ++e)
+    _bounds.push_back(pow(10., e));
+}
+
+
+
+int DecadeHistogram::bin(double value) const
+{
+  if (value < _bounds.front())
+    return 1;
+  if (value >= _bounds.back())
+    return _counts.size() - 1;
+
+  // the decade is estimated by the binary exponent and then corrected
+  int e2;
+  frexp(value, &e2);
+  int d = std::floor((e2 - 1) * 0.30102999566398120) - _min_exp;
+  d = std::max(0, std::min(d, (int)_bounds.size() - 2));
+  while (value >= _bounds[d + 1]) ++d;
+  while (value < _bounds[d]) --d;
+  return d + 2;
+}
+
+
+
+void DecadeHistogram::merge(const DecadeHistogram &other)
+{
+  for (size_t b = 0; b < _counts.size(); ++b)
+    _counts[b] += other._counts[b];
+  _n_nan += other._n_nan;
+}
+
+
+
+void DecadeHistogram::save(Checkpoint &checkpoint,
+                           const std::string &name) const
+{
+  // the counts are exact in double precision up to 2^53
+  std::vector<double> counts(_counts.begin(), _counts.end());
+  counts.push_back(_n_nan);
+  checkpoint.set(name, counts);
+}
+
+
+
+void DecadeHistogram::load(const Checkpoint &checkpoint,
+                           const std::string &name)
+{
+  const std::vector<double> &counts = checkpoint.values(name);
+  require(counts.size() == _counts.size() + 1, "Unexpected size of '" + name +
+          "'");
+  _counts.assign(counts.begin(), counts.end() - 1);
+  _n_nan = counts.back();
+}
+
+
+
+long long DecadeHistogram::n_values() const
+{
+  long long n = _n_nan;
+  for (size_t b = 0; b < _counts.size(); ++b)
+    n += _counts[b];
+  return n;
+}
+
+
+
+void DecadeHistogram::print(std::ostream &out, const std::string &indent) const
+{
+  const double n = std::max(1LL, n_values());
+  const int last = _counts.size() - 1;
+  for (int b = 0; b <= last; ++b)
+  {
+    if (_counts[b] == 0)
+      continue;
+    std::string range;
+    if (b == 0)
+      range = "[0]";
+    else if (b == 1)
+      range = "(0, 1e" + d2s(_min_exp) + ")";
+    else if (b == last)
+      range = "[1e" + d2s(_max_exp) + ", inf]";
+    else
+      range = "[1e" + d2s(_min_exp + b - 2) + ", 1e" + d2s(_min_exp + b - 1) +
+              ")";
+    out << indent << add_space(range, 18) << add_space(d2s(_counts[b]), 14)
+        << 100. * _counts[b] / n << " %\n";
+  }
+  if (_n_nan > 0)
+    out << indent << add_space("NaN", 18) << add_space(d2s(_n_nan), 14)
+        << 100. * _n_nan / n << " %\n";
+}
+
+
+
+//==============================================================================
+//
+// QuantileSketch
+//
+//==============================================================================
+QuantileSketch::QuantileSketch()
+  : _counts((0x7F800000u >> (23 - MANTISSA_BITS)), 0),
+    _n_zeros(0),
+    _n_nan(0)
+{ }
+
+
+
+int QuantileSketch::bucket(double value)
+{
+  // the bits of the positive floats grow with the values, so the upper bits
+  // are the number of the logarithmic bucket
+  const float f = std::min(value, (double)FLT_MAX);
+  return float_to_bits(f) >> (23 - MANTISSA_BITS);
+}
+
+
+
+void QuantileSketch::merge(const QuantileSketch &other)
+{
+  for (size_t b = 0; b < _counts.size(); ++b)
+    _counts[b] += other._counts[b];
+  _n_zeros += other._n_zeros;
+  _n_nan += other._n_nan;
+}
+
+
+
+void QuantileSketch::save(Checkpoint &checkpoint,
+                          const std::string &name) const
+{
+  std::vector<double> counts(_counts.begin(), _counts.end());
+  counts.push_back(_n_zeros);
+  counts.push_back(_n_nan);
+  checkpoint.set(name, counts);
+}
+
+
+
+void QuantileSketch::load(const Checkpoint &checkpoint,
+                          const std::string &name)
+{
+  const std::vector<double> &counts = checkpoint.values(name);
+  require(counts.size() == _counts.size() + 2, "Unexpected size of '" + name +
+          "'");
+  _counts.assign(counts.begin(), counts.end() - 2);
+  _n_zeros = counts[counts.size() - 2];
+  _n_nan = counts.back();
+}
+
+
+
+long long QuantileSketch::n_values() const
+{
+  long long n = _n_zeros;
+  for (size_t b = 0; b < _counts.size(); ++b)
+    n += _counts[b];
+  return n;
+}
+
+
+
+double QuantileSketch::quantile(double q) const
+{
+  const long long n = n_values();
+  if (n == 0)
+    return 0.;
+
+  // the rank of the quantile among the sorted values (from 1)
+  const long long rank = std::max(1LL, (long long)std::ceil(q * n));
+  long long seen = _n_zeros;
+  if (seen >= rank)
+    return 0.;
+  for (size_t b = 0; b < _counts.size(); ++b)
+  {
+    seen += _counts[b];
+    if (seen >= rank)
+    {
+      // the middle of the bucket (the last one has no upper bound)
+      const double lower = bits_to_float(b << (23 - MANTISSA_BITS));
+      if (b + 1 == _counts.size())
+        return lower;
+      const double upper = bits_to_float((b + 1) << (23 - MANTISSA_BITS));
+      return 0.5 * (lower + upper);
+    }
+  }
+  return FLT_MAX;
+}
+
+
+
+//==============================================================================
+//
+// WorstLocations
+//
+//==============================================================================
+/// Order of the min-heap of the locations
+static bool larger_value(const Location &a, const Location &b)
+{
+  return a.value > b.value;
+}
+
+
+
+WorstLocations::WorstLocations(int n_max)
+  : _n_max(n_max),
+    _heap(),
+    _threshold(n_max > 0 ? -HUGE_VAL : HUGE_VAL)
+{ }
+
+
+
+void WorstLocations::add(const Location &location)
+{
+  if (!(location.value > _threshold))
+    return;
+
+  if ((int)_heap.size() == _n_max)
+  {
+    std::pop_heap(_heap.begin(), _heap.end(), larger_value);
+    _heap.back() = location;
+  }
+  else
+    _heap.push_back(location);
+  std::push_heap(_heap.begin(), _heap.end(), larger_value);
+
+  if ((int)_heap.size() == _n_max)
+    _threshold = _heap.front().value;
+}
+
+
+
+void WorstLocations::merge(const WorstLocations &other)
+{
+  for (size_t k = 0; k < other._heap.size(); ++k)
+    add(other._heap[k]);
+}
+
+
+
+std::vector<Location> WorstLocations::sorted() const
+{
+  std::vector<Location> locations(_heap);
+  std::sort(locations.begin(), locations.end(), larger_value);
+  return locations;
+}
+
+
+
+void WorstLocations::save(Checkpoint &checkpoint,
+                          const std::string &name) const
+{
+  // the number of the locations first, so an empty heap is saved too
+  std::vector<double> values(1, _heap.size());
+  for (size_t k = 0; k < _heap.size(); ++k)
+  {
+    const Location &l = _heap[k];
+    const double location[] = { l.value, (double)l.row, (double)l.col,
+                                l.value0, l.value1 };
+    values.insert(values.end(), location, location + 5);
+  }
+  checkpoint.set(name, values);
+}
+
+
+
+void WorstLocations::load(const Checkpoint &checkpoint,
+                          const std::string &name)
+{
+  const std::vector<double> &values = checkpoint.values(name);
+  require(values.size() == 1 + 5 * (size_t)values[0], "Unexpected size of '" +
+          name + "'");
+  _heap.clear();
+  _threshold = (_n_max > 0 ? -HUGE_VAL : HUGE_VAL);
+  for (size_t k = 1; k < values.size(); k += 5)
+  {
+    const Location location = { values[k], (int)values[k + 1],
+                                (int)values[k + 2], values[k + 3],
+                                values[k + 4] };
+    add(location);
+  }
+}
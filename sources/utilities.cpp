@@ -1,9 +1,12 @@
+#include "conversion.hpp"
 #include "utilities.hpp"
 
 #if defined(__linux__) || defined(__APPLE__)
   #include <sys/time.h> // for time measurements
 #endif
 
+#include <sys/stat.h>
+
 #include <cerrno>
 #include <climits>
 #include <cstdlib>
@@ -185,6 +188,42 @@ bool file_exists(const std::string &path)
   return exists;
 }
 
+//------------------------------------------------------------------------------
+//
+// Check if the two paths refer to the same file
+//
+//------------------------------------------------------------------------------
+bool same_file(const std::string &path0, const std::string &path1)
+{
+  struct stat st0, st1;
+  if (stat(path0.c_str(), &st0) != 0 || stat(path1.c_str(), &st1) != 0)
+    return false;
+  return st0.st_dev == st1.st_dev && st0.st_ino == st1.st_ino;
+}
+
+//------------------------------------------------------------------------------
+//
+// Get the size of the file and the time of its last modification in
+// nanoseconds, which change when the file is rewritten. Return false if there
+// is no such file.
+//
+//------------------------------------------------------------------------------
+bool file_version(const std::string &path, long long &size, long long &time_ns)
+{
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0)
+    return false;
+  size = st.st_size;
+#if defined(__APPLE__)
+  time_ns = st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#elif defined(__linux__)
+  time_ns = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#else
+  time_ns = st.st_mtime * 1000000000LL;
+#endif
+  return true;
+}
+
 //------------------------------------------------------------------------------
 //
 // Get an absolute path according to the given relative one
@@ -217,7 +256,7 @@ bool is_big_endian()
     char c[sizeof(int)];
   } x;
   x.i = 1;
-  return x.c[0] == 1;
+  return x.c[0] == 0; // the least significant byte goes last
 }
 
 //------------------------------------------------------------------------------
@@ -260,6 +299,24 @@ std::string add_space(const std::string &str, int length)
   return str + std::string(n_spaces, ' ');
 }
 
+//------------------------------------------------------------------------------
+//
+// Split the string into the parts separated by the delimiter
+//
+//------------------------------------------------------------------------------
+std::vector<std::string> split(const std::string &str, char delimiter)
+{
+  std::vector<std::string> parts;
+  std::istringstream is(str);
+  std::string part;
+  while (std::getline(is, part, delimiter))
+  {
+    if (!part.empty())
+      parts.push_back(part);
+  }
+  return parts;
+}
+
 //------------------------------------------------------------------------------
 //
 // Get the info about memory consumption during the runtime
@@ -397,26 +454,27 @@ void read_binary(const std::string &filename,
 
   in.seekg(0, in.beg); // jump to the beginning of the file
 
+  require(size_value == sizeof(double) || size_value == sizeof(float),
+          "Uknown size of an element (" + d2s(size_value) + ") in bytes. "
+          "Expected one is either sizeof(float) = " + d2s(sizeof(float)) +
+          ", or sizeof(double) = " + d2s(sizeof(double)));
+
   if (size_value == sizeof(double))
   {
     in.read((char*)values, n_values*size_value); // read all at once
 
-    require(n_values == (int)in.gcount(), "The number of successfully read "
-            "elements is different from the expected one");
+    require(n_values*size_value == (int)in.gcount(), "The number of "
+            "successfully read elements is different from the expected one");
   }
-  else if (size_value == sizeof(float))
+  else
   {
-    float val = 0;
-    for (int i = 0; i < n_values; ++i)  // read element-by-element
-    {
-      in.read((char*)&val, size_value); // read a 'float' value
-      values[i] = val;                  // convert it to a 'double' value
-    }
+    // read all 'float' values at once and convert them to 'double' ones
+    std::vector<float> tmp(n_values);
+    in.read((char*)&tmp[0], n_values*size_value);
+    require(n_values*size_value == (int)in.gcount(), "The number of "
+            "successfully read elements is different from the expected one");
+    convert(&tmp[0], values, n_values);
   }
-  else require(false, "Uknown size of an element (" + d2s(size_value) + ") in "
-               "bytes. Expected one is either sizeof(float) = " +
-               d2s(sizeof(float)) + ", or sizeof(double) = " +
-               d2s(sizeof(double)));
 
   in.close();
 }